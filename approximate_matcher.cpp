@@ -0,0 +1,101 @@
+#include "approximate_matcher.h"
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+
+const size_t approximate_matcher::MAX_NEEDLE;
+const size_t approximate_matcher::stream::HISTORY;
+
+approximate_matcher::approximate_matcher(std::string needle, unsigned max_errors)
+        : needle(std::move(needle)), errors(max_errors) {
+    std::fill(peq, peq + 256, 0);
+    for (size_t i = 0; i < this->needle.size(); i++) {
+        peq[(unsigned char) this->needle[i]] |= uint64_t(1) << i;
+    }
+}
+
+size_t approximate_matcher::length() const {
+    return needle.size();
+}
+
+unsigned approximate_matcher::max_errors() const {
+    return errors;
+}
+
+approximate_matcher::stream::stream(approximate_matcher const& m)
+        : m(m), pv(~uint64_t(0)), mv(0), before(unsigned(m.needle.size())), score(unsigned(m.needle.size())) {}
+
+void approximate_matcher::stream::feed(const char* data, size_t size, std::vector<match>& out) {
+    uint64_t high = uint64_t(1) << (m.needle.size() - 1);
+    for (size_t i = 0; i < size; i++) {
+        auto c = (unsigned char) data[i];
+        history[size_t(consumed) % HISTORY] = c;
+        // one column of the distance matrix as vertical and horizontal deltas
+        uint64_t eq = m.peq[c];
+        uint64_t xv = eq | mv;
+        uint64_t xh = (((eq & pv) + pv) ^ pv) | eq;
+        uint64_t ph = mv | ~(xh | pv);
+        uint64_t mh = pv & xh;
+        unsigned next = score;
+        if (ph & high) {
+            next++;
+        } else if (mh & high) {
+            next--;
+        }
+        ph <<= 1;
+        mh <<= 1;
+        pv = mh | ~(xv | ph);
+        mv = ph & xv;
+        if (consumed > 0) {
+            decide(next, out);
+        }
+        before = score;
+        score = next;
+        consumed++;
+    }
+}
+
+void approximate_matcher::stream::finish(std::vector<match>& out) {
+    if (consumed > 0) {
+        decide(UINT_MAX, out);
+    }
+}
+
+void approximate_matcher::stream::decide(unsigned after, std::vector<match>& out) {
+    if (score <= m.errors && score <= before && score <= after) {
+        match found = align(consumed - 1);
+        if (found.position > last_start) {
+            last_start = found.position;
+            out.push_back(found);
+        }
+    }
+}
+
+approximate_matcher::match approximate_matcher::stream::align(int64_t end) const {
+    // distances of the needle's suffixes to the text ending at end, one more byte of text per column
+    std::string const& p = m.needle;
+    size_t n = p.size();
+    auto longest = (size_t) std::min<int64_t>(int64_t(n + m.errors), end + 1);
+    unsigned column[MAX_NEEDLE + 1];
+    for (size_t i = 0; i <= n; i++) {
+        column[i] = unsigned(i);
+    }
+    unsigned best = UINT_MAX;
+    size_t best_length = n;
+    for (size_t j = 1; j <= longest; j++) {
+        unsigned char t = history[size_t(end + 1 - int64_t(j)) % HISTORY];
+        unsigned diagonal = column[0];
+        column[0] = unsigned(j);
+        for (size_t i = 1; i <= n; i++) {
+            unsigned above = column[i];
+            column[i] = std::min(std::min(column[i], column[i - 1]) + 1, diagonal + (p[n - i] != char(t)));
+            diagonal = above;
+        }
+        // the alignment closest to the length of the needle among the best ones
+        if (column[n] < best || (column[n] == best && std::labs(long(j) - long(n)) < std::labs(long(best_length) - long(n)))) {
+            best = column[n];
+            best_length = j;
+        }
+    }
+    return match{end + 1 - int64_t(best_length), best};
+}
@@ -0,0 +1,64 @@
+#ifndef APPROXIMATE_MATCHER_H
+#define APPROXIMATE_MATCHER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Substrings within an edit distance of a needle of up to 64 bytes, found with
+// Myers' bit-parallel algorithm in one word of state per text byte. A match is
+// reported at every end whose distance is within the limit and not above the
+// distances at the ends next to it, from the start of its closest alignment.
+// Matches start in increasing order, one starting no later than the one before
+// it overlaps that one and is left out.
+class approximate_matcher {
+public:
+    static const size_t MAX_NEEDLE = 64;
+
+    struct match {
+        int64_t position;
+        unsigned distance;
+    };
+
+    // The needle must be longer than max_errors.
+    approximate_matcher(std::string needle, unsigned max_errors);
+
+    size_t length() const;
+    unsigned max_errors() const;
+
+    // One pass over a text, fed in chunks of any size.
+    class stream {
+    public:
+        explicit stream(approximate_matcher const& m);
+        // Appends the matches found so far, with positions from the start of the text.
+        void feed(const char* data, size_t size, std::vector<match>& out);
+        // Appends the match ending with the last byte, if there is one.
+        void finish(std::vector<match>& out);
+
+    private:
+        // the bytes an alignment of a reported end may start at
+        static const size_t HISTORY = 256;
+
+        approximate_matcher const& m;
+        uint64_t pv;
+        uint64_t mv;
+        // distance at the end before the last byte, and at the last byte
+        unsigned before;
+        unsigned score;
+        int64_t consumed = 0;
+        int64_t last_start = -1;
+        unsigned char history[HISTORY];
+
+        // Decides on the end before the last byte, now that the distance after it is known.
+        void decide(unsigned after, std::vector<match>& out);
+        match align(int64_t end) const;
+    };
+
+private:
+    std::string needle;
+    unsigned errors;
+    uint64_t peq[256];
+};
+
+#endif // APPROXIMATE_MATCHER_H
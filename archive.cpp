@@ -0,0 +1,388 @@
+#include "archive.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+namespace {
+    const size_t CHUNK = 64 * 1024;
+
+    uint16_t le16(const unsigned char* p) {
+        return uint16_t(p[0] | (p[1] << 8));
+    }
+
+    uint32_t le32(const unsigned char* p) {
+        return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24);
+    }
+
+    uint64_t le64(const unsigned char* p) {
+        return uint64_t(le32(p)) | (uint64_t(le32(p + 4)) << 32);
+    }
+
+    bool ends_with(std::string const& s, const char* suffix) {
+        size_t n = std::strlen(suffix);
+        if (s.size() < n) {
+            return false;
+        }
+        for (size_t i = 0; i < n; i++) {
+            if (std::tolower((unsigned char) s[s.size() - n + i]) != suffix[i]) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    const uint32_t EOCD = 0x06054b50;
+    const uint32_t ZIP64_LOCATOR = 0x07064b50;
+    const uint32_t ZIP64_EOCD = 0x06064b50;
+    const uint32_t CENTRAL_HEADER = 0x02014b50;
+    const uint32_t LOCAL_HEADER = 0x04034b50;
+    const uint16_t STORED = 0;
+    const uint16_t DEFLATED = 8;
+}
+
+const char archive_reader::SEPARATOR[] = "!/";
+
+archive_reader::archive_reader(std::string path) : path(std::move(path)), fd(-1), file_size(0), gzip(false) {}
+
+archive_reader::~archive_reader() {
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+bool archive_reader::is_archive(std::string const& path) {
+    return ends_with(path, ".zip") || ends_with(path, ".jar") || ends_with(path, ".war") ||
+           ends_with(path, ".ear") || ends_with(path, ".gz");
+}
+
+std::string archive_reader::virtual_path(std::string const& archive, std::string const& member) {
+    return archive + SEPARATOR + member;
+}
+
+bool archive_reader::split(std::string const& path, std::string& archive, std::string& member) {
+    // the first separator after an archive name, archives inside archives are not opened
+    for (size_t at = path.find(SEPARATOR); at != std::string::npos; at = path.find(SEPARATOR, at + 1)) {
+        if (is_archive(path.substr(0, at))) {
+            archive = path.substr(0, at);
+            member = path.substr(at + 2);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool archive_reader::fail(std::string const& message) {
+    last_error = message;
+    return false;
+}
+
+std::string const& archive_reader::error() const {
+    return last_error;
+}
+
+size_t archive_reader::members() const {
+    return listed ? listed->entries.size() : 0;
+}
+
+std::string const& archive_reader::name(size_t i) const {
+    return listed->entries[i].name;
+}
+
+bool archive_reader::read_at(uint64_t offset, void* buffer, size_t size) {
+    auto* out = static_cast<char*>(buffer);
+    while (size > 0) {
+        ssize_t n = pread(fd, out, size, (off_t) offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        out += n;
+        offset += (uint64_t) n;
+        size -= (size_t) n;
+    }
+    return true;
+}
+
+bool archive_reader::open(archive_cache* cache) {
+    fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return fail("Cannot open the archive");
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        return fail("Cannot open the archive");
+    }
+    file_size = (uint64_t) st.st_size;
+    auto d = std::make_shared<directory>();
+    if (ends_with(path, ".gz")) {
+        gzip = true;
+        size_t slash = path.rfind('/');
+        std::string name = path.substr(slash == std::string::npos ? 0 : slash + 1);
+        name.resize(name.size() - 3);
+        d->entries.push_back(member{name, DEFLATED, file_size, 0});
+        d->by_name.emplace(name, 0);
+        listed = d;
+        return true;
+    }
+    int64_t mtime_ns = int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+    if (cache) {
+        listed = cache->find_directory(path, st.st_size, mtime_ns);
+        if (listed) {
+            return true;
+        }
+    }
+    if (!read_zip_directory(*d)) {
+        return false;
+    }
+    listed = d;
+    if (cache) {
+        cache->store_directory(path, st.st_size, mtime_ns, listed);
+    }
+    return true;
+}
+
+bool archive_reader::read_zip_directory(directory& d) {
+    // the end record is followed by a comment of up to 64K
+    size_t tail_size = (size_t) std::min<uint64_t>(file_size, 22 + 0xFFFF);
+    std::vector<unsigned char> tail(tail_size);
+    if (tail_size < 22 || !read_at(file_size - tail_size, tail.data(), tail_size)) {
+        return fail("Not a zip archive");
+    }
+    size_t eocd = tail_size - 22;
+    while (le32(&tail[eocd]) != EOCD) {
+        if (eocd == 0) {
+            return fail("Not a zip archive");
+        }
+        eocd--;
+    }
+    uint64_t count = le16(&tail[eocd + 10]);
+    uint64_t directory_size = le32(&tail[eocd + 12]);
+    uint64_t directory_offset = le32(&tail[eocd + 16]);
+    if ((count == 0xFFFF || directory_offset == 0xFFFFFFFF) && eocd >= 20 &&
+        le32(&tail[eocd - 20]) == ZIP64_LOCATOR) {
+        unsigned char record[56];
+        if (!read_at(le64(&tail[eocd - 20 + 8]), record, sizeof(record)) || le32(record) != ZIP64_EOCD) {
+            return fail("Broken zip64 directory");
+        }
+        count = le64(record + 32);
+        directory_size = le64(record + 40);
+        directory_offset = le64(record + 48);
+    }
+    // the sum could wrap for crafted zip64 values
+    if (directory_size > file_size || directory_offset > file_size - directory_size) {
+        return fail("Broken zip directory");
+    }
+    std::vector<unsigned char> directory((size_t) directory_size);
+    if (!read_at(directory_offset, directory.data(), directory.size())) {
+        return fail("Broken zip directory");
+    }
+    size_t at = 0;
+    for (uint64_t i = 0; i < count; i++) {
+        if (at + 46 > directory.size() || le32(&directory[at]) != CENTRAL_HEADER) {
+            return fail("Broken zip directory");
+        }
+        const unsigned char* h = &directory[at];
+        uint16_t flags = le16(h + 8);
+        uint16_t method = le16(h + 10);
+        uint64_t compressed = le32(h + 20);
+        uint64_t uncompressed = le32(h + 24);
+        size_t name_length = le16(h + 28);
+        size_t extra_length = le16(h + 30);
+        size_t comment_length = le16(h + 32);
+        uint64_t local_offset = le32(h + 42);
+        if (at + 46 + name_length + extra_length + comment_length > directory.size()) {
+            return fail("Broken zip directory");
+        }
+        std::string name(reinterpret_cast<const char*>(h + 46), name_length);
+        // zip64 sizes replace the saturated 32-bit fields, in this order
+        const unsigned char* extra = h + 46 + name_length;
+        for (size_t e = 0; e + 4 <= extra_length;) {
+            uint16_t id = le16(extra + e);
+            size_t length = le16(extra + e + 2);
+            const unsigned char* field = extra + e + 4;
+            const unsigned char* field_end = field + std::min(length, extra_length - e - 4);
+            if (id == 0x0001) {
+                if (uncompressed == 0xFFFFFFFF && field + 8 <= field_end) { uncompressed = le64(field); field += 8; }
+                if (compressed == 0xFFFFFFFF && field + 8 <= field_end) { compressed = le64(field); field += 8; }
+                if (local_offset == 0xFFFFFFFF && field + 8 <= field_end) { local_offset = le64(field); }
+            }
+            e += 4 + length;
+        }
+        at += 46 + name_length + extra_length + comment_length;
+        bool encrypted = (flags & 1) != 0;
+        bool is_directory = !name.empty() && name.back() == '/';
+        if (!encrypted && !is_directory && (method == STORED || method == DEFLATED)) {
+            d.by_name.emplace(name, d.entries.size());
+            d.entries.push_back(member{name, method, compressed, local_offset});
+        }
+    }
+    return true;
+}
+
+bool archive_reader::stream(std::string const& name, chunk_sink const& sink) {
+    if (listed) {
+        auto i = listed->by_name.find(name);
+        if (i != listed->by_name.end()) {
+            return stream(i->second, sink);
+        }
+    }
+    return fail("No such member " + name);
+}
+
+bool archive_reader::stream(size_t i, chunk_sink const& sink) {
+    member const& m = listed->entries[i];
+    if (gzip) {
+        return stream_deflated(0, file_size, true, sink);
+    }
+    unsigned char local[30];
+    if (!read_at(m.local_offset, local, sizeof(local)) || le32(local) != LOCAL_HEADER) {
+        return fail("Broken zip member " + m.name);
+    }
+    uint64_t header = 30 + le16(local + 26) + le16(local + 28);
+    if (m.local_offset > file_size || header > file_size - m.local_offset ||
+        m.compressed_size > file_size - m.local_offset - header) {
+        return fail("Broken zip member " + m.name);
+    }
+    uint64_t data = m.local_offset + header;
+    if (m.method == STORED) {
+        return stream_stored(data, m.compressed_size, sink);
+    }
+    return stream_deflated(data, m.compressed_size, false, sink);
+}
+
+bool archive_reader::stream_stored(uint64_t offset, uint64_t size, chunk_sink const& sink) {
+    static thread_local std::vector<char> buffer;
+    buffer.resize(CHUNK);
+    while (size > 0) {
+        size_t n = (size_t) std::min<uint64_t>(size, CHUNK);
+        if (!read_at(offset, buffer.data(), n)) {
+            return fail("Cannot read the archive");
+        }
+        if (!sink(buffer.data(), n)) {
+            return true;
+        }
+        offset += n;
+        size -= n;
+    }
+    return true;
+}
+
+bool archive_reader::stream_deflated(uint64_t offset, uint64_t size, bool gzip_framing, chunk_sink const& sink) {
+    static thread_local std::vector<char> in;
+    static thread_local std::vector<char> out;
+    in.resize(CHUNK);
+    out.resize(CHUNK);
+    z_stream z;
+    std::memset(&z, 0, sizeof(z));
+    // raw deflate inside zip, with header and trailer in gzip
+    if (inflateInit2(&z, gzip_framing ? 16 + MAX_WBITS : -MAX_WBITS) != Z_OK) {
+        return fail("Cannot inflate");
+    }
+    std::unique_ptr<z_stream, int (*)(z_stream*)> guard(&z, inflateEnd);
+    if (offset > file_size || size > file_size - offset) {
+        return fail("Cannot read the archive");
+    }
+    uint64_t end = offset + size;
+    while (true) {
+        if (z.avail_in == 0) {
+            if (offset == end) {
+                // a stream cut short is read as far as it goes
+                return true;
+            }
+            size_t n = (size_t) std::min<uint64_t>(end - offset, CHUNK);
+            if (!read_at(offset, in.data(), n)) {
+                return fail("Cannot read the archive");
+            }
+            offset += n;
+            z.next_in = reinterpret_cast<Bytef*>(in.data());
+            z.avail_in = (uInt) n;
+        }
+        z.next_out = reinterpret_cast<Bytef*>(out.data());
+        z.avail_out = (uInt) CHUNK;
+        int status = inflate(&z, Z_NO_FLUSH);
+        if (status != Z_OK && status != Z_STREAM_END && status != Z_BUF_ERROR) {
+            return fail("Corrupted compressed data");
+        }
+        size_t produced = CHUNK - z.avail_out;
+        if (produced > 0 && !sink(out.data(), produced)) {
+            return true;
+        }
+        if (status == Z_STREAM_END) {
+            // gzip files may be several members in a row
+            if (!gzip_framing || (z.avail_in == 0 && offset == end) || inflateReset(&z) != Z_OK) {
+                return true;
+            }
+        } else if (status == Z_BUF_ERROR && z.avail_in != 0) {
+            return fail("Corrupted compressed data");
+        }
+    }
+}
+
+file_trigrams archive_member::trigrams() const {
+    file_trigrams result;
+    result.keys = keys.data();
+    result.counts = counts.data();
+    result.size = (uint32_t) keys.size();
+    return result;
+}
+
+archive_members archive_cache::find(std::string const& path, int64_t size, int64_t mtime_ns) const {
+    std::lock_guard<std::mutex> lock(m);
+    auto i = records.find(path);
+    if (i == records.end() || i->second.size != size || i->second.mtime_ns != mtime_ns) {
+        return nullptr;
+    }
+    return i->second.members;
+}
+
+archive_members archive_cache::previous(std::string const& path) const {
+    std::lock_guard<std::mutex> lock(m);
+    auto i = records.find(path);
+    return i == records.end() ? nullptr : i->second.members;
+}
+
+void archive_cache::store(std::string const& path, int64_t size, int64_t mtime_ns, archive_members members) {
+    std::lock_guard<std::mutex> lock(m);
+    records[path] = record{size, mtime_ns, std::move(members)};
+}
+
+std::shared_ptr<const archive_reader::directory> archive_cache::find_directory(std::string const& path, int64_t size,
+                                                                              int64_t mtime_ns) const {
+    std::lock_guard<std::mutex> lock(m);
+    auto i = directories.find(path);
+    if (i == directories.end() || i->second.size != size || i->second.mtime_ns != mtime_ns) {
+        return nullptr;
+    }
+    return i->second.directory;
+}
+
+void archive_cache::store_directory(std::string const& path, int64_t size, int64_t mtime_ns,
+                                    std::shared_ptr<const archive_reader::directory> directory) {
+    std::lock_guard<std::mutex> lock(m);
+    directories[path] = directory_record{size, mtime_ns, std::move(directory)};
+}
+
+void archive_cache::forget(std::string const& path) {
+    std::lock_guard<std::mutex> lock(m);
+    records.erase(path);
+    directories.erase(path);
+}
+
+void archive_cache::forget_under(std::string const& directory, std::unordered_set<std::string> const& kept) {
+    std::string prefix = directory;
+    if (prefix.empty() || prefix.back() != '/') {
+        prefix += '/';
+    }
+    std::lock_guard<std::mutex> lock(m);
+    auto under = [&](std::string const& path) {
+        return path.compare(0, prefix.size(), prefix) == 0 && !kept.count(path);
+    };
+    for (auto i = records.begin(); i != records.end();) {
+        i = under(i->first) ? records.erase(i) : std::next(i);
+    }
+    for (auto i = directories.begin(); i != directories.end();) {
+        i = under(i->first) ? directories.erase(i) : std::next(i);
+    }
+}
@@ -0,0 +1,127 @@
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "trigrams.h"
+#include "encoding.h"
+
+class archive_cache;
+
+// Streams the members of zip (jar, war, ear) and gzip files without writing
+// them anywhere. A member is addressed by the virtual path
+// <archive>!/<member>; the only member of a gzip file is named after the file
+// without its .gz suffix.
+class archive_reader {
+public:
+    // Returns false when the rest of the member is not needed.
+    using chunk_sink = std::function<bool(const char* data, size_t size)>;
+
+    static const char SEPARATOR[];
+
+    struct member {
+        std::string name;
+        uint16_t method;
+        uint64_t compressed_size;
+        uint64_t local_offset;
+    };
+    // The readable members of one version of an archive.
+    struct directory {
+        std::vector<member> entries;
+        // the first entry of each name
+        std::unordered_map<std::string, size_t> by_name;
+    };
+
+    explicit archive_reader(std::string path);
+    ~archive_reader();
+    archive_reader(const archive_reader&) = delete;
+    archive_reader& operator=(const archive_reader&) = delete;
+
+    static bool is_archive(std::string const& path);
+    static std::string virtual_path(std::string const& archive, std::string const& member);
+    // Splits a virtual path, false for paths of plain files.
+    static bool split(std::string const& path, std::string& archive, std::string& member);
+
+    // Reads the list of members, or takes it from the cache if the archive has not changed since it
+    // was stored there; false with error() set when it is not an archive it can read.
+    bool open(archive_cache* cache = nullptr);
+    std::string const& error() const;
+    size_t members() const;
+    std::string const& name(size_t i) const;
+    // Decompresses a member into sink chunk by chunk. False on errors, not
+    // when the sink stops.
+    bool stream(size_t i, chunk_sink const& sink);
+    bool stream(std::string const& name, chunk_sink const& sink);
+
+private:
+    std::string path;
+    int fd;
+    uint64_t file_size;
+    bool gzip;
+    std::shared_ptr<const directory> listed;
+    std::string last_error;
+
+    bool fail(std::string const& message);
+    bool read_at(uint64_t offset, void* buffer, size_t size);
+    bool read_zip_directory(directory& d);
+    bool stream_stored(uint64_t offset, uint64_t size, chunk_sink const& sink);
+    bool stream_deflated(uint64_t offset, uint64_t size, bool gzip_framing, chunk_sink const& sink);
+};
+
+// Trigrams of one text member, kept outside of any index generation.
+struct archive_member {
+    std::string name;
+    uint64_t size;
+    text_encoding encoding;
+    uint64_t content_hash;
+    std::vector<trigram> keys;
+    std::vector<uint32_t> counts;
+
+    file_trigrams trigrams() const;
+};
+
+using archive_members = std::shared_ptr<const std::vector<archive_member>>;
+
+// Text members of the archives seen so far, so that an archive is only
+// decompressed again after it changed.
+class archive_cache {
+public:
+    // Members stored for this size and modification time, null otherwise.
+    archive_members find(std::string const& path, int64_t size, int64_t mtime_ns) const;
+    // Members stored last, whatever the archive looks like now.
+    archive_members previous(std::string const& path) const;
+    void store(std::string const& path, int64_t size, int64_t mtime_ns, archive_members members);
+    // Directory read for this size and modification time, null otherwise.
+    std::shared_ptr<const archive_reader::directory> find_directory(std::string const& path, int64_t size,
+                                                                    int64_t mtime_ns) const;
+    void store_directory(std::string const& path, int64_t size, int64_t mtime_ns,
+                         std::shared_ptr<const archive_reader::directory> directory);
+    void forget(std::string const& path);
+    // Forgets the archives under a directory, except those kept.
+    void forget_under(std::string const& directory, std::unordered_set<std::string> const& kept = {});
+
+private:
+    struct record {
+        int64_t size;
+        int64_t mtime_ns;
+        archive_members members;
+    };
+    // directories are read by searches as well, for archives that may not be indexed yet
+    struct directory_record {
+        int64_t size;
+        int64_t mtime_ns;
+        std::shared_ptr<const archive_reader::directory> directory;
+    };
+
+    mutable std::mutex m;
+    std::unordered_map<std::string, record> records;
+    std::unordered_map<std::string, directory_record> directories;
+};
+
+#endif // ARCHIVE_H
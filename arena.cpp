@@ -0,0 +1,118 @@
+#include "arena.h"
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+namespace {
+    const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+    size_t align_up(size_t value, size_t align) {
+        return (value + align - 1) & ~(align - 1);
+    }
+}
+
+arena::arena(bool huge_pages, size_t block_size)
+        : huge_pages(huge_pages), block_size(block_size), current(nullptr), end(nullptr), reserved(0) {}
+
+arena::~arena() {
+    release();
+}
+
+void* arena::allocate(size_t size, size_t align) {
+    auto p = reinterpret_cast<uintptr_t>(current);
+    uintptr_t aligned = align_up(p, align);
+    if (current == nullptr || aligned + size > reinterpret_cast<uintptr_t>(end)) {
+        grow(size + align);
+        p = reinterpret_cast<uintptr_t>(current);
+        aligned = align_up(p, align);
+    }
+    current = reinterpret_cast<char*>(aligned + size);
+    return reinterpret_cast<void*>(aligned);
+}
+
+void arena::grow(size_t min_size) {
+    block b{nullptr, std::max(block_size, min_size), false};
+#ifdef __linux__
+    if (huge_pages) {
+        b.size = align_up(b.size, HUGE_PAGE_SIZE);
+        void* p = mmap(nullptr, b.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p != MAP_FAILED) {
+            madvise(p, b.size, MADV_HUGEPAGE);
+            b.data = static_cast<char*>(p);
+            b.mapped = true;
+        }
+    }
+#endif
+    if (b.data == nullptr) {
+        b.data = static_cast<char*>(std::malloc(b.size));
+        if (b.data == nullptr) {
+            throw std::bad_alloc();
+        }
+    }
+    blocks.push_back(b);
+    reserved += b.size;
+    current = b.data;
+    end = b.data + b.size;
+}
+
+void arena::free_block(block const& b) {
+#ifdef __linux__
+    if (b.mapped) {
+        munmap(b.data, b.size);
+        return;
+    }
+#endif
+    std::free(b.data);
+}
+
+void arena::release() {
+    for (auto& b : blocks) {
+        free_block(b);
+    }
+    blocks.clear();
+    current = end = nullptr;
+    reserved = 0;
+}
+
+size_t arena::bytes_reserved() const {
+    return reserved;
+}
+
+namespace {
+    std::atomic<uint64_t> next_pool_id(1);
+
+    struct local_arena_cache {
+        uint64_t pool_id = 0;
+        arena* a = nullptr;
+    };
+    thread_local local_arena_cache cache;
+}
+
+arena_pool::arena_pool(bool huge_pages) : huge_pages(huge_pages), id(next_pool_id++) {}
+
+arena& arena_pool::local() {
+    if (cache.pool_id == id) {
+        return *cache.a;
+    }
+    std::lock_guard<std::mutex> lock(m);
+    auto& a = arenas[std::this_thread::get_id()];
+    if (!a) {
+        a.reset(new arena(huge_pages));
+    }
+    cache.pool_id = id;
+    cache.a = a.get();
+    return *a;
+}
+
+size_t arena_pool::bytes_reserved() const {
+    std::lock_guard<std::mutex> lock(m);
+    size_t result = 0;
+    for (auto& a : arenas) {
+        result += a.second->bytes_reserved();
+    }
+    return result;
+}
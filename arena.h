@@ -0,0 +1,68 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Bump allocator: memory is handed out linearly from large blocks and is only
+// given back all at once by release() or the destructor.
+class arena {
+public:
+    static const size_t DEFAULT_BLOCK_SIZE = 2 * 1024 * 1024;
+
+    explicit arena(bool huge_pages = false, size_t block_size = DEFAULT_BLOCK_SIZE);
+    ~arena();
+    arena(const arena&) = delete;
+    arena& operator=(const arena&) = delete;
+
+    void* allocate(size_t size, size_t align = alignof(std::max_align_t));
+    template<typename T>
+    T* allocate_array(size_t n) {
+        return static_cast<T*>(allocate(n * sizeof(T), alignof(T)));
+    }
+    void release();
+    size_t bytes_reserved() const;
+
+private:
+    struct block {
+        char* data;
+        size_t size;
+        bool mapped;
+    };
+
+    bool huge_pages;
+    size_t block_size;
+    std::vector<block> blocks;
+    char* current;
+    char* end;
+    std::atomic<size_t> reserved;
+
+    void grow(size_t min_size);
+    void free_block(block const& b);
+};
+
+// Set of arenas with one arena per thread, so that indexing threads never
+// contend on allocation. Destroying the pool frees every arena in one shot.
+class arena_pool {
+public:
+    explicit arena_pool(bool huge_pages = false);
+    arena_pool(const arena_pool&) = delete;
+    arena_pool& operator=(const arena_pool&) = delete;
+
+    arena& local();
+    size_t bytes_reserved() const;
+
+private:
+    bool huge_pages;
+    uint64_t id;
+    mutable std::mutex m;
+    std::unordered_map<std::thread::id, std::unique_ptr<arena>> arenas;
+};
+
+#endif // ARENA_H
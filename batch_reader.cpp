@@ -0,0 +1,337 @@
+#include "batch_reader.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+// the ops are enum values; IORING_FEAT_RW_CUR_POS came with them in 5.6 headers
+#if defined(__linux__) && defined(__NR_io_uring_setup) && defined(IORING_FEAT_RW_CUR_POS)
+#define HAVE_IO_URING 1
+#endif
+
+#ifdef HAVE_IO_URING
+
+// The submission and completion rings shared with the kernel, driven with raw
+// system calls.
+struct batch_reader::ring {
+    int fd = -1;
+    void* sq_ptr = MAP_FAILED;
+    size_t sq_len = 0;
+    void* cq_ptr = MAP_FAILED;
+    size_t cq_len = 0;
+    io_uring_sqe* sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+    size_t sqes_len = 0;
+
+    unsigned* sq_tail = nullptr;
+    unsigned* sq_mask = nullptr;
+    unsigned* sq_array = nullptr;
+    unsigned sq_entries = 0;
+    unsigned* cq_head = nullptr;
+    unsigned* cq_tail = nullptr;
+    unsigned* cq_mask = nullptr;
+    io_uring_cqe* cqes = nullptr;
+
+    ~ring() {
+        if (sqes != MAP_FAILED) munmap(sqes, sqes_len);
+        if (cq_ptr != MAP_FAILED && cq_ptr != sq_ptr) munmap(cq_ptr, cq_len);
+        if (sq_ptr != MAP_FAILED) munmap(sq_ptr, sq_len);
+        if (fd >= 0) close(fd);
+    }
+
+    bool setup(unsigned entries) {
+        io_uring_params p;
+        std::memset(&p, 0, sizeof(p));
+        fd = (int) syscall(__NR_io_uring_setup, entries, &p);
+        if (fd < 0) {
+            return false;
+        }
+        sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        cq_len = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        bool single_mmap = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single_mmap) {
+            sq_len = cq_len = std::max(sq_len, cq_len);
+        }
+        sq_ptr = mmap(nullptr, sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        if (sq_ptr == MAP_FAILED) {
+            return false;
+        }
+        cq_ptr = single_mmap ? sq_ptr : mmap(nullptr, cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                             fd, IORING_OFF_CQ_RING);
+        if (cq_ptr == MAP_FAILED) {
+            return false;
+        }
+        sqes_len = p.sq_entries * sizeof(io_uring_sqe);
+        sqes = static_cast<io_uring_sqe*>(mmap(nullptr, sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                               fd, IORING_OFF_SQES));
+        if (sqes == MAP_FAILED) {
+            return false;
+        }
+        char* sq = static_cast<char*>(sq_ptr);
+        char* cq = static_cast<char*>(cq_ptr);
+        sq_tail = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+        sq_mask = reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+        sq_array = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+        sq_entries = p.sq_entries;
+        cq_head = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+        cq_tail = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+        cq_mask = reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+        return supports(IORING_OP_OPENAT) && supports(IORING_OP_READ) && supports(IORING_OP_CLOSE);
+    }
+
+    bool supports(unsigned op) {
+        const unsigned OPS = 256;
+        std::unique_ptr<char[]> memory(new char[sizeof(io_uring_probe) + OPS * sizeof(io_uring_probe_op)]());
+        auto* probe = reinterpret_cast<io_uring_probe*>(memory.get());
+        if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, OPS) < 0) {
+            return false;
+        }
+        return op <= probe->last_op && (probe->ops[op].flags & IO_URING_OP_SUPPORTED);
+    }
+
+    // Slots are taken in order, at most sq_entries before the next submit.
+    io_uring_sqe* next(unsigned i) {
+        unsigned index = (*sq_tail + i) & *sq_mask;
+        sq_array[index] = index;
+        io_uring_sqe* sqe = &sqes[index];
+        std::memset(sqe, 0, sizeof(*sqe));
+        return sqe;
+    }
+
+    // Submits the first count prepared entries, waits for all of them and
+    // hands out the result of each by its user_data. When submitting fails,
+    // the entries submitted before still complete and are handed out, so that
+    // the descriptors they opened can be closed, and it returns false.
+    template<typename F>
+    bool run(unsigned count, F on_result) {
+        __atomic_store_n(sq_tail, *sq_tail + count, __ATOMIC_RELEASE);
+        unsigned submitted = 0;
+        unsigned completed = 0;
+        bool failed = false;
+        while (completed < (failed ? submitted : count)) {
+            unsigned to_submit = failed ? 0 : count - submitted;
+            long r = syscall(__NR_io_uring_enter, fd, to_submit, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+            if (r < 0 && errno == EINTR) {
+                continue;
+            }
+            // a ring that cannot even wait any more is given up with what it has
+            bool give_up = r < 0 && failed;
+            if (r < 0) {
+                failed = true;
+            } else if (!failed) {
+                submitted += (unsigned) r;
+            }
+            unsigned head = *cq_head;
+            unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+            for (; head != tail; head++) {
+                io_uring_cqe const& cqe = cqes[head & *cq_mask];
+                on_result((size_t) cqe.user_data, cqe.res);
+                completed++;
+            }
+            __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+            if (give_up) {
+                break;
+            }
+        }
+        return !failed;
+    }
+};
+
+#else
+
+struct batch_reader::ring {};
+
+#endif
+
+long batch_reader::file::read(char *buffer, size_t size) {
+    if (complete) {
+        return 0;
+    }
+    while (true) {
+        ssize_t n = ::read(fd, buffer, size);
+        if (n >= 0 || errno != EINTR) {
+            return (long) n;
+        }
+    }
+}
+
+batch_reader::batch_reader(unsigned queue_depth, size_t head_size)
+        : depth(queue_depth), head_size(head_size), uring(nullptr) {
+#ifdef HAVE_IO_URING
+    if (depth > 0) {
+        std::unique_ptr<ring> r(new ring);
+        if (r->setup(depth)) {
+            // the kernel may round the depth up
+            depth = std::min(depth, r->sq_entries);
+            uring = r.release();
+        }
+    }
+#endif
+    buffers.resize(std::max(depth, 1u) * head_size);
+}
+
+batch_reader::~batch_reader() {
+    delete uring;
+}
+
+batch_reader& batch_reader::local(unsigned queue_depth) {
+    thread_local std::unique_ptr<batch_reader> reader;
+    thread_local unsigned requested = 0;
+    if (!reader || requested != queue_depth) {
+        reader.reset(new batch_reader(queue_depth));
+        requested = queue_depth;
+    }
+    return *reader;
+}
+
+unsigned batch_reader::queue_depth() const {
+    return depth;
+}
+
+bool batch_reader::uses_io_uring() const {
+    return uring != nullptr;
+}
+
+void batch_reader::read(std::vector<std::string> const &paths, file_callback const &on_file) {
+    size_t from = 0;
+    // a ring that fails is dropped, whatever is left is then read the blocking way
+    while (uring && from < paths.size()) {
+        size_t count = std::min<size_t>(depth, paths.size() - from);
+        if (!read_batch(paths, from, count, on_file)) {
+            break;
+        }
+        from += count;
+    }
+    read_blocking(paths, from, paths.size() - from, on_file);
+}
+
+void batch_reader::read_blocking(std::vector<std::string> const &paths, size_t from, size_t count,
+                                 file_callback const &on_file) {
+    for (size_t i = from; i < from + count; i++) {
+        file f;
+        f.fd = open(paths[i].c_str(), O_RDONLY | O_CLOEXEC);
+        if (f.fd < 0) {
+            f.error = errno;
+        } else {
+            // a short read does not tell the end of the file, a read of nothing does
+            size_t filled = 0;
+            while (filled < head_size) {
+                long n = f.read(buffers.data() + filled, head_size - filled);
+                if (n < 0) {
+                    f.error = errno;
+                    break;
+                }
+                if (n == 0) {
+                    f.complete = true;
+                    break;
+                }
+                filled += (size_t) n;
+            }
+            if (!f.error) {
+                f.head = buffers.data();
+                f.head_size = filled;
+            }
+        }
+        on_file(i, f);
+        if (f.fd >= 0) {
+            close(f.fd);
+        }
+    }
+}
+
+#ifdef HAVE_IO_URING
+
+bool batch_reader::read_batch(std::vector<std::string> const &paths, size_t from, size_t count,
+                              file_callback const &on_file) {
+    std::vector<file> files(count);
+    for (unsigned i = 0; i < count; i++) {
+        io_uring_sqe* sqe = uring->next(i);
+        sqe->opcode = IORING_OP_OPENAT;
+        sqe->fd = AT_FDCWD;
+        sqe->addr = (unsigned long long) paths[from + i].c_str();
+        sqe->open_flags = O_RDONLY | O_CLOEXEC;
+        sqe->user_data = i;
+    }
+    bool ok = uring->run((unsigned) count, [&files](size_t i, int res) {
+        if (res < 0) {
+            files[i].error = -res;
+        } else {
+            files[i].fd = res;
+        }
+    });
+
+    // short reads do not tell the end of a file, the heads not full yet are read on
+    // in further rounds until they are or a read returns nothing
+    while (ok) {
+        unsigned reads = 0;
+        for (unsigned i = 0; i < count; i++) {
+            file const& f = files[i];
+            if (f.fd < 0 || f.error || f.complete || f.head_size == head_size) continue;
+            io_uring_sqe* sqe = uring->next(reads++);
+            sqe->opcode = IORING_OP_READ;
+            sqe->fd = f.fd;
+            sqe->addr = (unsigned long long) (buffers.data() + i * head_size + f.head_size);
+            sqe->len = (unsigned) (head_size - f.head_size);
+            sqe->off = f.head_size;
+            sqe->user_data = i;
+        }
+        if (reads == 0) {
+            break;
+        }
+        ok = uring->run(reads, [&files](size_t i, int res) {
+            if (res < 0) {
+                files[i].error = -res;
+            } else if (res == 0) {
+                files[i].complete = true;
+            } else {
+                files[i].head_size += (size_t) res;
+            }
+        });
+    }
+    if (!ok) {
+        for (auto& f : files) {
+            if (f.fd >= 0) close(f.fd);
+        }
+        delete uring;
+        uring = nullptr;
+        return false;
+    }
+
+    unsigned closes = 0;
+    for (unsigned i = 0; i < count; i++) {
+        file& f = files[i];
+        if (f.fd >= 0 && !f.error) {
+            f.head = buffers.data() + i * head_size;
+            // the head was read at offset 0, the consumer continues after it
+            if (!f.complete && lseek(f.fd, (off_t) f.head_size, SEEK_SET) < 0) {
+                f.error = errno;
+            }
+        }
+        on_file(from + i, f);
+        if (f.fd >= 0) {
+            io_uring_sqe* sqe = uring->next(closes++);
+            sqe->opcode = IORING_OP_CLOSE;
+            sqe->fd = f.fd;
+            sqe->user_data = i;
+        }
+    }
+    // a failed close still frees the descriptor, nothing to report
+    uring->run(closes, [](size_t, int) {});
+    return true;
+}
+
+#else
+
+bool batch_reader::read_batch(std::vector<std::string> const &, size_t, size_t, file_callback const &) {
+    return false;
+}
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef BATCH_READER_H
+#define BATCH_READER_H
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Reads the beginning of many files with a few system calls. On Linux the
+// opens, the reads of the heads and the closes of a batch are each submitted
+// at once through an io_uring of the given queue depth; elsewhere, when the
+// kernel refuses io_uring, or with a depth of 0 the files are read one by one
+// with blocking calls. The rest of a file that does not fit into its head buffer is read
+// with blocking calls by the consumer.
+class batch_reader {
+public:
+    static const size_t DEFAULT_HEAD_SIZE = 64 * 1024;
+
+    struct file {
+        // errno of the failed open or read, 0 on success
+        int error = 0;
+        const char* head = nullptr;
+        size_t head_size = 0;
+        // a read past the head returned nothing, so the head holds the whole file
+        bool complete = false;
+        int fd = -1;
+
+        // Reads past the head, returns 0 at the end and -1 on errors.
+        long read(char* buffer, size_t size);
+    };
+    using file_callback = std::function<void(size_t index, file& f)>;
+
+    explicit batch_reader(unsigned queue_depth, size_t head_size = DEFAULT_HEAD_SIZE);
+    ~batch_reader();
+    batch_reader(const batch_reader&) = delete;
+    batch_reader& operator=(const batch_reader&) = delete;
+
+    // Reader of the calling thread, recreated when the depth changes.
+    static batch_reader& local(unsigned queue_depth);
+
+    unsigned queue_depth() const;
+    bool uses_io_uring() const;
+    // Calls on_file for every path, in order, while its descriptor is open.
+    void read(std::vector<std::string> const& paths, file_callback const& on_file);
+
+private:
+    struct ring;
+
+    unsigned depth;
+    size_t head_size;
+    std::vector<char> buffers;
+    ring* uring;
+
+    void read_blocking(std::vector<std::string> const& paths, size_t from, size_t count, file_callback const& on_file);
+    // Returns false, leaving the batch unread, when the ring fails.
+    bool read_batch(std::vector<std::string> const& paths, size_t from, size_t count, file_callback const& on_file);
+};
+
+#endif // BATCH_READER_H
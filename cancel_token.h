@@ -0,0 +1,39 @@
+#ifndef CANCEL_TOKEN_H
+#define CANCEL_TOKEN_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+// Cancellation flag of a single scan or search. Copies share the flag, so the
+// run and every task it spawned observe cancel() of the token it was given,
+// while the next run gets a fresh token and is not affected.
+class cancel_token {
+public:
+    cancel_token() : flag(std::make_shared<std::atomic_bool>(false)), run_epoch(0) {}
+    explicit cancel_token(uint64_t epoch) : flag(std::make_shared<std::atomic_bool>(false)), run_epoch(epoch) {}
+
+    bool cancelled() const {
+        return flag->load(std::memory_order_relaxed) ||
+               (parent && parent->load(std::memory_order_relaxed));
+    }
+    void cancel() const {
+        flag->store(true, std::memory_order_relaxed);
+    }
+    uint64_t epoch() const {
+        return run_epoch;
+    }
+    // Token for a part of the run, cancelled with this one or on its own.
+    cancel_token child() const {
+        cancel_token part(run_epoch);
+        part.parent = flag;
+        return part;
+    }
+
+private:
+    std::shared_ptr<std::atomic_bool> flag;
+    std::shared_ptr<std::atomic_bool> parent;
+    uint64_t run_epoch;
+};
+
+#endif // CANCEL_TOKEN_H
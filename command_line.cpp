@@ -0,0 +1,179 @@
+#include "command_line.h"
+#include "daemon_protocol.h"
+#include "search_client.h"
+#include "search_daemon.h"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QTextStream>
+#include <cstdio>
+#include <cstring>
+
+namespace {
+    // exit codes of grep
+    const int FOUND = 0;
+    const int NOT_FOUND = 1;
+    const int FAILED = 2;
+
+    int run_daemon(QCoreApplication& app, QStringList const& dirs, QString const& socket_name, bool shared,
+                   double bloom_rate, index_engine engine, tokenizer words) {
+        QTextStream err(stderr);
+        search_daemon daemon;
+        daemon.set_bloom_filter(bloom_rate);
+        daemon.set_engine(engine);
+        daemon.set_tokenizer(words);
+        QString error;
+        if (!daemon.start(dirs, socket_name, shared, error)) {
+            err << "text_searcher: " << error << "\n";
+            return FAILED;
+        }
+        for (QString const& dir : dirs) {
+            err << "text_searcher: serving " << QDir(dir).absolutePath() << " on " << socket_name << "\n";
+        }
+        err.flush();
+        return app.exec();
+    }
+
+    int run_query(QCoreApplication& app, QString const& needle, query_options const& query,
+                  QString const& socket_name) {
+        QTextStream out(stdout);
+        QTextStream err(stderr);
+        search_client client;
+        QHash<QString, int> coverage;
+        QObject::connect(&client, &search_client::index_published,
+                         [&coverage](quint64, const QString& root, int percent, quint64) {
+            coverage[root] = percent;
+        });
+        if (!client.connect_to_daemon(socket_name, 1000)) {
+            err << "text_searcher: no daemon is listening on " << socket_name
+                << ", start one with --daemon DIR\n";
+            return FAILED;
+        }
+        for (QString const& root : client.roots()) {
+            if (query.roots.isEmpty() || query.roots.contains(root)) {
+                int percent = coverage.value(root, 0);
+                if (percent < 100) {
+                    err << "text_searcher: the daemon has indexed " << percent << "% of " << root << " so far\n";
+                }
+            }
+        }
+        int code = NOT_FOUND;
+        QObject::connect(&client, &search_client::update_results,
+                         [&](quint64, const QString& filename, const occurrence_list& occurrences) {
+            code = FOUND;
+            if (query.mode == query_mode::files_only) {
+                out << filename << "\n";
+            } else if (query.mode == query_mode::count_only) {
+                out << filename << ":" << occurrences.matches() << "\n";
+            } else {
+                size_t i = 0;
+                for (int64_t position : occurrences) {
+                    out << filename << ":" << position;
+                    if (occurrences.has_distances()) {
+                        out << ":" << occurrences.distance(i);
+                    }
+                    out << "\n";
+                    i++;
+                }
+            }
+        });
+        QObject::connect(&client, &search_client::search_truncated, [&err](quint64, quint64 results) {
+            err << "text_searcher: stopped at " << results << " matches\n";
+        });
+        QObject::connect(&client, &search_client::exception_occurred, [&err](const QString& message) {
+            err << "text_searcher: " << message << "\n";
+        });
+        QObject::connect(&client, &search_client::searching_finished, [&](quint64) {
+            out.flush();
+            app.exit(code);
+        });
+        QObject::connect(&client, &search_client::disconnected, [&] {
+            err << "text_searcher: the daemon has gone\n";
+            app.exit(FAILED);
+        });
+        client.search(needle, query);
+        return app.exec();
+    }
+}
+
+bool is_headless(int argc, char* argv[]) {
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--daemon") == 0 || std::strcmp(argv[i], "--query") == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int run_headless(int argc, char* argv[]) {
+    QCoreApplication app(argc, argv);
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Indexes a tree once and answers searches in it.");
+    parser.addHelpOption();
+    QCommandLineOption daemon_option("daemon", "Index the directory and serve searches, may be repeated.", "dir");
+    QCommandLineOption bloom_option("bloom", "Keep Bloom filters of the trigrams of every file with this false "
+                                             "positive rate, such as 0.01, instead of their counts.", "rate", "0");
+    QCommandLineOption fm_index_option("fm-index", "Also build an FM-index of the text of every directory, so "
+                                                   "that queries read no files.");
+    QCommandLineOption tokens_option("tokens", "Also keep the tokens of every file, identifiers or words, so that "
+                                               "whole-word and prefix queries look them up.", "kind");
+    QCommandLineOption shared_option("shared", "Let other users of the machine connect to the daemon.");
+    QCommandLineOption socket_option("socket", "Name of the local socket.", "name", default_socket_name());
+    QCommandLineOption query_option("query", "Search the daemon's index for the text.", "text");
+    QCommandLineOption root_option("root", "Search only this directory of the daemon, may be repeated.", "dir");
+    QCommandLineOption files_option("files-only", "Print only the names of matching files.");
+    QCommandLineOption count_option("count", "Print the number of matches of every matching file.");
+    QCommandLineOption first_option("first", "Print the first n matches of every file.", "n");
+    QCommandLineOption max_option("max-results", "Stop after this many matches.", "n", "0");
+    QCommandLineOption word_option("word", "Match only whole words.");
+    QCommandLineOption prefix_option("word-prefix", "Match only at the start of words.");
+    QCommandLineOption errors_option("errors", "Also match the text with up to k insertions, deletions or "
+                                               "substitutions, printing the distance after the position.", "k", "0");
+    for (auto const& option : {daemon_option, bloom_option, fm_index_option, tokens_option, shared_option, socket_option,
+                               query_option, root_option, files_option, count_option, first_option, max_option,
+                               word_option, prefix_option, errors_option}) {
+        parser.addOption(option);
+    }
+    parser.process(app);
+
+    QString socket_name = parser.value(socket_option);
+    if (parser.isSet(daemon_option)) {
+        QString kind = parser.value(tokens_option);
+        tokenizer words = tokenizer::none;
+        if (kind == "identifiers") {
+            words = tokenizer::identifiers;
+        } else if (kind == "words") {
+            words = tokenizer::words;
+        } else if (!kind.isEmpty()) {
+            QTextStream(stderr) << "text_searcher: --tokens takes identifiers or words\n";
+            return FAILED;
+        }
+        return run_daemon(app, parser.values(daemon_option), socket_name, parser.isSet(shared_option),
+                          parser.value(bloom_option).toDouble(),
+                          parser.isSet(fm_index_option) ? index_engine::fm_index : index_engine::trigrams, words);
+    }
+    query_options query;
+    if (parser.isSet(files_option)) {
+        query.mode = query_mode::files_only;
+    } else if (parser.isSet(count_option)) {
+        query.mode = query_mode::count_only;
+    } else if (parser.isSet(first_option)) {
+        query.mode = query_mode::first_n;
+        query.per_file = parser.value(first_option).toULongLong();
+    }
+    query.max_results = parser.value(max_option).toULongLong();
+    query.max_errors = parser.value(errors_option).toUInt();
+    if (parser.isSet(word_option)) {
+        query.words = word_match::whole_word;
+    } else if (parser.isSet(prefix_option)) {
+        query.words = word_match::prefix;
+    }
+    for (QString const& root : parser.values(root_option)) {
+        query.roots.append(QDir(root).absolutePath());
+    }
+    if (parser.value(query_option).isEmpty()) {
+        QTextStream(stderr) << "text_searcher: --query needs a text to search for\n";
+        return FAILED;
+    }
+    return run_query(app, parser.value(query_option), query, socket_name);
+}
@@ -0,0 +1,11 @@
+#ifndef COMMAND_LINE_H
+#define COMMAND_LINE_H
+
+// Modes of the executable that need no display:
+//   text_searcher --daemon DIR [--shared] [--socket NAME]
+//   text_searcher --query TEXT [--files-only | --count | --first N] [--max-results N] [--socket NAME]
+// Queries go to the daemon and print file:position lines, positions counted from 1.
+bool is_headless(int argc, char* argv[]);
+int run_headless(int argc, char* argv[]);
+
+#endif // COMMAND_LINE_H
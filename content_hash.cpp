@@ -0,0 +1,117 @@
+#include "content_hash.h"
+#include <algorithm>
+#include <cstring>
+
+namespace {
+    const uint64_t PRIME1 = 11400714785074694791ULL;
+    const uint64_t PRIME2 = 14029467366897019727ULL;
+    const uint64_t PRIME3 = 1609587929392839161ULL;
+    const uint64_t PRIME4 = 9650029242287828579ULL;
+    const uint64_t PRIME5 = 2870177450012600261ULL;
+
+    uint64_t rotl(uint64_t x, int r) {
+        return (x << r) | (x >> (64 - r));
+    }
+
+    // little-endian loads, as the reference implementation reads them
+    uint64_t read64(const unsigned char* p) {
+        uint64_t v = 0;
+        for (int i = 7; i >= 0; i--) {
+            v = (v << 8) | p[i];
+        }
+        return v;
+    }
+
+    uint32_t read32(const unsigned char* p) {
+        return uint32_t(p[0]) | uint32_t(p[1]) << 8 | uint32_t(p[2]) << 16 | uint32_t(p[3]) << 24;
+    }
+
+    uint64_t round(uint64_t acc, uint64_t input) {
+        acc += input * PRIME2;
+        acc = rotl(acc, 31);
+        return acc * PRIME1;
+    }
+
+    uint64_t merge_round(uint64_t acc, uint64_t lane) {
+        acc ^= round(0, lane);
+        return acc * PRIME1 + PRIME4;
+    }
+}
+
+content_hasher::content_hasher(uint64_t seed) : seed(seed) {
+    lanes[0] = seed + PRIME1 + PRIME2;
+    lanes[1] = seed + PRIME2;
+    lanes[2] = seed;
+    lanes[3] = seed - PRIME1;
+}
+
+void content_hasher::consume(const unsigned char* stripe) {
+    for (int i = 0; i < 4; i++) {
+        lanes[i] = round(lanes[i], read64(stripe + 8 * i));
+    }
+}
+
+void content_hasher::update(const char* data, size_t size) {
+    auto p = reinterpret_cast<const unsigned char*>(data);
+    total += size;
+    if (buffered > 0) {
+        size_t n = std::min(size, STRIPE_LEN - buffered);
+        std::memcpy(buffer + buffered, p, n);
+        buffered += n;
+        p += n;
+        size -= n;
+        if (buffered < STRIPE_LEN) {
+            return;
+        }
+        consume(buffer);
+        buffered = 0;
+    }
+    while (size >= STRIPE_LEN) {
+        consume(p);
+        p += STRIPE_LEN;
+        size -= STRIPE_LEN;
+    }
+    std::memcpy(buffer, p, size);
+    buffered = size;
+}
+
+uint64_t content_hasher::digest() const {
+    uint64_t h;
+    if (total >= STRIPE_LEN) {
+        h = rotl(lanes[0], 1) + rotl(lanes[1], 7) + rotl(lanes[2], 12) + rotl(lanes[3], 18);
+        for (uint64_t lane : lanes) {
+            h = merge_round(h, lane);
+        }
+    } else {
+        h = seed + PRIME5;
+    }
+    h += total;
+    const unsigned char* p = buffer;
+    size_t n = buffered;
+    for (; n >= 8; p += 8, n -= 8) {
+        h ^= round(0, read64(p));
+        h = rotl(h, 27) * PRIME1 + PRIME4;
+    }
+    if (n >= 4) {
+        h ^= uint64_t(read32(p)) * PRIME1;
+        h = rotl(h, 23) * PRIME2 + PRIME3;
+        p += 4;
+        n -= 4;
+    }
+    for (; n > 0; p++, n--) {
+        h ^= *p * PRIME5;
+        h = rotl(h, 11) * PRIME1;
+    }
+    h ^= h >> 33;
+    h *= PRIME2;
+    h ^= h >> 29;
+    h *= PRIME3;
+    h ^= h >> 32;
+    return h;
+}
+
+uint64_t content_hash(const char* data, size_t size) {
+    content_hasher hasher;
+    hasher.update(data, size);
+    return hasher.digest();
+}
@@ -0,0 +1,30 @@
+#ifndef CONTENT_HASH_H
+#define CONTENT_HASH_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Streaming XXH64 of a file's bytes, computed while the file is read for its
+// trigrams. Files with the same hash and size are taken as copies of each other.
+class content_hasher {
+public:
+    explicit content_hasher(uint64_t seed = 0);
+
+    void update(const char* data, size_t size);
+    uint64_t digest() const;
+
+private:
+    static const size_t STRIPE_LEN = 32;
+
+    uint64_t lanes[4];
+    unsigned char buffer[STRIPE_LEN];
+    size_t buffered = 0;
+    uint64_t total = 0;
+    uint64_t seed;
+
+    void consume(const unsigned char* stripe);
+};
+
+uint64_t content_hash(const char* data, size_t size);
+
+#endif // CONTENT_HASH_H
@@ -0,0 +1,125 @@
+#include "daemon_protocol.h"
+
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <algorithm>
+
+namespace {
+    const char* const MODE_NAMES[] = {"all", "files_only", "count_only", "first_n"};
+    const char* const WORD_MATCH_NAMES[] = {"anywhere", "whole_word", "prefix"};
+}
+
+QString default_socket_name() {
+    QByteArray user = qgetenv("USER");
+    return "text_searcher-" + QString::fromLocal8Bit(user.isEmpty() ? QByteArray("user") : user);
+}
+
+QByteArray encode_message(QJsonObject const& message) {
+    return QJsonDocument(message).toJson(QJsonDocument::Compact) + '\n';
+}
+
+bool decode_message(QByteArray const& line, QJsonObject& message) {
+    QJsonDocument document = QJsonDocument::fromJson(line);
+    if (!document.isObject()) {
+        return false;
+    }
+    message = document.object();
+    return true;
+}
+
+QJsonObject query_to_json(query_options const& query) {
+    QJsonObject json;
+    json["mode"] = MODE_NAMES[int(query.mode)];
+    json["per_file"] = (qint64) query.per_file;
+    json["max_results"] = (qint64) query.max_results;
+    json["max_errors"] = (qint64) query.max_errors;
+    json["words"] = WORD_MATCH_NAMES[int(query.words)];
+    if (!query.roots.isEmpty()) {
+        json["roots"] = QJsonArray::fromStringList(query.roots);
+    }
+    return json;
+}
+
+query_options query_from_json(QJsonObject const& json) {
+    query_options query;
+    QString mode = json.value("mode").toString();
+    for (int i = 0; i < 4; i++) {
+        if (mode == MODE_NAMES[i]) {
+            query.mode = query_mode(i);
+        }
+    }
+    query.per_file = (size_t) std::max(1.0, json.value("per_file").toDouble(10));
+    query.max_results = (uint64_t) std::max(0.0, json.value("max_results").toDouble(0));
+    query.max_errors = (unsigned) std::max(0.0, json.value("max_errors").toDouble(0));
+    QString words = json.value("words").toString();
+    for (int i = 0; i < 3; i++) {
+        if (words == WORD_MATCH_NAMES[i]) {
+            query.words = word_match(i);
+        }
+    }
+    for (auto const& root : json.value("roots").toArray()) {
+        query.roots.append(root.toString());
+    }
+    return query;
+}
+
+QJsonObject progress_to_json(progress_info const& progress) {
+    QJsonObject json;
+    json["percent"] = progress.percent;
+    json["done_bytes"] = (qint64) progress.done_bytes;
+    json["total_bytes"] = (qint64) progress.total_bytes;
+    json["mb_per_second"] = progress.mb_per_second;
+    json["eta_ms"] = progress.eta_ms;
+    return json;
+}
+
+progress_info progress_from_json(QJsonObject const& json) {
+    progress_info progress;
+    progress.percent = json.value("percent").toInt();
+    progress.done_bytes = (quint64) json.value("done_bytes").toDouble();
+    progress.total_bytes = (quint64) json.value("total_bytes").toDouble();
+    progress.mb_per_second = json.value("mb_per_second").toDouble();
+    progress.eta_ms = (qint64) json.value("eta_ms").toDouble(-1);
+    return progress;
+}
+
+QJsonObject occurrences_to_json(occurrence_list const& occurrences) {
+    QJsonObject json;
+    QJsonArray deltas;
+    int64_t last = 0;
+    for (int64_t position : occurrences) {
+        deltas.append((qint64) (position - last));
+        last = position;
+    }
+    json["matches"] = (qint64) occurrences.matches();
+    json["deltas"] = deltas;
+    if (occurrences.has_distances()) {
+        QJsonArray distances;
+        for (size_t i = 0; i < occurrences.size(); i++) {
+            distances.append((int) occurrences.distance(i));
+        }
+        json["distances"] = distances;
+    }
+    return json;
+}
+
+occurrence_list occurrences_from_json(QJsonObject const& json) {
+    occurrence_list::builder positions;
+    int64_t position = 0;
+    uint64_t kept = 0;
+    QJsonArray distances = json.value("distances").toArray();
+    for (auto delta : json.value("deltas").toArray()) {
+        position += (int64_t) delta.toDouble();
+        if (distances.isEmpty()) {
+            positions.append(position);
+        } else {
+            positions.append(position, (unsigned) distances.at((int) kept).toInt());
+        }
+        kept++;
+    }
+    auto matches = (uint64_t) json.value("matches").toDouble();
+    if (matches > kept) {
+        positions.skip(matches - kept);
+    }
+    return positions.finish();
+}
@@ -0,0 +1,44 @@
+#ifndef DAEMON_PROTOCOL_H
+#define DAEMON_PROTOCOL_H
+
+#include <QByteArray>
+#include <QJsonObject>
+#include <QString>
+#include "occurrence_list.h"
+#include "progress.h"
+#include "query.h"
+
+// The daemon and its clients exchange JSON objects over a local socket, one per
+// line. Clients send requests {"op": ...} and tag each search with an id of
+// their own; the daemon sends {"event": ...} messages that carry the id of the
+// search they belong to.
+//
+//   {"op": "search", "id": 1, "needle": "...", "query": {...}}
+//   {"op": "next", "id": 2, "after": 1}      next page of the search 1
+//   {"op": "cancel", "id": 1}
+//
+//   {"event": "roots", "roots": ["...", ...]}  the indexed directories, sent first
+//   {"event": "index", "root": "...", "coverage": 100, "files": 42}   one per root
+//   {"event": "result", "id": 1, "file": "...", "matches": 3, "deltas": [...]}
+//   {"event": "progress", "id": 1, "progress": {...}}
+//   {"event": "truncated", "id": 1, "results": 10000}
+//   {"event": "finished", "id": 1}
+//   {"event": "info" or "error", "message": "..."}
+//   {"event": "error", "id": 1, "message": "..."}    sent only to the client of the search
+
+// Name of the socket of the daemon of the current user.
+QString default_socket_name();
+
+QByteArray encode_message(QJsonObject const& message);
+// False for a line that is not a JSON object.
+bool decode_message(QByteArray const& line, QJsonObject& message);
+
+QJsonObject query_to_json(query_options const& query);
+query_options query_from_json(QJsonObject const& json);
+QJsonObject progress_to_json(progress_info const& progress);
+progress_info progress_from_json(QJsonObject const& json);
+// Positions go as deltas, which keeps the lines short for dense matches.
+QJsonObject occurrences_to_json(occurrence_list const& occurrences);
+occurrence_list occurrences_from_json(QJsonObject const& json);
+
+#endif // DAEMON_PROTOCOL_H
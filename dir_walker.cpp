@@ -0,0 +1,234 @@
+#include "dir_walker.h"
+#include <algorithm>
+#include <thread>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+namespace {
+    enum class kind {
+        other, file, directory
+    };
+
+    // Regular files and directories are recognized by d_type. Only entries the
+    // file system does not type, and symbolic links, which are followed for
+    // files but never descended into, cost a stat, unless the size of files
+    // is needed.
+    kind classify(int dir_fd, const char* name, unsigned char type, bool with_sizes, int64_t& size) {
+        size = -1;
+        if (type == DT_DIR) {
+            return kind::directory;
+        }
+        if (type == DT_REG && !with_sizes) {
+            return kind::file;
+        }
+        if (type != DT_REG && type != DT_UNKNOWN && type != DT_LNK) {
+            return kind::other;
+        }
+        struct stat st;
+        if (fstatat(dir_fd, name, &st, 0) != 0) {
+            // still handed out, so that the error shows up when the file is read
+            return type == DT_REG ? kind::file : kind::other;
+        }
+        if (S_ISREG(st.st_mode)) {
+            if (with_sizes) {
+                size = (int64_t) st.st_size;
+            }
+            return kind::file;
+        }
+        if (S_ISDIR(st.st_mode) && type == DT_UNKNOWN) {
+            return kind::directory;
+        }
+        return kind::other;
+    }
+
+#ifdef __linux__
+    struct linux_dirent64 {
+        ino64_t d_ino;
+        off64_t d_off;
+        unsigned short d_reclen;
+        unsigned char d_type;
+        char d_name[1];
+    };
+#endif
+}
+
+dir_walker::dir_walker(size_t threads, bool include_hidden, bool with_sizes, size_t batch_size)
+        : threads(threads == 0 ? 1 : threads), include_hidden(include_hidden), with_sizes(with_sizes),
+          batch_size(batch_size == 0 ? 1 : batch_size), busy(0) {}
+
+uint64_t dir_walker::files_found() const {
+    return found_files.load(std::memory_order_relaxed);
+}
+
+uint64_t dir_walker::bytes_found() const {
+    return found_bytes.load(std::memory_order_relaxed);
+}
+
+uint64_t dir_walker::paths_excluded() const {
+    return excluded.load(std::memory_order_relaxed);
+}
+
+void dir_walker::set_filter(const path_filter* filter) {
+    this->filter = filter;
+}
+
+void dir_walker::walk(std::string const& root, files_callback on_files, error_callback on_error,
+                      cancel_callback cancelled) {
+    directories.assign(1, directory{root, filter ? filter->root_scope() : nullptr});
+    files.clear();
+    busy = 0;
+    found_files = 0;
+    found_bytes = 0;
+    excluded = 0;
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < threads; i++) {
+        workers.emplace_back(&dir_walker::worker, this, std::cref(on_files), std::cref(on_error), std::cref(cancelled));
+    }
+    for (auto& w : workers) {
+        w.join();
+    }
+}
+
+void dir_walker::push_directory(directory dir) {
+    std::lock_guard<std::mutex> lock(m);
+    directories.push_back(std::move(dir));
+    cv.notify_one();
+}
+
+void dir_walker::push_file(std::string path, int64_t size) {
+    found_files.fetch_add(1, std::memory_order_relaxed);
+    if (size > 0) {
+        found_bytes.fetch_add((uint64_t) size, std::memory_order_relaxed);
+    }
+    std::lock_guard<std::mutex> lock(m);
+    files.push_back(file{std::move(path), size});
+    cv.notify_one();
+}
+
+void dir_walker::worker(files_callback const& on_files, error_callback const& on_error,
+                        cancel_callback const& cancelled) {
+    std::unique_lock<std::mutex> lock(m);
+    while (true) {
+        cv.wait(lock, [this] {
+            return !directories.empty() || !files.empty() || busy == 0;
+        });
+        if (directories.empty() && files.empty()) {
+            // nothing queued and nobody who could queue more
+            cv.notify_all();
+            return;
+        }
+        // directories first, so the walk runs ahead and all workers get files early
+        bool is_directory = !directories.empty();
+        directory dir;
+        std::vector<file> batch;
+        if (is_directory) {
+            dir = std::move(directories.front());
+            directories.pop_front();
+        } else {
+            // a short queue is shared out rather than taken by the first worker
+            size_t n = std::min(batch_size, std::max<size_t>(1, files.size() / threads));
+            for (size_t i = 0; i < n; i++) {
+                batch.push_back(std::move(files.front()));
+                files.pop_front();
+            }
+        }
+        busy++;
+        lock.unlock();
+        if (!cancelled()) {
+            if (is_directory) {
+                list(dir, on_error);
+            } else {
+                on_files(batch);
+            }
+        }
+        lock.lock();
+        busy--;
+        if (busy == 0) {
+            cv.notify_all();
+        }
+    }
+}
+
+void dir_walker::list(directory const& dir, error_callback const& on_error) {
+    int fd = open(dir.path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        on_error(dir.path);
+        return;
+    }
+    // the whole listing is read first, its ignore files apply to all of it
+    static thread_local std::vector<std::pair<std::string, unsigned char>> entries;
+    entries.clear();
+    bool has_ignore_files = false;
+    auto collect = [&](const char* name, unsigned char type) {
+        if (name[0] == '.' && (name[1] == 0 || (name[1] == '.' && name[2] == 0))) {
+            return;
+        }
+        has_ignore_files = has_ignore_files || path_filter::is_ignore_file(name);
+        if (name[0] == '.' && !include_hidden) {
+            return;
+        }
+        entries.emplace_back(name, type);
+    };
+#ifdef __linux__
+    alignas(linux_dirent64) char buffer[64 * 1024];
+    while (true) {
+        long n = syscall(SYS_getdents64, fd, buffer, sizeof(buffer));
+        if (n < 0) {
+            on_error(dir.path);
+            break;
+        }
+        if (n == 0) {
+            break;
+        }
+        for (long offset = 0; offset < n;) {
+            auto* d = reinterpret_cast<linux_dirent64*>(buffer + offset);
+            collect(d->d_name, d->d_type);
+            offset += d->d_reclen;
+        }
+    }
+#else
+    int listing_fd = dup(fd);
+    DIR* listing = listing_fd < 0 ? nullptr : fdopendir(listing_fd);
+    if (!listing) {
+        if (listing_fd >= 0) close(listing_fd);
+        close(fd);
+        on_error(dir.path);
+        return;
+    }
+    while (dirent* d = readdir(listing)) {
+        collect(d->d_name, d->d_type);
+    }
+    closedir(listing);
+#endif
+    std::shared_ptr<const path_filter::scope> scope;
+    if (filter) {
+        scope = filter->enter(dir.scope, dir.path, has_ignore_files);
+    }
+    std::string prefix = dir.path.back() == '/' ? dir.path : dir.path + '/';
+    bool measure = with_sizes || (filter && filter->needs_sizes());
+    for (auto& entry : entries) {
+        int64_t size;
+        kind k = classify(fd, entry.first.c_str(), entry.second, measure, size);
+        if (k == kind::other) {
+            continue;
+        }
+        std::string path = prefix + entry.first;
+        if (filter && filter->excluded(scope.get(), path, entry.first.c_str(), k == kind::directory, size)) {
+            excluded.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+        if (k == kind::directory) {
+            push_directory(directory{std::move(path), scope});
+        } else {
+            push_file(std::move(path), with_sizes ? size : -1);
+        }
+    }
+    close(fd);
+}
@@ -0,0 +1,73 @@
+#ifndef DIR_WALKER_H
+#define DIR_WALKER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "path_filter.h"
+
+// Parallel directory traversal. Directories are split across worker threads
+// through a shared queue; on Linux entries are read with getdents64 and their
+// d_type decides whether a stat is needed at all. Every regular file found is
+// handed to on_files by one of the workers, so processing starts while the
+// walk is still going on. Files are handed out in batches of up to batch_size
+// for consumers that read many files at once. When sizes are asked for, files
+// are stat'ed as they are found and the running totals can be read from any
+// thread. An optional path_filter prunes files and whole subtrees while
+// directories are listed.
+class dir_walker {
+public:
+    struct file {
+        std::string path;
+        // -1 unless the walker measures files
+        int64_t size;
+    };
+    using files_callback = std::function<void(std::vector<file> const& files)>;
+    using error_callback = std::function<void(std::string const& path)>;
+    using cancel_callback = std::function<bool()>;
+
+    explicit dir_walker(size_t threads, bool include_hidden = false, bool with_sizes = false,
+                        size_t batch_size = 1);
+
+    void walk(std::string const& root, files_callback on_files, error_callback on_error,
+              cancel_callback cancelled);
+
+    // The filter must outlive the walk.
+    void set_filter(const path_filter* filter);
+    uint64_t files_found() const;
+    uint64_t bytes_found() const;
+    uint64_t paths_excluded() const;
+
+private:
+    struct directory {
+        std::string path;
+        std::shared_ptr<const path_filter::scope> scope;
+    };
+
+    size_t threads;
+    bool include_hidden;
+    bool with_sizes;
+    size_t batch_size;
+    std::atomic<uint64_t> found_files{0};
+    std::atomic<uint64_t> found_bytes{0};
+    std::atomic<uint64_t> excluded{0};
+    const path_filter* filter = nullptr;
+
+    std::mutex m;
+    std::condition_variable cv;
+    std::deque<directory> directories;
+    std::deque<file> files;
+    size_t busy;
+
+    void worker(files_callback const& on_files, error_callback const& on_error, cancel_callback const& cancelled);
+    void list(directory const& dir, error_callback const& on_error);
+    void push_directory(directory dir);
+    void push_file(std::string path, int64_t size);
+};
+
+#endif // DIR_WALKER_H
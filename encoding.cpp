@@ -0,0 +1,176 @@
+#include "encoding.h"
+#include <algorithm>
+#include <cstring>
+
+namespace {
+    const uint32_t REPLACEMENT = 0xFFFD;
+
+    // 0x80-0x9F of Windows-1252; the undefined ones keep their Latin-1 control code
+    const uint16_t WINDOWS_1252[32] = {
+            0x20AC, 0x0081, 0x201A, 0x0192, 0x201E, 0x2026, 0x2020, 0x2021,
+            0x02C6, 0x2030, 0x0160, 0x2039, 0x0152, 0x008D, 0x017D, 0x008F,
+            0x0090, 0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014,
+            0x02DC, 0x2122, 0x0161, 0x203A, 0x0153, 0x009D, 0x017E, 0x0178};
+
+    // A sequence cut by the end of the head counts as valid.
+    bool valid_utf8(const unsigned char* p, size_t size) {
+        size_t i = 0;
+        while (i < size) {
+            unsigned char c = p[i];
+            size_t length = c < 0x80 ? 1 : (c >> 5) == 0x6 ? 2 : (c >> 4) == 0xE ? 3 : (c >> 3) == 0x1E ? 4 : 0;
+            if (length == 0) {
+                return false;
+            }
+            for (size_t k = 1; k < length; k++) {
+                if (i + k >= size) {
+                    return true;
+                }
+                if ((p[i + k] & 0xC0) != 0x80) {
+                    return false;
+                }
+            }
+            i += length;
+        }
+        return true;
+    }
+}
+
+const char* encoding_name(text_encoding encoding) {
+    switch (encoding) {
+        case text_encoding::utf16le:
+            return "UTF-16LE";
+        case text_encoding::utf16be:
+            return "UTF-16BE";
+        case text_encoding::windows1252:
+            return "Windows-1252";
+        default:
+            return "UTF-8";
+    }
+}
+
+text_encoding detect_encoding(const char* head, size_t size) {
+    auto p = reinterpret_cast<const unsigned char*>(head);
+    if (size >= 3 && p[0] == 0xEF && p[1] == 0xBB && p[2] == 0xBF) {
+        return text_encoding::utf8;
+    }
+    if (size >= 2 && p[0] == 0xFF && p[1] == 0xFE) {
+        return text_encoding::utf16le;
+    }
+    if (size >= 2 && p[0] == 0xFE && p[1] == 0xFF) {
+        return text_encoding::utf16be;
+    }
+    size_t sample = std::min<size_t>(size, 4096) & ~size_t(1);
+    if (sample >= 4) {
+        size_t even_zeros = 0;
+        size_t odd_zeros = 0;
+        for (size_t i = 0; i < sample; i += 2) {
+            even_zeros += p[i] == 0;
+            odd_zeros += p[i + 1] == 0;
+        }
+        size_t pairs = sample / 2;
+        if (odd_zeros * 10 >= pairs * 4 && even_zeros * 10 < pairs) {
+            return text_encoding::utf16le;
+        }
+        if (even_zeros * 10 >= pairs * 4 && odd_zeros * 10 < pairs) {
+            return text_encoding::utf16be;
+        }
+    }
+    if (valid_utf8(p, size) || std::memchr(p, 0, size)) {
+        return text_encoding::utf8;
+    }
+    return text_encoding::windows1252;
+}
+
+utf8_transcoder::utf8_transcoder(text_encoding encoding) : encoding(encoding) {
+    reset();
+}
+
+void utf8_transcoder::reset() {
+    consumed = 0;
+    pending_byte = 0;
+    has_pending_byte = false;
+    high_surrogate = 0;
+    high_surrogate_offset = 0;
+}
+
+void utf8_transcoder::append(uint32_t c, int64_t offset, std::vector<char>& out, std::vector<int64_t>* offsets) {
+    size_t before = out.size();
+    if (c < 0x80) {
+        out.push_back(char(c));
+    } else if (c < 0x800) {
+        out.push_back(char(0xC0 | (c >> 6)));
+        out.push_back(char(0x80 | (c & 0x3F)));
+    } else if (c < 0x10000) {
+        out.push_back(char(0xE0 | (c >> 12)));
+        out.push_back(char(0x80 | ((c >> 6) & 0x3F)));
+        out.push_back(char(0x80 | (c & 0x3F)));
+    } else {
+        out.push_back(char(0xF0 | (c >> 18)));
+        out.push_back(char(0x80 | ((c >> 12) & 0x3F)));
+        out.push_back(char(0x80 | ((c >> 6) & 0x3F)));
+        out.push_back(char(0x80 | (c & 0x3F)));
+    }
+    if (offsets) {
+        offsets->resize(offsets->size() + (out.size() - before), offset);
+    }
+}
+
+void utf8_transcoder::unit(uint32_t value, int64_t offset, std::vector<char>& out, std::vector<int64_t>* offsets) {
+    if (high_surrogate) {
+        if (value >= 0xDC00 && value <= 0xDFFF) {
+            append(0x10000 + ((high_surrogate - 0xD800) << 10) + (value - 0xDC00), high_surrogate_offset, out, offsets);
+            high_surrogate = 0;
+            return;
+        }
+        append(REPLACEMENT, high_surrogate_offset, out, offsets);
+        high_surrogate = 0;
+    }
+    if (value >= 0xD800 && value <= 0xDBFF) {
+        high_surrogate = value;
+        high_surrogate_offset = offset;
+    } else if (value >= 0xDC00 && value <= 0xDFFF) {
+        append(REPLACEMENT, offset, out, offsets);
+    } else {
+        append(value, offset, out, offsets);
+    }
+}
+
+void utf8_transcoder::convert(const char* data, size_t size, std::vector<char>& out, std::vector<int64_t>* offsets) {
+    auto p = reinterpret_cast<const unsigned char*>(data);
+    if (encoding == text_encoding::utf8) {
+        out.insert(out.end(), data, data + size);
+        if (offsets) {
+            for (size_t i = 0; i < size; i++) {
+                offsets->push_back(consumed + int64_t(i));
+            }
+        }
+    } else if (encoding == text_encoding::windows1252) {
+        for (size_t i = 0; i < size; i++) {
+            uint32_t c = p[i];
+            if (c >= 0x80 && c < 0xA0) {
+                c = WINDOWS_1252[c - 0x80];
+            }
+            append(c, consumed + int64_t(i), out, offsets);
+        }
+    } else {
+        bool little_endian = encoding == text_encoding::utf16le;
+        size_t i = 0;
+        if (has_pending_byte && size > 0) {
+            // the first byte of this unit came with the previous chunk
+            unsigned char a = pending_byte;
+            unsigned char b = p[0];
+            unit(little_endian ? (a | (b << 8)) : ((a << 8) | b), consumed - 1, out, offsets);
+            has_pending_byte = false;
+            i = 1;
+        }
+        for (; i + 1 < size; i += 2) {
+            uint32_t value = little_endian ? (p[i] | (p[i + 1] << 8)) : ((p[i] << 8) | p[i + 1]);
+            unit(value, consumed + int64_t(i), out, offsets);
+        }
+        if (i < size) {
+            pending_byte = p[i];
+            has_pending_byte = true;
+        }
+    }
+    consumed += int64_t(size);
+}
@@ -0,0 +1,48 @@
+#ifndef ENCODING_H
+#define ENCODING_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Encodings files are read in. Everything is indexed and searched as UTF-8.
+enum class text_encoding : uint8_t {
+    utf8,
+    utf16le,
+    utf16be,
+    // also covers Latin-1, whose printable characters are the same
+    windows1252
+};
+
+const char* encoding_name(text_encoding encoding);
+
+// Guesses the encoding from the beginning of a file: a BOM decides, otherwise
+// ASCII text in UTF-16 is recognized by its zero bytes, and what is not valid
+// UTF-8 is taken for Windows-1252. Binaries are reported as UTF-8, so they
+// reach the trigram counter unchanged and are rejected there.
+text_encoding detect_encoding(const char* head, size_t size);
+
+// Converts a stream to UTF-8 chunk by chunk. Code units split between chunks
+// are carried over, so chunks can be cut anywhere.
+class utf8_transcoder {
+public:
+    explicit utf8_transcoder(text_encoding encoding);
+
+    void reset();
+    // Appends the UTF-8 form of the next chunk to out and, when offsets is
+    // given, the input offset every appended byte came from.
+    void convert(const char* data, size_t size, std::vector<char>& out, std::vector<int64_t>* offsets);
+
+private:
+    text_encoding encoding;
+    int64_t consumed;
+    unsigned char pending_byte;
+    bool has_pending_byte;
+    uint32_t high_surrogate;
+    int64_t high_surrogate_offset;
+
+    void append(uint32_t code_point, int64_t offset, std::vector<char>& out, std::vector<int64_t>* offsets);
+    void unit(uint32_t value, int64_t offset, std::vector<char>& out, std::vector<int64_t>* offsets);
+};
+
+#endif // ENCODING_H
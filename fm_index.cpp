@@ -0,0 +1,289 @@
+#include "fm_index.h"
+#include <algorithm>
+
+const uint64_t fm_index::MAX_TEXT;
+const uint32_t fm_index::SAMPLE_RATE;
+const uint32_t fm_index::CANCEL_CHECK;
+const uint32_t fm_index::BLOCK;
+
+namespace {
+    // Suffix array by induced sorting (SA-IS) in linear time. The last symbol of s
+    // must be 0 and occur nowhere else, every symbol must be below k.
+    template<typename T>
+    void suffix_array(const T* s, int32_t* sa, int32_t n, int32_t k) {
+        // true for S-type positions, whose suffix is smaller than the next one
+        std::vector<bool> smaller(size_t(n), false);
+        smaller[size_t(n - 1)] = true;
+        for (int32_t i = n - 2; i >= 0; i--) {
+            smaller[size_t(i)] = s[i] < s[i + 1] || (s[i] == s[i + 1] && smaller[size_t(i + 1)]);
+        }
+        auto leftmost = [&smaller](int32_t i) {
+            return i > 0 && smaller[size_t(i)] && !smaller[size_t(i - 1)];
+        };
+        std::vector<int32_t> bucket(static_cast<size_t>(k));
+        auto buckets = [&](bool ends) {
+            std::fill(bucket.begin(), bucket.end(), 0);
+            for (int32_t i = 0; i < n; i++) {
+                bucket[size_t(s[i])]++;
+            }
+            int32_t sum = 0;
+            for (auto& b : bucket) {
+                sum += b;
+                b = ends ? sum : sum - b;
+            }
+        };
+        auto induce = [&] {
+            buckets(false);
+            for (int32_t i = 0; i < n; i++) {
+                int32_t j = sa[i] - 1;
+                if (sa[i] > 0 && !smaller[size_t(j)]) {
+                    sa[bucket[size_t(s[j])]++] = j;
+                }
+            }
+            buckets(true);
+            for (int32_t i = n - 1; i >= 0; i--) {
+                int32_t j = sa[i] - 1;
+                if (sa[i] > 0 && smaller[size_t(j)]) {
+                    sa[--bucket[size_t(s[j])]] = j;
+                }
+            }
+        };
+
+        // sorts the leftmost S-type substrings by inducing from their unsorted starts
+        buckets(true);
+        std::fill(sa, sa + n, -1);
+        for (int32_t i = 1; i < n; i++) {
+            if (leftmost(i)) {
+                sa[--bucket[size_t(s[i])]] = i;
+            }
+        }
+        induce();
+        int32_t n1 = 0;
+        for (int32_t i = 0; i < n; i++) {
+            if (leftmost(sa[i])) {
+                sa[n1++] = sa[i];
+            }
+        }
+
+        // names equal substrings alike, the names in text order make the reduced string
+        std::fill(sa + n1, sa + n, -1);
+        int32_t names = 0;
+        int32_t previous = -1;
+        for (int32_t i = 0; i < n1; i++) {
+            int32_t position = sa[i];
+            bool different = false;
+            for (int32_t d = 0; d < n; d++) {
+                if (previous == -1 || s[position + d] != s[previous + d] ||
+                    smaller[size_t(position + d)] != smaller[size_t(previous + d)]) {
+                    different = true;
+                    break;
+                }
+                if (d > 0 && (leftmost(position + d) || leftmost(previous + d))) {
+                    break;
+                }
+            }
+            if (different) {
+                names++;
+                previous = position;
+            }
+            sa[n1 + position / 2] = names - 1;
+        }
+        for (int32_t i = n - 1, j = n - 1; i >= n1; i--) {
+            if (sa[i] >= 0) {
+                sa[j--] = sa[i];
+            }
+        }
+
+        // sorts the leftmost suffixes by the reduced string, then induces all the others from them
+        int32_t* reduced = sa + n - n1;
+        if (names < n1) {
+            suffix_array<int32_t>(reduced, sa, n1, names);
+        } else {
+            for (int32_t i = 0; i < n1; i++) {
+                sa[reduced[i]] = i;
+            }
+        }
+        for (int32_t i = 1, j = 0; i < n; i++) {
+            if (leftmost(i)) {
+                reduced[j++] = i;
+            }
+        }
+        for (int32_t i = 0; i < n1; i++) {
+            sa[i] = reduced[sa[i]];
+        }
+        std::fill(sa + n1, sa + n, -1);
+        buckets(true);
+        for (int32_t i = n1 - 1; i >= 0; i--) {
+            int32_t j = sa[i];
+            sa[i] = -1;
+            sa[--bucket[size_t(s[j])]] = j;
+        }
+        induce();
+    }
+
+    int popcount(uint64_t word) {
+        return __builtin_popcountll(word);
+    }
+}
+
+uint32_t fm_index::builder::add(const char* data, size_t size) {
+    starts.push_back(uint32_t(text.size()));
+    text.insert(text.end(), data, data + size);
+    text.push_back(0);
+    return uint32_t(starts.size() - 1);
+}
+
+uint64_t fm_index::builder::size() const {
+    return text.size();
+}
+
+fm_index fm_index::builder::build() {
+    fm_index result;
+    auto n = uint32_t(text.size() + 1);
+    // the bytes shifted by one, so that the sentinel at the end is the only 0
+    std::vector<int32_t> sa(n);
+    {
+        std::vector<uint16_t> symbols(n);
+        for (uint32_t i = 0; i + 1 < n; i++) {
+            symbols[i] = uint16_t(text[i] + 1);
+        }
+        symbols[n - 1] = 0;
+        suffix_array<uint16_t>(symbols.data(), sa.data(), int32_t(n), 257);
+    }
+
+    uint32_t counts[256] = {};
+    for (unsigned char c : text) {
+        counts[c]++;
+    }
+    result.first_row[0] = 1;
+    for (int c = 0; c < 256; c++) {
+        result.first_row[c + 1] = result.first_row[c] + counts[c];
+        if (counts[c] > 0) {
+            result.code[c] = uint8_t(result.sigma++);
+        }
+    }
+
+    result.bwt.resize(n);
+    result.sampled.assign(n / 64 + 1, 0);
+    result.checkpoints.assign(size_t(n / BLOCK + 1) * result.sigma, 0);
+    std::vector<uint32_t> running(result.sigma, 0);
+    for (uint32_t row = 0; row < n; row++) {
+        if (row % BLOCK == 0) {
+            std::copy(running.begin(), running.end(), result.checkpoints.begin() + size_t(row / BLOCK) * result.sigma);
+        }
+        auto position = uint32_t(sa[row]);
+        if (position == 0) {
+            result.primary = row;
+            result.bwt[row] = 0;
+        } else {
+            result.bwt[row] = text[position - 1];
+            running[result.code[text[position - 1]]]++;
+        }
+        if (position % SAMPLE_RATE == 0) {
+            result.sampled[row / 64] |= uint64_t(1) << (row % 64);
+            result.samples.push_back(position);
+        }
+    }
+    if (n % BLOCK == 0) {
+        std::copy(running.begin(), running.end(), result.checkpoints.begin() + size_t(n / BLOCK) * result.sigma);
+    }
+    uint32_t before = 0;
+    for (uint64_t word : result.sampled) {
+        result.sampled_before.push_back(before);
+        before += uint32_t(popcount(word));
+    }
+    result.starts = std::move(starts);
+    result.text_size = text.size();
+    text.clear();
+    text.shrink_to_fit();
+    return result;
+}
+
+fm_index::fm_index() {
+    std::fill(first_row, first_row + 257, 0);
+    std::fill(code, code + 256, 0);
+}
+
+size_t fm_index::documents() const {
+    return starts.size();
+}
+
+uint32_t fm_index::rank(unsigned char c, uint32_t row) const {
+    if (first_row[c + 1] == first_row[c]) {
+        return 0;
+    }
+    uint32_t block = row / BLOCK;
+    uint32_t result = checkpoints[size_t(block) * sigma + code[c]];
+    for (uint32_t i = block * BLOCK; i < row; i++) {
+        result += bwt[i] == c;
+    }
+    // the sentinel is stored as a zero byte
+    if (c == 0 && primary >= block * BLOCK && primary < row) {
+        result--;
+    }
+    return result;
+}
+
+uint32_t fm_index::lf(uint32_t row) const {
+    unsigned char c = bwt[row];
+    return first_row[c] + rank(c, row);
+}
+
+uint32_t fm_index::position_of(uint32_t row) const {
+    uint32_t steps = 0;
+    while (!(sampled[row / 64] >> (row % 64) & 1)) {
+        row = lf(row);
+        steps++;
+    }
+    uint64_t below = sampled[row / 64] & ((uint64_t(1) << (row % 64)) - 1);
+    return samples[sampled_before[row / 64] + uint32_t(popcount(below))] + steps;
+}
+
+bool fm_index::range(const char* needle, size_t length, uint32_t& begin, uint32_t& end) const {
+    if (starts.empty() || length == 0) {
+        return false;
+    }
+    begin = 0;
+    end = uint32_t(bwt.size());
+    for (size_t i = length; i-- > 0;) {
+        auto c = (unsigned char) needle[i];
+        begin = first_row[c] + rank(c, begin);
+        end = first_row[c] + rank(c, end);
+        if (begin >= end) {
+            return false;
+        }
+    }
+    return true;
+}
+
+uint64_t fm_index::count(const char* needle, size_t length) const {
+    uint32_t begin, end;
+    return range(needle, length, begin, end) ? end - begin : 0;
+}
+
+bool fm_index::locate(const char* needle, size_t length, std::vector<hit>& out,
+                      std::function<bool()> const& cancelled) const {
+    uint32_t begin, end;
+    if (!range(needle, length, begin, end)) {
+        return true;
+    }
+    for (uint32_t row = begin; row < end; row++) {
+        // a row takes up to SAMPLE_RATE steps back through the text
+        if (cancelled && (row - begin) % CANCEL_CHECK == 0 && cancelled()) {
+            return false;
+        }
+        uint32_t position = position_of(row);
+        auto document = uint32_t(std::upper_bound(starts.begin(), starts.end(), position) - starts.begin() - 1);
+        // the separator behind the document
+        uint64_t limit = (document + 1 < starts.size() ? starts[document + 1] : text_size) - 1;
+        if (position + length <= limit) {
+            out.push_back(hit{document, position - starts[document]});
+        }
+    }
+    return true;
+}
+
+size_t fm_index::bytes() const {
+    return bwt.size() + (checkpoints.size() + sampled_before.size() + samples.size() + starts.size()) * 4 +
+           sampled.size() * 8;
+}
@@ -0,0 +1,86 @@
+#ifndef FM_INDEX_H
+#define FM_INDEX_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// What a scan builds besides the trigram index.
+enum class index_engine {
+    trigrams,   // searches read the files the trigrams let through
+    fm_index    // also an FM-index of the text, so searches read no files
+};
+
+// FM-index over the texts of many documents laid end to end, each followed by
+// a zero byte: the Burrows-Wheeler transform of the whole with rank checkpoints
+// for counting and every SAMPLE_RATE-th suffix array entry for locating. It
+// answers queries without the documents, at roughly three bytes per byte of text.
+class fm_index {
+public:
+    // positions are 32-bit
+    static const uint64_t MAX_TEXT = (uint64_t(1) << 31) - 2;
+    static const uint32_t SAMPLE_RATE = 32;
+    static const uint32_t CANCEL_CHECK = 4096;
+
+    class builder {
+    public:
+        // Appends the next document and returns its number.
+        uint32_t add(const char* data, size_t size);
+        // Bytes of text so far, separators included.
+        uint64_t size() const;
+        fm_index build();
+
+    private:
+        std::vector<unsigned char> text;
+        std::vector<uint32_t> starts;
+    };
+
+    struct hit {
+        uint32_t document;
+        uint32_t offset;
+
+        bool operator<(hit const& other) const {
+            return document != other.document ? document < other.document : offset < other.offset;
+        }
+    };
+
+    fm_index();
+
+    size_t documents() const;
+    // Occurrences in the whole text, those running across the end of a document included.
+    uint64_t count(const char* needle, size_t length) const;
+    // Appends the occurrences inside documents, in no particular order. Asks cancelled every
+    // CANCEL_CHECK rows and returns false as soon as it says so.
+    bool locate(const char* needle, size_t length, std::vector<hit>& out,
+                std::function<bool()> const& cancelled = nullptr) const;
+    // Memory held by the index.
+    size_t bytes() const;
+
+private:
+    static const uint32_t BLOCK = 256;
+
+    std::vector<unsigned char> bwt;
+    // row of the suffix that is the whole text, whose preceding symbol is the sentinel
+    uint32_t primary = 0;
+    // first row of every byte, the sentinel row being 0
+    uint32_t first_row[257];
+    // dense code of every byte present, and the rank of each code at every BLOCK-th row
+    uint8_t code[256];
+    uint32_t sigma = 0;
+    std::vector<uint32_t> checkpoints;
+    // rows whose suffix starts at a multiple of SAMPLE_RATE, with set bits counted per word
+    std::vector<uint64_t> sampled;
+    std::vector<uint32_t> sampled_before;
+    std::vector<uint32_t> samples;
+    std::vector<uint32_t> starts;
+    uint64_t text_size = 0;
+
+    // Occurrences of c in the rows before row.
+    uint32_t rank(unsigned char c, uint32_t row) const;
+    uint32_t lf(uint32_t row) const;
+    uint32_t position_of(uint32_t row) const;
+    bool range(const char* needle, size_t length, uint32_t& begin, uint32_t& end) const;
+};
+
+#endif // FM_INDEX_H
@@ -1,8 +1,12 @@
 #include "mainwindow.h"
+#include "command_line.h"
 #include <QApplication>
 
 int main(int argc, char *argv[])
 {
+    if (is_headless(argc, argv)) {
+        return run_headless(argc, argv);
+    }
     QApplication a(argc, argv);
     main_window w;
     w.show();
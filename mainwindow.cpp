@@ -6,12 +6,17 @@
 #include <QDir>
 #include <QFileDialog>
 #include <QFileInfo>
+#include <QInputDialog>
 #include <QMessageBox>
 #include <QLabel>
 #include <QDebug>
 #include <QtWidgets/QTreeWidgetItem>
 #include <QtConcurrent/QtConcurrent>
 #include <QMetaType>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QStandardPaths>
+#include "daemon_protocol.h"
 #include <algorithm>
 
 main_window::main_window(QWidget *parent)
@@ -19,6 +24,7 @@ main_window::main_window(QWidget *parent)
     ui->setupUi(this);
     setGeometry(QStyle::alignedRect(Qt::LeftToRight, Qt::AlignCenter, size(), qApp->desktop()->availableGeometry()));
     ui->treeWidget->header()->setSectionResizeMode(0, QHeaderView::ResizeToContents);
+    ui->statsWidget->header()->setSectionResizeMode(0, QHeaderView::ResizeToContents);
 
     QCommonStyle style;
     ui->actionScan_Directory->setIcon(style.standardIcon(QCommonStyle::SP_DialogOpenButton));
@@ -29,55 +35,125 @@ main_window::main_window(QWidget *parent)
     clear_gui();
 
     connect(ui->actionScan_Directory, &QAction::triggered, this, &main_window::select_directory);
+    connect(ui->actionAdd_Directory, &QAction::triggered, this, &main_window::add_directory);
+    connect(ui->actionRemove_Directory, &QAction::triggered, this, &main_window::remove_directory);
+    connect(ui->actionExport_Statistics, &QAction::triggered, this, &main_window::export_stats);
+    connect(ui->actionRecord_Traces, &QAction::toggled, this, &main_window::toggle_tracing);
+    connect(ui->actionExclusion_Rules, &QAction::triggered, this, &main_window::edit_exclusions);
+    connect(ui->actionIndex_Mode, &QAction::triggered, this, &main_window::edit_index_mode);
     connect(ui->actionExit, &QAction::triggered, this, &QWidget::close);
     connect(ui->actionAbout, &QAction::triggered, this, &main_window::show_about_dialog);
 
     qRegisterMetaType<vector<QString>>("vector<QString>");
     qRegisterMetaType<QSet<QString>>("QSet<QString>");
-    qRegisterMetaType<vector<int>>("vector<int>");
+    qRegisterMetaType<occurrence_list>("occurrence_list");
+    qRegisterMetaType<scanner_stats>("scanner_stats");
+    qRegisterMetaType<progress_info>("progress_info");
 
     connect(this, SIGNAL(exception_occurred(
                                  const QString&)),
             this, SLOT(log_error(
                                const QString&)));
 
-    connect(&s, SIGNAL(exception_occurred(
-                               const QString&)),
-            this, SLOT(log_error(
-                               const QString&)));
-    connect(&s, SIGNAL(info_message(
-                               const QString&)),
-            this, SLOT(log_info(
-                               const QString&)));
+    connect_search_signals(&s);
+    connect_search_signals(&client);
+    connect(&s, &scanner::search_error, this, [this](quint64, const QString& message) {
+        log_error(message);
+    });
     connect(&s, SIGNAL(all_new_text_files(
                                const QSet<QString>&)),
             this, SLOT(print_text_files(
                                const QSet<QString>&)));
-    connect(&s, SIGNAL(progress_updated(int)),
-            this, SLOT(update_progress_bar(int)));
-    connect(&s, SIGNAL(indexing_finished()),
-            this, SLOT(indexing_finished()));
-    connect(&s, SIGNAL(searching_finished()),
-            this, SLOT(searching_finished()));
-    connect(&s, SIGNAL(update_results(
-                               const QString&, const vector<int>&)),
-            this, SLOT(update_window(
-                               const QString&, const vector<int>&)));
+    connect(&s, SIGNAL(stats_updated(
+                               const scanner_stats&)),
+            this, SLOT(show_stats(
+                               const scanner_stats&)));
     connect(ui->searchButton, SIGNAL(clicked()), this, SLOT(search_clicked()));
+    connect(ui->nextPageButton, SIGNAL(clicked()), this, SLOT(next_page_clicked()));
+    connect(ui->modeBox, static_cast<void (QComboBox::*)(int)>(&QComboBox::currentIndexChanged), this, [this](int index) {
+        ui->perFileBox->setEnabled(index == int(query_mode::first_n));
+    });
+    connect(ui->treeWidget, &QTreeWidget::itemExpanded, this, &main_window::show_occurrences);
     connect(ui->cancelButton, SIGNAL(clicked()), this, SLOT(cancel_clicked()));
     connect(this, SIGNAL(cancel_thread()), &s, SLOT(cancel()));
+    connect(this, SIGNAL(cancel_thread()), &client, SLOT(cancel()));
+    connect(&client, &search_client::disconnected, this, &main_window::daemon_disconnected);
+
+    // a daemon of this user has the index already, this window only asks it
+    if (client.connect_to_daemon(default_socket_name(), DAEMON_CONNECT_TIMEOUT_MS)) {
+        remote = true;
+        ui->actionScan_Directory->setEnabled(false);
+        ui->actionAdd_Directory->setEnabled(false);
+        ui->actionRemove_Directory->setEnabled(false);
+        ui->actionExclusion_Rules->setEnabled(false);
+        ui->actionIndex_Mode->setEnabled(false);
+        update_roots();
+        return;
+    }
+    load_roots();
+    if (!saved_roots.isEmpty()) {
+        index_roots(saved_roots);
+    }
+}
+
+// Signals scanner and search_client have in common.
+void main_window::connect_search_signals(QObject *source) {
+    connect(source, SIGNAL(exception_occurred(
+                               const QString&)),
+            this, SLOT(log_error(
+                               const QString&)));
+    connect(source, SIGNAL(info_message(
+                               const QString&)),
+            this, SLOT(log_info(
+                               const QString&)));
+    connect(source, SIGNAL(progress_updated(quint64, const progress_info&)),
+            this, SLOT(show_progress(quint64, const progress_info&)));
+    connect(source, SIGNAL(index_published(quint64, const QString&, int, quint64)),
+            this, SLOT(index_published(quint64, const QString&, int, quint64)));
+    connect(source, SIGNAL(indexing_finished(quint64)),
+            this, SLOT(indexing_finished(quint64)));
+    connect(source, SIGNAL(searching_finished(quint64)),
+            this, SLOT(searching_finished(quint64)));
+    connect(source, SIGNAL(search_truncated(quint64, quint64)),
+            this, SLOT(search_truncated(quint64, quint64)));
+    connect(source, SIGNAL(update_results(quint64,
+                               const QString&, const occurrence_list&)),
+            this, SLOT(update_window(quint64,
+                               const QString&, const occurrence_list&)));
+}
+
+void main_window::daemon_disconnected() {
+    if (!remote) {
+        return;
+    }
+    remote = false;
+    searching = false;
+    scan_epoch = search_epoch = 0;
+    ui->actionScan_Directory->setEnabled(true);
+    ui->actionAdd_Directory->setEnabled(true);
+    ui->actionRemove_Directory->setEnabled(true);
+    ui->actionExclusion_Rules->setEnabled(true);
+    ui->actionIndex_Mode->setEnabled(true);
+    ui->searchButton->setEnabled(false);
+    ui->nextPageButton->setEnabled(false);
+    update_roots();
+    emit exception_occurred("The search daemon has gone, scan a directory to search in this window");
 }
 
 main_window::~main_window() {
     emit cancel_thread();
     future.waitForFinished();
+    // superseded runs are cancelled but may still be finishing in the pool
+    QThreadPool::globalInstance()->waitForDone();
 }
 
 void main_window::select_directory() {
     QString dir = QFileDialog::getExistingDirectory(this, "Select Directory for Scanning",
                                                     QString(),
                                                     QFileDialog::ShowDirsOnly | QFileDialog::DontResolveSymlinks);
-
+    if (dir.isEmpty()) {
+        return;
+    }
     scan_directory(dir);
 }
 
@@ -87,7 +163,7 @@ void main_window::print_text_files(const QSet<QString> &names) {
         auto *f = new QTreeWidgetItem(ui->treeWidget);
         f->setText(0, name);
         ui->treeWidget->addTopLevelItem(f);
-        update_progress_bar(++counter / names.size());
+        update_progress_bar(int(++counter * 100 / names.size()));
     }
 }
 
@@ -101,16 +177,31 @@ void main_window::clear_layout(QLayout *layout) {
 }
 
 void main_window::clear_gui() {
+    pending_occurrences.clear();
     ui->treeWidget->clear();
     clear_layout(ui->verticalLayout);
     ui->progressBar->setValue(0);
+    ui->progressBar->setFormat("%p%");
     ui->searchButton->setEnabled(false);
+    ui->nextPageButton->setEnabled(false);
 }
 
-void main_window::searching_finished() {
+void main_window::searching_finished(quint64 epoch) {
+    if (epoch != search_epoch) {
+        return;
+    }
+    searching = false;
     ui->searchButton->setEnabled(true);
 }
 
+void main_window::search_truncated(quint64 epoch, quint64 results) {
+    if (epoch != search_epoch) {
+        return;
+    }
+    ui->nextPageButton->setEnabled(true);
+    ui->nextPageButton->setToolTip(QString("The last page stopped after %1 matches").arg(results));
+}
+
 void main_window::search_clicked() {
     QString text = ui->textEdit->toPlainText();
     const int MAX_STR_LEN = 10000;
@@ -124,37 +215,358 @@ void main_window::search_clicked() {
     }
     ui->searchButton->setEnabled(false);
     clear_gui();
-    if (!future.isFinished()) {
-        emit cancel_thread();
+    query_options query;
+    query.mode = query_mode(ui->modeBox->currentIndex());
+    query.per_file = size_t(ui->perFileBox->value());
+    query.max_results = quint64(ui->maxResultsBox->value());
+    query.max_errors = unsigned(ui->errorsBox->value());
+    query.words = word_match(ui->wordBox->currentIndex());
+    if (ui->rootBox->currentIndex() > 0) {
+        query.roots.append(ui->rootBox->currentText());
+    }
+    if (remote) {
+        searching = true;
+        search_epoch = client.search(text, query);
+        return;
     }
-    future = QtConcurrent::run(&s, &scanner::search, text);
+    cancel_token token = s.new_search_token();
+    search_epoch = token.epoch();
+    searching = true;
+    future = QtConcurrent::run(&s, &scanner::search, text, query, token);
+}
+
+void main_window::next_page_clicked() {
+    // the next page is added below the results already shown
+    ui->searchButton->setEnabled(false);
+    ui->nextPageButton->setEnabled(false);
+    quint64 previous = search_epoch;
+    if (remote) {
+        searching = true;
+        search_epoch = client.search_next(previous);
+        return;
+    }
+    cancel_token token = s.new_search_token();
+    search_epoch = token.epoch();
+    searching = true;
+    future = QtConcurrent::run(&s, &scanner::search_next, previous, token);
 }
 
 void main_window::scan_directory(QString const &dir) {
-    emit cancel_thread();
     clear_gui();
-    setWindowTitle(QString("Directory - %1").arg(dir));
-    future = QtConcurrent::run(&s, &scanner::scan, dir);
+    ui->coverageLabel->setText("Indexing...");
+    cancel_token token = s.new_scan_token();
+    scan_epoch = token.epoch();
+    saved_roots = QStringList{QDir(dir).absolutePath()};
+    save_roots();
+    future = QtConcurrent::run(&s, &scanner::scan, QDir(dir), token);
+    update_roots();
+}
+
+void main_window::add_directory() {
+    QString dir = QFileDialog::getExistingDirectory(this, "Select Directory to Add", QString(),
+                                                    QFileDialog::ShowDirsOnly | QFileDialog::DontResolveSymlinks);
+    if (dir.isEmpty()) {
+        return;
+    }
+    QString path = QDir(dir).absolutePath();
+    for (QString const& root : saved_roots) {
+        bool nested = path.startsWith(root + "/") || root.startsWith(path + "/");
+        if (nested) {
+            emit exception_occurred(QString("%1 overlaps the indexed directory %2").arg(path).arg(root));
+            return;
+        }
+    }
+    if (!saved_roots.contains(path)) {
+        saved_roots.append(path);
+        save_roots();
+    }
+    clear_gui();
+    index_roots(QStringList{path});
+}
+
+void main_window::remove_directory() {
+    QStringList roots = s.roots();
+    if (roots.isEmpty()) {
+        emit exception_occurred("No directory is indexed");
+        return;
+    }
+    bool ok;
+    QString root = QInputDialog::getItem(this, "Remove Directory", "Directory to drop from the index:",
+                                         roots, 0, false, &ok);
+    if (!ok) {
+        return;
+    }
+    s.remove_root(root);
+    saved_roots.removeAll(root);
+    save_roots();
+    update_roots();
+    log_info(root + " is removed from the index");
+}
+
+// Indexes the directories one after another next to those already indexed.
+void main_window::index_roots(QStringList const &dirs) {
+    ui->coverageLabel->setText("Indexing...");
+    // the scans of other directories keep running
+    cancel_token token = s.new_query_token();
+    scan_epoch = token.epoch();
+    future = QtConcurrent::run([this, dirs, token] {
+        for (QString const& dir : dirs) {
+            if (token.cancelled()) {
+                return;
+            }
+            s.add_root(QDir(dir), token);
+        }
+    });
+}
+
+void main_window::update_roots() {
+    QStringList roots = remote ? client.roots() : s.roots();
+    QStringList shown;
+    for (int i = 1; i < ui->rootBox->count(); i++) {
+        shown.append(ui->rootBox->itemText(i));
+    }
+    if (shown == roots && !roots.isEmpty()) {
+        return;
+    }
+    QString current = ui->rootBox->currentIndex() > 0 ? ui->rootBox->currentText() : QString();
+    ui->rootBox->clear();
+    ui->rootBox->addItem("All directories");
+    ui->rootBox->addItems(roots);
+    ui->rootBox->setCurrentIndex(std::max(0, ui->rootBox->findText(current)));
+    if (remote) {
+        setWindowTitle(QString("Daemon - %1").arg(roots.join(", ")));
+    } else if (roots.size() == 1) {
+        setWindowTitle(QString("Directory - %1").arg(roots.first()));
+    } else {
+        setWindowTitle(roots.isEmpty() ? QString("Text Searcher") : QString("%1 directories").arg(roots.size()));
+    }
+}
+
+void main_window::load_roots() {
+    QFile f(QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/roots.json");
+    if (!f.open(QFile::ReadOnly)) {
+        return;
+    }
+    for (auto const& root : QJsonDocument::fromJson(f.readAll()).array()) {
+        // directories that are gone are forgotten
+        if (QFileInfo(root.toString()).isDir()) {
+            saved_roots.append(root.toString());
+        }
+    }
+}
+
+void main_window::save_roots() {
+    QString dir = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation);
+    QFile f(dir + "/roots.json");
+    if (!QDir().mkpath(dir) || !f.open(QFile::WriteOnly | QFile::Truncate)) {
+        emit exception_occurred("Cannot write the file " + f.fileName());
+        return;
+    }
+    f.write(QJsonDocument(QJsonArray::fromStringList(saved_roots)).toJson());
 }
 
 void main_window::update_progress_bar(int value) {
     ui->progressBar->setValue(value);
 }
 
-void main_window::update_window(const QString &filename, const vector<int> &occurrences) {
+void main_window::show_progress(quint64 epoch, const progress_info &progress) {
+    // while a search runs the bar belongs to it, otherwise to the indexing
+    if (epoch == (searching ? search_epoch : scan_epoch)) {
+        ui->progressBar->setFormat("%p% (" + progress.describe() + ")");
+        update_progress_bar(progress.percent);
+    }
+}
+
+void main_window::index_published(quint64 epoch, const QString &root, int coverage, quint64 files) {
+    update_roots();
+    if (epoch != scan_epoch) {
+        return;
+    }
+    if (coverage < 100) {
+        ui->coverageLabel->setText(QString("Partial index of %1: %2% of the tree, %3 text files")
+                                           .arg(root).arg(coverage).arg(files));
+    } else {
+        ui->coverageLabel->setText(QString("Index of %1 is complete: %2 text files").arg(root).arg(files));
+    }
+    if (!searching) {
+        ui->searchButton->setEnabled(true);
+    }
+}
+
+void main_window::update_window(quint64 epoch, const QString &filename, const occurrence_list &occurrences) {
+    if (epoch != search_epoch) {
+        return;
+    }
+    auto session = s.current_trace();
+    trace_span span(session.get(), "update_window", "gui", session ? filename.toUtf8() : QByteArray());
     auto *f = new QTreeWidgetItem(ui->treeWidget);
     f->setText(0, filename);
     ui->treeWidget->addTopLevelItem(f);
-    auto cp_occur = occurrences;
-    std::sort(cp_occur.begin(), cp_occur.end());
-    for (const auto &occur: cp_occur) {
-        auto *item = new QTreeWidgetItem(f);
-        item->setText(0, QString::number(occur));
+    if (occurrences.empty()) {
+        // a count-only query
+        f->setText(0, QString("%1 (%2 matches)").arg(filename).arg(occurrences.matches()));
+        return;
     }
+    // the positions are sorted already; their items are created when the file is expanded
+    f->setChildIndicatorPolicy(QTreeWidgetItem::ShowIndicator);
+    pending_occurrences.insert(f, occurrences);
 }
 
-void main_window::indexing_finished() {
+void main_window::show_occurrences(QTreeWidgetItem *item) {
+    auto it = pending_occurrences.find(item);
+    if (it == pending_occurrences.end()) {
+        return;
+    }
+    occurrence_list occurrences = it.value();
+    pending_occurrences.erase(it);
+    size_t i = 0;
+    for (int64_t occur : occurrences) {
+        auto *child = new QTreeWidgetItem(item);
+        if (occurrences.has_distances()) {
+            child->setText(0, QString("%1 (%2 errors)").arg(occur).arg(occurrences.distance(i)));
+        } else {
+            child->setText(0, QString::number(occur));
+        }
+        i++;
+    }
+}
+
+void main_window::show_stats(const scanner_stats &stats) {
+    ui->statsWidget->clear();
+    auto add_group = [this](const QString &name, const vector<pair<QString, quint64>> &counters,
+                            const vector<phase_time> &phases) {
+        auto *group = new QTreeWidgetItem(ui->statsWidget);
+        group->setText(0, name);
+        for (auto &c : counters) {
+            auto *item = new QTreeWidgetItem(group);
+            item->setText(0, c.first);
+            item->setText(1, QString::number(c.second));
+        }
+        for (auto &phase : phases) {
+            auto *item = new QTreeWidgetItem(group);
+            item->setText(0, phase.name);
+            item->setText(1, QString("%1 ms wall, %2 ms process cpu")
+                    .arg(phase.wall_ms, 0, 'f', 1)
+                    .arg(phase.process_cpu_ms, 0, 'f', 1));
+        }
+        group->setExpanded(true);
+    };
+    add_group("Scan", {{"files walked", stats.files_walked},
+                       {"paths excluded", stats.paths_excluded},
+                       {"bytes read", stats.bytes_read},
+                       {"trigrams extracted", stats.trigrams_extracted},
+                       {"trigram bytes", stats.trigram_bytes},
+                       {"binaries rejected", stats.binaries_rejected},
+                       {"duplicate files", stats.duplicate_files},
+                       {"text files", stats.text_files}}, stats.scan_phases);
+    add_group("Search", {{"files checked", stats.files_checked},
+                         {"duplicates skipped", stats.duplicates_skipped},
+                         {"candidates", stats.candidates},
+                         {"bytes verified", stats.bytes_verified},
+                         {"matches", stats.matches}}, stats.search_phases);
+    for (auto &root : stats.roots) {
+        add_group(root.complete ? root.path : QString("%1 (%2% indexed)").arg(root.path).arg(root.coverage),
+                  {{"text files", root.text_files},
+                   {"files walked", root.files_walked},
+                   {"paths excluded", root.paths_excluded},
+                   {"bytes read", root.bytes_read},
+                   {"binaries rejected", root.binaries_rejected},
+                   {"duplicate files", root.duplicate_files},
+                   {"stop trigrams", root.stop_trigrams.size()},
+                   {"FM-index files", root.fm_index_files},
+                   {"FM-index bytes", root.fm_index_bytes},
+                   {"tokens", root.tokens}}, {});
+    }
+}
+
+void main_window::export_stats() {
+    QString path = QFileDialog::getSaveFileName(this, "Export Statistics", "text_searcher_stats.json",
+                                                "JSON (*.json)");
+    if (path.isEmpty()) {
+        return;
+    }
+    QFile f(path);
+    if (!f.open(QFile::WriteOnly | QFile::Truncate)) {
+        emit exception_occurred("Cannot write the file " + path);
+        return;
+    }
+    f.write(QJsonDocument(s.stats().to_json()).toJson());
+}
+
+void main_window::toggle_tracing(bool enabled) {
+    QString dir;
+    if (enabled) {
+        dir = QFileDialog::getExistingDirectory(this, "Select Directory for Traces", QDir::tempPath());
+        if (dir.isEmpty()) {
+            ui->actionRecord_Traces->setChecked(false);
+            return;
+        }
+        log_info("Traces of the next runs will be written to " + dir);
+    }
+    s.set_trace_directory(dir);
+}
+
+void main_window::edit_exclusions() {
+    bool ok;
+    QString text = QInputDialog::getMultiLineText(
+            this, "Exclusion Rules",
+            "One rule per line: a gitignore pattern, ext:<extension>, max-size:<bytes>[K|M|G]\n"
+            "or no-ignore-files to disregard .gitignore and .ignore files",
+            QString::fromStdString(s.exclusion_rules().to_text()), &ok);
+    if (!ok) {
+        return;
+    }
+    path_filter::options rules;
+    std::string error;
+    if (!path_filter::options::parse(text.toStdString(), rules, error)) {
+        emit exception_occurred("Invalid exclusion rule: " + QString::fromStdString(error));
+        return;
+    }
+    s.set_exclusions(rules);
+    log_info("Exclusion rules apply from the next scan");
+}
+
+void main_window::edit_index_mode() {
+    QStringList modes{"Trigram counts",
+                      "Bloom filters of the trigrams, several times smaller",
+                      "Trigram counts and an FM-index of the text, which searches read no files from"};
+    int current = s.current_engine() == index_engine::fm_index ? 2 : s.bloom_filter() > 0 ? 1 : 0;
+    bool ok;
+    QString mode = QInputDialog::getItem(this, "Index Mode", "What a scan builds:", modes, current, false, &ok);
+    if (!ok) {
+        return;
+    }
+    double rate = 0;
+    if (mode == modes[1]) {
+        double percent = QInputDialog::getDouble(
+                this, "Index Mode", "False positive rate of the Bloom filters in percent",
+                s.bloom_filter() > 0 ? s.bloom_filter() * 100 : 1, 0.001, 50, 3, &ok);
+        if (!ok) {
+            return;
+        }
+        rate = percent / 100;
+    }
+    QStringList tokenizers{"None",
+                           "Identifiers: letters, digits and underscores",
+                           "Words: letters and digits"};
+    QString words = QInputDialog::getItem(this, "Index Mode", "Tokens kept for whole-word and prefix searches:",
+                                          tokenizers, int(s.current_tokenizer()), false, &ok);
+    if (!ok) {
+        return;
+    }
+    s.set_bloom_filter(rate);
+    s.set_engine(mode == modes[2] ? index_engine::fm_index : index_engine::trigrams);
+    s.set_tokenizer(tokenizer(tokenizers.indexOf(words)));
+    log_info("The index mode applies from the next scan");
+}
+
+void main_window::indexing_finished(quint64 epoch) {
+    update_roots();
+    if (epoch != scan_epoch || searching) {
+        return;
+    }
     ui->progressBar->setValue(0);
+    ui->progressBar->setFormat("%p%");
     ui->searchButton->setEnabled(true);
 }
 
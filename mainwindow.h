@@ -5,7 +5,11 @@
 #include <memory>
 #include <QFuture>
 #include <QSet>
+#include <QHash>
 #include "scanner.h"
+#include "search_client.h"
+
+class QTreeWidgetItem;
 
 namespace Ui {
 class MainWindow;
@@ -26,23 +30,53 @@ signals:
 private slots:
     void select_directory();
     void scan_directory(QString const& dir);
+    void add_directory();
+    void remove_directory();
     void show_about_dialog();
     void log_error(const QString &message);
     void log_info(const QString &message);
     void update_progress_bar(int value);
+    void show_progress(quint64 epoch, const progress_info& progress);
+    void index_published(quint64 epoch, const QString& root, int coverage, quint64 files);
     void cancel_clicked();
-    void indexing_finished();
+    void indexing_finished(quint64 epoch);
     void print_text_files(const QSet<QString>&);
     void search_clicked();
-    void searching_finished();
-    void update_window(const QString& filename, const vector<int>& occurrences);
+    void searching_finished(quint64 epoch);
+    void search_truncated(quint64 epoch, quint64 results);
+    void next_page_clicked();
+    void update_window(quint64 epoch, const QString& filename, const occurrence_list& occurrences);
+    void show_occurrences(QTreeWidgetItem* item);
+    void show_stats(const scanner_stats& stats);
+    void export_stats();
+    void toggle_tracing(bool enabled);
+    void edit_exclusions();
+    void edit_index_mode();
+    void daemon_disconnected();
 
 private:
     std::unique_ptr<Ui::MainWindow> ui;
     scanner s;
+    search_client client;
+    // searches go to the daemon, the local scanner stays empty
+    bool remote = false;
+    const int DAEMON_CONNECT_TIMEOUT_MS = 300;
     QFuture<void> future;
+    quint64 scan_epoch = 0;
+    quint64 search_epoch = 0;
+    bool searching = false;
+    // files whose occurrences have not been expanded yet
+    QHash<QTreeWidgetItem*, occurrence_list> pending_occurrences;
+    // directories to index again at the next start
+    QStringList saved_roots;
     void clear_layout(QLayout * layout);
     void clear_gui();
+    void connect_search_signals(QObject* source);
+    void index_roots(QStringList const& dirs);
+    // Fills the scope box with the indexed directories.
+    void update_roots();
+    void load_roots();
+    void save_roots();
     //QList<QColor> get_row_colors(size_t colors_count);
 };
 
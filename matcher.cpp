@@ -0,0 +1,147 @@
+#include "matcher.h"
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace {
+    template<size_t N>
+    inline bool equal_fixed(const char* a, const char* b) {
+        // constant size, so the compiler expands it into a few loads and compares
+        return std::memcmp(a, b, N) == 0;
+    }
+
+    // Positions i where data[i] == first and data[i + len - 1] == last,
+    // 16 candidates at a time. check(i) verifies the middle part and returns
+    // false to stop.
+    template<typename Check>
+    inline void filter_first_last(const char* needle, size_t len, const char* data, size_t size,
+                                  Check check) {
+        if (size < len) {
+            return;
+        }
+        size_t last_start = size - len;
+        size_t i = 0;
+#ifdef __SSE2__
+        const __m128i first = _mm_set1_epi8(needle[0]);
+        const __m128i last = _mm_set1_epi8(needle[len - 1]);
+        for (; i + 16 <= last_start + 1; i += 16) {
+            __m128i block_first = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+            __m128i block_last = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + len - 1));
+            unsigned mask = unsigned(_mm_movemask_epi8(
+                    _mm_and_si128(_mm_cmpeq_epi8(first, block_first), _mm_cmpeq_epi8(last, block_last))));
+            while (mask != 0) {
+                unsigned bit = unsigned(__builtin_ctz(mask));
+                if (!check(i + bit)) {
+                    return;
+                }
+                mask &= mask - 1;
+            }
+        }
+#endif
+        for (; i <= last_start; i++) {
+            if (data[i] == needle[0] && data[i + len - 1] == needle[len - 1] && !check(i)) {
+                return;
+            }
+        }
+    }
+}
+
+void byte_find(matcher const& m, const char* data, size_t size, int64_t base, std::vector<int64_t>& out,
+               size_t max_size) {
+    const char* end = data + size;
+    const char* p = data;
+    while (out.size() < max_size &&
+           (p = static_cast<const char*>(std::memchr(p, m.needle[0], size_t(end - p)))) != nullptr) {
+        out.push_back(base + (p - data));
+        p++;
+    }
+}
+
+template<size_t N>
+void fixed_find(matcher const& m, const char* data, size_t size, int64_t base, std::vector<int64_t>& out,
+                size_t max_size) {
+    const char* needle = m.needle.data();
+    filter_first_last(needle, N, data, size, [&](size_t i) {
+        if (equal_fixed<N>(data + i, needle)) {
+            out.push_back(base + int64_t(i));
+        }
+        return out.size() < max_size;
+    });
+}
+
+void simd_find(matcher const& m, const char* data, size_t size, int64_t base, std::vector<int64_t>& out,
+               size_t max_size) {
+    const char* needle = m.needle.data();
+    size_t len = m.needle.size();
+    filter_first_last(needle, len, data, size, [&](size_t i) {
+        if (std::memcmp(data + i + 1, needle + 1, len - 2) == 0) {
+            out.push_back(base + int64_t(i));
+        }
+        return out.size() < max_size;
+    });
+}
+
+void kmp_find(matcher const& m, const char* data, size_t size, int64_t base, std::vector<int64_t>& out,
+              size_t max_size) {
+    const std::string& pattern = m.needle;
+    const std::vector<size_t>& pf = m.prefix_function;
+    size_t len = pattern.size();
+    for (size_t k = 0, i = 0; i < size && out.size() < max_size; ++i) {
+        while (k > 0 && pattern[k] != data[i])
+            k = pf[k - 1];
+        if (pattern[k] == data[i])
+            k++;
+        if (k == len) {
+            out.push_back(base + int64_t(i + 1 - len));
+            k = pf[k - 1];
+        }
+    }
+}
+
+namespace {
+    const matcher::kernel FIXED_KERNELS[matcher::MAX_SHORT_NEEDLE + 1] = {
+            nullptr, byte_find,
+            fixed_find<2>, fixed_find<3>, fixed_find<4>, fixed_find<5>,
+            fixed_find<6>, fixed_find<7>, fixed_find<8>, fixed_find<9>,
+            fixed_find<10>, fixed_find<11>, fixed_find<12>, fixed_find<13>,
+            fixed_find<14>, fixed_find<15>, fixed_find<16>
+    };
+}
+
+matcher::matcher(std::string needle) : needle(std::move(needle)), prefix_function(this->needle.size()) {
+    size_t len = this->needle.size();
+    for (size_t k = 0, i = 1; i < len; ++i) {
+        while (k > 0 && this->needle[i] != this->needle[k])
+            k = prefix_function[k - 1];
+        if (this->needle[i] == this->needle[k])
+            k++;
+        prefix_function[i] = k;
+    }
+    if (len == 0) {
+        find = nullptr;
+    } else if (len <= MAX_SHORT_NEEDLE) {
+        find = FIXED_KERNELS[len];
+    } else if (len <= MAX_SIMD_NEEDLE) {
+        find = simd_find;
+    } else {
+        find = kmp_find;
+    }
+}
+
+size_t matcher::length() const {
+    return needle.size();
+}
+
+std::string const& matcher::bytes() const {
+    return needle;
+}
+
+void matcher::find_all(const char* data, size_t size, int64_t base, std::vector<int64_t>& out,
+                       size_t limit) const {
+    if (find && limit > 0) {
+        size_t max_size = limit > SIZE_MAX - out.size() ? SIZE_MAX : out.size() + limit;
+        find(*this, data, size, base, out, max_size);
+    }
+}
@@ -0,0 +1,50 @@
+#ifndef MATCHER_H
+#define MATCHER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Exact substring search over raw bytes. The kernel is picked once per query
+// by needle length: memchr for one byte, SIMD first/last byte filtering with
+// a compile-time sized compare up to 16 bytes, the same filter with a runtime
+// compare up to 32 bytes, and KMP for longer needles.
+class matcher {
+public:
+    static const size_t MAX_SHORT_NEEDLE = 16;
+    static const size_t MAX_SIMD_NEEDLE = 32;
+
+    explicit matcher(std::string needle);
+
+    size_t length() const;
+    std::string const& bytes() const;
+    // Appends the start of every occurrence in data[0, size), plus base, up to limit of them.
+    void find_all(const char* data, size_t size, int64_t base, std::vector<int64_t>& out,
+                  size_t limit = SIZE_MAX) const;
+
+    // Kernels stop once out holds max_size positions.
+    using kernel = void (*)(matcher const& m, const char* data, size_t size, int64_t base,
+                            std::vector<int64_t>& out, size_t max_size);
+
+private:
+    std::string needle;
+    std::vector<size_t> prefix_function;
+    kernel find;
+
+    friend void kmp_find(matcher const& m, const char* data, size_t size, int64_t base,
+                         std::vector<int64_t>& out, size_t max_size);
+    friend void simd_find(matcher const& m, const char* data, size_t size, int64_t base,
+                          std::vector<int64_t>& out, size_t max_size);
+    template<size_t N>
+    friend void fixed_find(matcher const& m, const char* data, size_t size, int64_t base,
+                           std::vector<int64_t>& out, size_t max_size);
+    friend void byte_find(matcher const& m, const char* data, size_t size, int64_t base,
+                          std::vector<int64_t>& out, size_t max_size);
+};
+
+// Generic Knuth-Morris-Pratt kernel, also used as the reference in tests.
+void kmp_find(matcher const& m, const char* data, size_t size, int64_t base, std::vector<int64_t>& out,
+              size_t max_size = SIZE_MAX);
+
+#endif // MATCHER_H
@@ -0,0 +1,144 @@
+#include "occurrence_list.h"
+#include <algorithm>
+
+occurrence_list::builder::builder() : data(std::make_shared<data_t>()), last(0) {}
+
+void occurrence_list::builder::append(int64_t position) {
+    if (data->count % BLOCK_SIZE == 0) {
+        // a block starts with its first position in full, nothing is stored in the bytes
+        data->block_first.push_back(position);
+        data->block_offset.push_back(uint32_t(data->bytes.size()));
+    } else {
+        uint64_t delta = uint64_t(position - last);
+        while (delta >= 0x80) {
+            data->bytes.push_back(uint8_t(delta | 0x80));
+            delta >>= 7;
+        }
+        data->bytes.push_back(uint8_t(delta));
+    }
+    last = position;
+    data->count++;
+}
+
+void occurrence_list::builder::append(int64_t position, unsigned distance) {
+    data->distances.resize(data->count, 0);
+    data->distances.push_back(uint8_t(std::min(distance, 255u)));
+    append(position);
+}
+
+void occurrence_list::builder::skip(uint64_t matches) {
+    data->skipped += matches;
+}
+
+occurrence_list occurrence_list::builder::finish() {
+    occurrence_list result;
+    data->bytes.shrink_to_fit();
+    data->distances.shrink_to_fit();
+    result.data = std::move(data);
+    data = std::make_shared<data_t>();
+    last = 0;
+    return result;
+}
+
+occurrence_list::occurrence_list() {
+    static const std::shared_ptr<const data_t> EMPTY = std::make_shared<data_t>();
+    data = EMPTY;
+}
+
+occurrence_list occurrence_list::from(std::vector<int64_t> const& positions) {
+    builder b;
+    for (int64_t position : positions) {
+        b.append(position);
+    }
+    return b.finish();
+}
+
+size_t occurrence_list::size() const {
+    return data->count;
+}
+
+bool occurrence_list::empty() const {
+    return data->count == 0;
+}
+
+uint64_t occurrence_list::matches() const {
+    return data->count + data->skipped;
+}
+
+bool occurrence_list::has_distances() const {
+    return !data->distances.empty();
+}
+
+unsigned occurrence_list::distance(size_t i) const {
+    return i < data->distances.size() ? data->distances[i] : 0;
+}
+
+size_t occurrence_list::bytes() const {
+    return data->bytes.size() + data->distances.size() + data->block_first.size() * (sizeof(int64_t) + sizeof(uint32_t));
+}
+
+occurrence_list::const_iterator occurrence_list::begin() const {
+    return from_index(0);
+}
+
+occurrence_list::const_iterator occurrence_list::end() const {
+    const_iterator it;
+    it.list = this;
+    it.index = data->count;
+    return it;
+}
+
+occurrence_list::const_iterator occurrence_list::from_index(size_t i) const {
+    if (i >= data->count) {
+        return end();
+    }
+    const_iterator it;
+    it.list = this;
+    size_t block = i / BLOCK_SIZE;
+    it.index = block * BLOCK_SIZE;
+    it.byte = data->block_offset[block];
+    it.load();
+    while (it.index < i) {
+        ++it;
+    }
+    return it;
+}
+
+void occurrence_list::const_iterator::load() {
+    auto const& d = *list->data;
+    if (index >= d.count) {
+        return;
+    }
+    if (index % BLOCK_SIZE == 0) {
+        value = d.block_first[index / BLOCK_SIZE];
+        byte = d.block_offset[index / BLOCK_SIZE];
+        return;
+    }
+    uint64_t delta = 0;
+    for (int shift = 0;; shift += 7) {
+        uint8_t b = d.bytes[byte++];
+        delta |= uint64_t(b & 0x7F) << shift;
+        if (!(b & 0x80)) {
+            break;
+        }
+    }
+    value += int64_t(delta);
+}
+
+int64_t occurrence_list::const_iterator::operator*() const {
+    return value;
+}
+
+occurrence_list::const_iterator& occurrence_list::const_iterator::operator++() {
+    index++;
+    load();
+    return *this;
+}
+
+bool occurrence_list::const_iterator::operator==(const_iterator const& other) const {
+    return index == other.index && list == other.list;
+}
+
+bool occurrence_list::const_iterator::operator!=(const_iterator const& other) const {
+    return !(*this == other);
+}
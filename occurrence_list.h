@@ -0,0 +1,98 @@
+#ifndef OCCURRENCE_LIST_H
+#define OCCURRENCE_LIST_H
+
+#include <QMetaType>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <vector>
+
+// Sorted 64-bit positions of the matches in one file. They are stored as
+// varint deltas in blocks of BLOCK_SIZE, each block starting with its first
+// position in full, so a list costs one or two bytes per match instead of
+// eight and any block can be decoded on its own. The data is shared and
+// immutable, so lists are cheap to copy through queued signals.
+class occurrence_list {
+    struct data_t;
+
+public:
+    static const size_t BLOCK_SIZE = 128;
+
+    class builder {
+    public:
+        builder();
+        // Positions must not decrease.
+        void append(int64_t position);
+        // Also keeps the edit distance of an approximate match, 255 at most.
+        void append(int64_t position, unsigned distance);
+        // Counts matches whose positions are not kept.
+        void skip(uint64_t matches);
+        occurrence_list finish();
+
+    private:
+        std::shared_ptr<data_t> data;
+        int64_t last;
+    };
+
+    // Decodes one position per step.
+    class const_iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = int64_t;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const int64_t*;
+        using reference = int64_t;
+
+        int64_t operator*() const;
+        const_iterator& operator++();
+        bool operator==(const_iterator const& other) const;
+        bool operator!=(const_iterator const& other) const;
+
+    private:
+        friend class occurrence_list;
+
+        const occurrence_list* list = nullptr;
+        size_t index = 0;
+        size_t byte = 0;
+        int64_t value = 0;
+
+        void load();
+    };
+
+    occurrence_list();
+    static occurrence_list from(std::vector<int64_t> const& positions);
+
+    size_t size() const;
+    bool empty() const;
+    // Matches found, kept or skipped.
+    uint64_t matches() const;
+    // True if the matches are approximate, with a distance each.
+    bool has_distances() const;
+    unsigned distance(size_t i) const;
+    // Encoded size, to compare with 8 bytes per position.
+    size_t bytes() const;
+    const_iterator begin() const;
+    const_iterator end() const;
+    // Starts at the i-th position, decoding only the block it is in.
+    const_iterator from_index(size_t i) const;
+
+private:
+    struct data_t {
+        std::vector<uint8_t> bytes;
+        // first position and byte offset of every block
+        std::vector<int64_t> block_first;
+        std::vector<uint32_t> block_offset;
+        // one per position, empty for exact matches
+        std::vector<uint8_t> distances;
+        size_t count = 0;
+        uint64_t skipped = 0;
+    };
+    friend class builder;
+
+    std::shared_ptr<const data_t> data;
+};
+
+Q_DECLARE_METATYPE(occurrence_list)
+
+#endif // OCCURRENCE_LIST_H
@@ -0,0 +1,338 @@
+#include "path_filter.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <sys/stat.h>
+
+namespace {
+    const char* const IGNORE_FILES[] = {".gitignore", ".ignore"};
+
+    bool has_wildcards(std::string const& s) {
+        return s.find_first_of("*?[\\") != std::string::npos;
+    }
+
+    std::string with_slash(std::string path) {
+        if (path.empty() || path.back() != '/') {
+            path += '/';
+        }
+        return path;
+    }
+
+    std::string trim(std::string const& s) {
+        size_t begin = s.find_first_not_of(" \t\r");
+        size_t end = s.find_last_not_of(" \t\r");
+        return begin == std::string::npos ? std::string() : s.substr(begin, end - begin + 1);
+    }
+
+    // [...] at p, which is moved past it; false when c is not in the class.
+    bool match_class(const char*& p, char c) {
+        const char* q = p + 1;
+        bool negated = *q == '!' || *q == '^';
+        if (negated) q++;
+        bool found = false;
+        bool first = true;
+        for (; *q && (first || *q != ']'); first = false) {
+            char lo = *q++;
+            if (lo == '\\' && *q) lo = *q++;
+            char hi = lo;
+            if (*q == '-' && q[1] && q[1] != ']') {
+                hi = q[1];
+                q += 2;
+            }
+            if (lo <= c && c <= hi) found = true;
+        }
+        if (*q != ']') {
+            // not a class after all, a literal '['
+            bool same = c == '[';
+            p++;
+            return same;
+        }
+        p = q + 1;
+        return found != negated;
+    }
+}
+
+// "*" and "?" stop at slashes, "**" does not; "/**/" also matches a single slash.
+bool path_filter::glob_match(const char* p, const char* s) {
+    while (*p) {
+        if (p[0] == '*' && p[1] == '*') {
+            p += 2;
+            if (*p == '/') {
+                p++;
+                for (const char* t = s;; t++) {
+                    if ((t == s || t[-1] == '/') && glob_match(p, t)) return true;
+                    if (!*t) return false;
+                }
+            }
+            for (const char* t = s;; t++) {
+                if (glob_match(p, t)) return true;
+                if (!*t) return false;
+            }
+        }
+        if (*p == '*') {
+            p++;
+            for (const char* t = s;; t++) {
+                if (glob_match(p, t)) return true;
+                if (!*t || *t == '/') return false;
+            }
+        }
+        if (!*s) return false;
+        if (*p == '?') {
+            if (*s == '/') return false;
+            p++;
+        } else if (*p == '[') {
+            if (*s == '/' || !match_class(p, *s)) return false;
+        } else {
+            if (*p == '\\' && p[1]) p++;
+            if (*p != *s) return false;
+            p++;
+        }
+        s++;
+    }
+    return !*s;
+}
+
+void path_filter::rule_set::add(std::string const& line) {
+    std::string pattern = line;
+    while (!pattern.empty() && (pattern.back() == '\r' || pattern.back() == '\n')) pattern.pop_back();
+    // trailing spaces are dropped unless escaped
+    while (!pattern.empty() && pattern.back() == ' ' &&
+           !(pattern.size() > 1 && pattern[pattern.size() - 2] == '\\')) {
+        pattern.pop_back();
+    }
+    if (pattern.empty() || pattern[0] == '#') {
+        return;
+    }
+    rule r{std::string(), false, false, false};
+    if (pattern[0] == '!') {
+        r.negated = true;
+        pattern.erase(0, 1);
+    } else if (pattern[0] == '\\' && pattern.size() > 1 && (pattern[1] == '!' || pattern[1] == '#')) {
+        pattern.erase(0, 1);
+    }
+    if (!pattern.empty() && pattern.back() == '/') {
+        r.directory_only = true;
+        pattern.pop_back();
+    }
+    if (pattern.find('/') != std::string::npos) {
+        r.anchored = true;
+        if (pattern[0] == '/') pattern.erase(0, 1);
+    }
+    if (pattern.empty()) {
+        return;
+    }
+    r.pattern = pattern;
+    size_t index = rules.size();
+    rules.push_back(r);
+    if (!r.anchored && !has_wildcards(pattern)) {
+        by_name[pattern].push_back(index);
+    } else if (!r.anchored && pattern.size() > 2 && pattern[0] == '*' && pattern[1] == '.' &&
+               !has_wildcards(pattern.substr(2)) && pattern.find('.', 2) == std::string::npos) {
+        by_extension[pattern.substr(2)].push_back(index);
+    } else {
+        globs.push_back(index);
+    }
+}
+
+bool path_filter::rule_set::empty() const {
+    return rules.empty();
+}
+
+void path_filter::rule_set::consider(std::vector<size_t> const& candidates, bool is_directory, size_t& best) const {
+    for (size_t index : candidates) {
+        if ((best == SIZE_MAX || index > best) && (is_directory || !rules[index].directory_only)) {
+            best = index;
+        }
+    }
+}
+
+int path_filter::rule_set::match(std::string const& relative_path, const char* name, bool is_directory) const {
+    if (rules.empty()) {
+        return 0;
+    }
+    // the last matching pattern decides
+    size_t best = SIZE_MAX;
+    auto n = by_name.find(name);
+    if (n != by_name.end()) {
+        consider(n->second, is_directory, best);
+    }
+    const char* dot = std::strrchr(name, '.');
+    if (dot && dot != name) {
+        auto e = by_extension.find(dot + 1);
+        if (e != by_extension.end()) {
+            consider(e->second, is_directory, best);
+        }
+    }
+    for (auto i = globs.rbegin(); i != globs.rend() && (best == SIZE_MAX || *i > best); ++i) {
+        rule const& r = rules[*i];
+        if ((is_directory || !r.directory_only) &&
+            glob_match(r.pattern.c_str(), r.anchored ? relative_path.c_str() : name)) {
+            best = *i;
+            break;
+        }
+    }
+    if (best == SIZE_MAX) {
+        return 0;
+    }
+    return rules[best].negated ? -1 : 1;
+}
+
+path_filter::path_filter(options const& opts, std::string const& root) : opts(opts), root(with_slash(root)) {
+    for (auto& glob : opts.globs) {
+        user_rules.add(glob);
+    }
+}
+
+bool path_filter::is_ignore_file(const char* name) {
+    for (const char* ignore_file : IGNORE_FILES) {
+        if (std::strcmp(name, ignore_file) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+std::shared_ptr<const path_filter::scope> path_filter::load(std::shared_ptr<const scope> const& parent,
+                                                             std::string const& directory) {
+    auto result = std::make_shared<scope>();
+    result->parent = parent;
+    result->directory = with_slash(directory);
+    // .ignore comes last, so its patterns win over those of .gitignore
+    for (const char* ignore_file : IGNORE_FILES) {
+        std::ifstream in(result->directory + ignore_file);
+        std::string line;
+        while (std::getline(in, line)) {
+            result->rules.add(line);
+        }
+    }
+    if (result->rules.empty()) {
+        return parent;
+    }
+    return result;
+}
+
+std::shared_ptr<const path_filter::scope> path_filter::root_scope() const {
+    std::shared_ptr<const scope> result;
+    if (!opts.use_ignore_files) {
+        return result;
+    }
+    // the enclosing directories only count inside a work tree
+    std::vector<std::string> enclosing;
+    struct stat st;
+    if (stat((root + ".git").c_str(), &st) == 0) {
+        return result;
+    }
+    std::string directory = root;
+    while (directory.size() > 1) {
+        directory = directory.substr(0, directory.rfind('/', directory.size() - 2) + 1);
+        enclosing.push_back(directory);
+        if (stat((directory + ".git").c_str(), &st) == 0) {
+            for (auto i = enclosing.rbegin(); i != enclosing.rend(); ++i) {
+                result = load(result, *i);
+            }
+            break;
+        }
+    }
+    return result;
+}
+
+std::shared_ptr<const path_filter::scope> path_filter::enter(std::shared_ptr<const scope> const& parent,
+                                                              std::string const& directory,
+                                                              bool has_ignore_files) const {
+    if (!opts.use_ignore_files || !has_ignore_files) {
+        return parent;
+    }
+    return load(parent, directory);
+}
+
+bool path_filter::needs_sizes() const {
+    return opts.max_file_size > 0;
+}
+
+bool path_filter::excluded(scope const* where, std::string const& path, const char* name, bool is_directory,
+                           int64_t size) const {
+    if (path.size() < root.size()) {
+        return false;
+    }
+    int user = user_rules.match(path.substr(root.size()), name, is_directory);
+    if (user != 0) {
+        return user > 0;
+    }
+    if (!is_directory) {
+        if (opts.max_file_size > 0 && size > opts.max_file_size) {
+            return true;
+        }
+        const char* dot = std::strrchr(name, '.');
+        if (dot && dot != name &&
+            std::find(opts.extensions.begin(), opts.extensions.end(), dot + 1) != opts.extensions.end()) {
+            return true;
+        }
+    }
+    // the closest ignore file decides
+    for (; where; where = where->parent.get()) {
+        int r = where->rules.match(path.substr(where->directory.size()), name, is_directory);
+        if (r != 0) {
+            return r > 0;
+        }
+    }
+    return false;
+}
+
+bool path_filter::options::parse(std::string const& text, options& result, std::string& error) {
+    options parsed;
+    parsed.use_ignore_files = true;
+    std::istringstream in(text);
+    std::string line;
+    while (std::getline(in, line)) {
+        std::string rule = trim(line);
+        if (rule.empty() || rule[0] == '#') {
+            continue;
+        }
+        if (rule == "no-ignore-files") {
+            parsed.use_ignore_files = false;
+        } else if (rule.compare(0, 4, "ext:") == 0) {
+            std::string extension = trim(rule.substr(4));
+            if (!extension.empty() && extension[0] == '.') extension.erase(0, 1);
+            if (extension.empty()) {
+                error = line;
+                return false;
+            }
+            parsed.extensions.push_back(extension);
+        } else if (rule.compare(0, 9, "max-size:") == 0) {
+            std::string value = trim(rule.substr(9));
+            char* end = nullptr;
+            long long size = std::strtoll(value.c_str(), &end, 10);
+            std::string unit = trim(end ? end : "");
+            int64_t multiplier = unit.empty() ? 1 : unit == "K" ? 1024 : unit == "M" ? 1024 * 1024
+                               : unit == "G" ? 1024 * 1024 * 1024 : 0;
+            if (value.empty() || end == value.c_str() || size <= 0 || multiplier == 0) {
+                error = line;
+                return false;
+            }
+            parsed.max_file_size = size * multiplier;
+        } else {
+            parsed.globs.push_back(rule);
+        }
+    }
+    result = parsed;
+    return true;
+}
+
+std::string path_filter::options::to_text() const {
+    std::string text;
+    if (!use_ignore_files) {
+        text += "no-ignore-files\n";
+    }
+    if (max_file_size > 0) {
+        text += "max-size:" + std::to_string(max_file_size) + "\n";
+    }
+    for (auto& extension : extensions) {
+        text += "ext:" + extension + "\n";
+    }
+    for (auto& glob : globs) {
+        text += glob + "\n";
+    }
+    return text;
+}
@@ -0,0 +1,91 @@
+#ifndef PATH_FILTER_H
+#define PATH_FILTER_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Decides which paths of a walk are skipped. Rules come from .gitignore and
+// .ignore files, which apply to the directory they are in and everything
+// below it, and from user rules, which apply to the whole walk and take
+// precedence over them. Excluded directories are never descended into.
+class path_filter {
+public:
+    struct options {
+        // gitignore syntax, relative to the root of the walk
+        std::vector<std::string> globs;
+        // without the dot, compared case-sensitively
+        std::vector<std::string> extensions;
+        // 0 for no limit
+        int64_t max_file_size = 0;
+        bool use_ignore_files = true;
+
+        // One rule per line: a gitignore pattern, "ext:<extension>",
+        // "max-size:<bytes>[K|M|G]" or "no-ignore-files". Returns false with
+        // the offending line in error.
+        static bool parse(std::string const& text, options& result, std::string& error);
+        std::string to_text() const;
+    };
+
+    // Patterns of one ignore file, or of the user rules, compiled for matching.
+    class rule_set {
+    public:
+        void add(std::string const& line);
+        bool empty() const;
+        // 1 when the last matching pattern excludes, -1 when it re-includes, 0 when none matches.
+        int match(std::string const& relative_path, const char* name, bool is_directory) const;
+
+    private:
+        struct rule {
+            std::string pattern;
+            bool negated;
+            bool directory_only;
+            // matched against the path relative to the rule set rather than the name
+            bool anchored;
+        };
+
+        std::vector<rule> rules;
+        // the common "name" and "*.ext" patterns are found by lookup, the rest by globbing
+        std::unordered_map<std::string, std::vector<size_t>> by_name;
+        std::unordered_map<std::string, std::vector<size_t>> by_extension;
+        std::vector<size_t> globs;
+
+        void consider(std::vector<size_t> const& candidates, bool is_directory, size_t& best) const;
+    };
+
+    // Ignore rules in effect in a directory: its own and those of its parents.
+    struct scope {
+        std::shared_ptr<const scope> parent;
+        // absolute, with a trailing slash
+        std::string directory;
+        rule_set rules;
+    };
+
+    path_filter(options const& opts, std::string const& root);
+
+    // Scope around the root, made of the ignore files of the enclosing
+    // directories up to the top of a git work tree.
+    std::shared_ptr<const scope> root_scope() const;
+    // Scope of the entries of directory; its ignore files are only read when the listing has them.
+    std::shared_ptr<const scope> enter(std::shared_ptr<const scope> const& parent, std::string const& directory,
+                                       bool has_ignore_files) const;
+    // path is absolute and below the root, size is -1 when unknown.
+    bool excluded(scope const* where, std::string const& path, const char* name, bool is_directory,
+                  int64_t size) const;
+    bool needs_sizes() const;
+    static bool is_ignore_file(const char* name);
+
+    static bool glob_match(const char* pattern, const char* text);
+
+private:
+    options opts;
+    // with a trailing slash
+    std::string root;
+    rule_set user_rules;
+
+    static std::shared_ptr<const scope> load(std::shared_ptr<const scope> const& parent, std::string const& directory);
+};
+
+#endif // PATH_FILTER_H
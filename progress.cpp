@@ -0,0 +1,78 @@
+#include "progress.h"
+#include <algorithm>
+
+QString progress_info::describe() const {
+    QString text = QString("%1 MB/s").arg(mb_per_second, 0, 'f', 1);
+    if (eta_ms >= 0) {
+        qint64 seconds = (eta_ms + 999) / 1000;
+        text += QString(", %1:%2 left").arg(seconds / 60).arg(seconds % 60, 2, 10, QChar('0'));
+    }
+    return text;
+}
+
+progress_meter::progress_meter(int interval_ms) : interval_ms(interval_ms) {
+    start();
+}
+
+void progress_meter::start(quint64 total_bytes) {
+    started = clock::now();
+    total = total_bytes;
+    done = 0;
+    reported_percent = 0;
+    last_report_ms = 0;
+}
+
+void progress_meter::set_total(quint64 bytes) {
+    total.store(bytes, std::memory_order_relaxed);
+}
+
+void progress_meter::add_done(quint64 bytes) {
+    done.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+int progress_meter::percent() const {
+    return reported_percent.load(std::memory_order_relaxed);
+}
+
+qint64 progress_meter::elapsed_ms() const {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(clock::now() - started).count();
+}
+
+progress_info progress_meter::measure(bool finished) {
+    progress_info info;
+    info.done_bytes = done.load(std::memory_order_relaxed);
+    info.total_bytes = std::max(total.load(std::memory_order_relaxed), info.done_bytes);
+    if (finished) {
+        info.percent = 100;
+    } else if (info.total_bytes > 0) {
+        // 100 is left for the end, the total may not be final yet
+        info.percent = std::min(99, int(info.done_bytes * 100 / info.total_bytes));
+    }
+    // the bar never goes back when the total grows
+    int previous = reported_percent.load(std::memory_order_relaxed);
+    while (previous < info.percent && !reported_percent.compare_exchange_weak(previous, info.percent)) {}
+    info.percent = std::max(info.percent, previous);
+
+    qint64 elapsed = std::max<qint64>(elapsed_ms(), 1);
+    info.mb_per_second = info.done_bytes / (1024.0 * 1024.0) / (elapsed / 1000.0);
+    if (finished) {
+        info.eta_ms = 0;
+    } else if (info.done_bytes > 0) {
+        info.eta_ms = qint64((info.total_bytes - info.done_bytes) * (double) elapsed / info.done_bytes);
+    }
+    return info;
+}
+
+bool progress_meter::poll(progress_info &info) {
+    qint64 now = elapsed_ms();
+    qint64 last = last_report_ms.load(std::memory_order_relaxed);
+    if (now - last < interval_ms || !last_report_ms.compare_exchange_strong(last, now)) {
+        return false;
+    }
+    info = measure(false);
+    return true;
+}
+
+progress_info progress_meter::finish() {
+    return measure(true);
+}
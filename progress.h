@@ -0,0 +1,53 @@
+#ifndef PROGRESS_H
+#define PROGRESS_H
+
+#include <QMetaType>
+#include <QString>
+#include <atomic>
+#include <chrono>
+
+// Plain copy of the progress, safe to pass through queued signals.
+struct progress_info {
+    int percent = 0;
+    quint64 done_bytes = 0;
+    quint64 total_bytes = 0;
+    double mb_per_second = 0;
+    // -1 while there is nothing to estimate from
+    qint64 eta_ms = -1;
+
+    QString describe() const;
+};
+
+Q_DECLARE_METATYPE(progress_info)
+
+// Byte based progress of a scan or a search. Workers add what they have done
+// through atomic counters; the total may keep growing while the tree is walked.
+// poll() lets one caller per interval through, so the GUI gets a bounded
+// number of updates however many threads report.
+class progress_meter {
+public:
+    explicit progress_meter(int interval_ms = 100);
+
+    void start(quint64 total_bytes = 0);
+    void set_total(quint64 bytes);
+    void add_done(quint64 bytes);
+    int percent() const;
+    // Fills info and returns true when an update is due.
+    bool poll(progress_info& info);
+    progress_info finish();
+
+private:
+    using clock = std::chrono::steady_clock;
+
+    int interval_ms;
+    clock::time_point started;
+    std::atomic<quint64> total{0};
+    std::atomic<quint64> done{0};
+    std::atomic<int> reported_percent{0};
+    std::atomic<qint64> last_report_ms{0};
+
+    qint64 elapsed_ms() const;
+    progress_info measure(bool finished);
+};
+
+#endif // PROGRESS_H
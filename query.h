@@ -0,0 +1,53 @@
+#ifndef QUERY_H
+#define QUERY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <QStringList>
+
+// How much a search reports about each matching file. Verification of a file
+// stops as soon as the positions to report have been found.
+enum class query_mode {
+    all,          // every position
+    files_only,   // only that the file matches, with its first position
+    count_only,   // the number of matches, no positions
+    first_n       // the first per_file positions
+};
+
+// Where an occurrence has to lie relative to the words of the text.
+enum class word_match {
+    anywhere,
+    whole_word,   // starts and ends a word
+    prefix        // starts a word
+};
+
+struct query_options {
+    query_mode mode = query_mode::all;
+    size_t per_file = 10;
+    // Matches a search reports before it stops and leaves the rest for the next page, 0 for no limit.
+    // The file that reaches the limit is reported whole.
+    uint64_t max_results = 0;
+    // Edits (insertions, deletions, substitutions) a match may have, 0 for exact matches.
+    unsigned max_errors = 0;
+    word_match words = word_match::anywhere;
+    // Absolute paths of the indexed directories to search, all of them when empty.
+    QStringList roots;
+
+    // Positions kept per file before its verification stops.
+    size_t position_limit() const {
+        switch (mode) {
+            case query_mode::files_only:
+                return 1;
+            case query_mode::first_n:
+                return per_file == 0 ? 1 : per_file;
+            default:
+                return std::numeric_limits<size_t>::max();
+        }
+    }
+    bool keeps_positions() const {
+        return mode != query_mode::count_only;
+    }
+};
+
+#endif // QUERY_H
@@ -0,0 +1,58 @@
+#include "reclaimer.h"
+#include <algorithm>
+#include <thread>
+
+epoch_reclaimer::guard::guard(std::atomic<uint64_t>* slot) : slot(slot) {}
+
+epoch_reclaimer::guard::guard(guard&& other) noexcept : slot(other.slot) {
+    other.slot = nullptr;
+}
+
+epoch_reclaimer::guard::~guard() {
+    if (slot) {
+        slot->store(0);
+    }
+}
+
+epoch_reclaimer::~epoch_reclaimer() {
+    for (auto& item : retired) {
+        item.deleter(item.p);
+    }
+}
+
+epoch_reclaimer::guard epoch_reclaimer::pin() {
+    while (true) {
+        uint64_t epoch = global_epoch.load();
+        for (auto& slot : readers) {
+            uint64_t expected = 0;
+            if (slot.load(std::memory_order_relaxed) == 0 && slot.compare_exchange_strong(expected, epoch)) {
+                return guard(&slot);
+            }
+        }
+        // more concurrent queries than slots, wait for one of them to finish
+        std::this_thread::yield();
+    }
+}
+
+void epoch_reclaimer::retire(void* p, void (*deleter)(void*)) {
+    std::lock_guard<std::mutex> lock(retired_mutex);
+    retired.push_back(retired_item{global_epoch.fetch_add(1), p, deleter});
+    collect();
+}
+
+void epoch_reclaimer::collect() {
+    uint64_t oldest = UINT64_MAX;
+    for (auto& slot : readers) {
+        uint64_t epoch = slot.load();
+        if (epoch != 0) {
+            oldest = std::min(oldest, epoch);
+        }
+    }
+    auto alive = std::partition(retired.begin(), retired.end(), [oldest](retired_item const& item) {
+        return item.epoch >= oldest;
+    });
+    for (auto it = alive; it != retired.end(); ++it) {
+        it->deleter(it->p);
+    }
+    retired.erase(alive, retired.end());
+}
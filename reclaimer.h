@@ -0,0 +1,54 @@
+#ifndef RECLAIMER_H
+#define RECLAIMER_H
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+// Epoch-based reclamation. Readers pin the current epoch for the duration of
+// a query; writers retire memory they unlinked and it is freed once every
+// reader that could still see it has unpinned. Pinning and unpinning are a
+// single atomic operation on a per-reader slot, readers never take a lock.
+class epoch_reclaimer {
+public:
+    class guard {
+    public:
+        guard(guard&& other) noexcept;
+        ~guard();
+        guard(const guard&) = delete;
+        guard& operator=(const guard&) = delete;
+
+    private:
+        friend class epoch_reclaimer;
+        explicit guard(std::atomic<uint64_t>* slot);
+        std::atomic<uint64_t>* slot;
+    };
+
+    epoch_reclaimer() = default;
+    ~epoch_reclaimer();
+    epoch_reclaimer(const epoch_reclaimer&) = delete;
+    epoch_reclaimer& operator=(const epoch_reclaimer&) = delete;
+
+    guard pin();
+    // Frees p with deleter once no reader pinned before this call is left.
+    void retire(void* p, void (*deleter)(void*));
+
+private:
+    static const int MAX_READERS = 128;
+
+    struct retired_item {
+        uint64_t epoch;
+        void* p;
+        void (*deleter)(void*);
+    };
+
+    std::atomic<uint64_t> global_epoch{1};
+    std::atomic<uint64_t> readers[MAX_READERS] = {};
+    std::mutex retired_mutex;
+    std::vector<retired_item> retired;
+
+    void collect();
+};
+
+#endif // RECLAIMER_H
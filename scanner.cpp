@@ -1,254 +1,1540 @@
 #include "scanner.h"
-#include <QtCore/QDirIterator>
-#include <QtCore/QCryptographicHash>
+#include "dir_walker.h"
+#include "content_hash.h"
 #include <QtConcurrent/QtConcurrent>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QFileInfo>
 #include <set>
 #include <memory>
 #include <iostream>
 #include <chrono>
 #include <thread>
+#include <cstring>
+#include <limits>
+#include <sys/stat.h>
 
-void scanner::update_progress(size_t i, size_t overall_size) {
-    int progress = int((i / (double) overall_size) * 100);
-    if (progress > current_progress) {
-        current_progress = progress;
-        emit progress_updated(progress);
+namespace {
+    // Feeds text of any encoding to the counter, and to the token collector unless it is null, in its
+    // UTF-8 form; null transcoder for UTF-8.
+    bool feed_utf8(trigram_counter& counter, token_collector* tokens, utf8_transcoder* transcoder,
+                   const char* data, size_t size) {
+        if (transcoder) {
+            static thread_local vector<char> converted;
+            converted.clear();
+            transcoder->convert(data, size, converted, nullptr);
+            data = converted.data();
+            size = converted.size();
+        }
+        if (tokens) {
+            tokens->feed(data, size);
+        }
+        return counter.feed(data, size);
+    }
+
+    // Positions of the matches of the stream matchers, and how they are kept.
+    int64_t& position_of(int64_t& position) {
+        return position;
+    }
+    int64_t& position_of(approximate_matcher::match& match) {
+        return match.position;
+    }
+    // positions are reported 1-based
+    void append_match(occurrence_list::builder& positions, int64_t position) {
+        positions.append(position + 1);
+    }
+    void append_match(occurrence_list::builder& positions, approximate_matcher::match const& match) {
+        positions.append(match.position + 1, match.distance);
+    }
+
+    // Whether path is root or lies under it.
+    bool is_under(QString const& path, QString const& root) {
+        if (!path.startsWith(root)) {
+            return false;
+        }
+        return path.size() == root.size() || root.endsWith("/") || path[root.size()] == '/';
     }
-}
 
-void scanner::init() {
-    trigrams.clear();
-    overall_files_count = 0;
-    overall_text_files_count = 0;
-    current_progress = 0;
-    cancel_state = false;
-    max_socket_limit_reached = false;
-    for (auto& x : text_file_names) {
-        watcher.removePath(x);
+    // Calls f(file, root, position) for the files of several snapshots from position on, as if
+    // their slots were one after another, until it returns false.
+    template<typename F>
+    void for_each_from(vector<std::shared_ptr<const index_snapshot>> const& snapshots, size_t position, F f) {
+        size_t base = 0;
+        for (size_t r = 0; r < snapshots.size(); r++) {
+            size_t length = snapshots[r]->slot_count();
+            if (position < base + length) {
+                bool stopped = false;
+                snapshots[r]->for_each_from(position - base, [&](indexed_file const& file, size_t local) {
+                    stopped = !f(file, r, base + local);
+                    return !stopped;
+                });
+                if (stopped) {
+                    return;
+                }
+                position = base + length;
+            }
+            base += length;
+        }
     }
+}
+
+scanner::scanner() {
+    updates.setMaxThreadCount(1);
     connect(&watcher, SIGNAL(fileChanged(const QString&)), this, SLOT(text_file_changed(const QString&)));
 }
 
-void scanner::text_file_changed(const QString &filename) {
-    QByteArray ba = filename.toUtf8();
-    QFile f(filename);
-    text_file_names.remove(filename);
-    trigrams[ba].clear();
-    if (f.exists()) {
-        to_trigrams(ba);
+void scanner::report_progress(progress_meter &progress, quint64 epoch) {
+    progress_info info;
+    if (progress.poll(info)) {
+        emit progress_updated(epoch, info);
     }
-    else {
+}
+
+void scanner::init(indexed_root& root) {
+    // every entry of a previous index of the root lives in its arena pool, which is
+    // released at once when the last snapshot of it is dropped
+    root.index.reset(root.path, huge_pages, bloom_rate, word_tokenizer);
+    unwatch(root.path);
+}
+
+std::shared_ptr<scanner::indexed_root> scanner::root_of(const QString &absolute_path) const {
+    std::lock_guard<std::mutex> lock(roots_mutex);
+    for (auto& root : indexed_roots) {
+        if (is_under(absolute_path, root->path)) {
+            return root;
+        }
+    }
+    return nullptr;
+}
+
+void scanner::watch(const QStringList &absolute_paths) {
+    QMetaObject::invokeMethod(this, [this, absolute_paths] {
+        if (max_socket_limit_reached || absolute_paths.isEmpty()) {
+            return;
+        }
+        QStringList failed = watcher.addPaths(absolute_paths);
+        if (!failed.isEmpty()) {
+            emit exception_occurred(QString("Cannot watch %1 files, starting with %2")
+                                            .arg(failed.size()).arg(failed.first()));
+            max_socket_limit_reached = true;
+        }
+    }, Qt::QueuedConnection);
+}
+
+void scanner::unwatch(const QString &root_path) {
+    // the watcher belongs to the GUI thread, so it is only touched there
+    QMetaObject::invokeMethod(this, [this, root_path] {
+        QStringList watched;
+        for (QString const& path : watcher.files()) {
+            if (is_under(path, root_path)) {
+                watched.append(path);
+            }
+        }
+        if (!watched.isEmpty()) {
+            watcher.removePaths(watched);
+            max_socket_limit_reached = false;
+        }
+    }, Qt::QueuedConnection);
+}
+
+void scanner::text_file_changed(const QString &filename) {
+    bool exists = QFile::exists(filename);
+    if (!exists) {
         max_socket_limit_reached = false;
         watcher.removePath(filename);
     }
+    // re-indexed off the GUI thread; one worker keeps the updates of a file in order
+    QtConcurrent::run(&updates, [this, filename, exists] {
+        update_file(filename, exists);
+    });
 }
 
-void scanner::cancel() {
-    cancel_state = true;
+void scanner::update_file(const QString &filename, bool exists) {
+    // the root may have been removed since the change was seen
+    auto root = root_of(filename);
+    if (!root) {
+        return;
+    }
+    if (archive_reader::is_archive(QFile::encodeName(filename).toStdString())) {
+        update_archive(*root, filename, exists);
+        return;
+    }
+    trigram_index& text_index = root->index;
+    auto pool = text_index.pool();
+    const file_entry* entry = nullptr;
+    if (exists) {
+        vector<string> paths{QFile::encodeName(filename).toStdString()};
+        batch_reader::local(io_queue_depth).read(paths, [&](size_t, batch_reader::file& file) {
+            try {
+                qint64 size;
+                text_encoding encoding;
+                uint64_t hash;
+                trigram_counter* counter = to_trigrams(filename, file, size, encoding, hash, nullptr, cancel_token());
+                if (counter) {
+                    entry = text_index.make_heap_entry(*counter, size, encoding);
+                }
+            }
+            catch (const std::runtime_error &e) {
+                emit exception_occurred((QString) e.what() + " " + filename);
+            }
+        });
+    }
+    text_index.set(filename, entry, *pool);
+    text_index.publish();
 }
 
-void scanner::to_trigrams(const QByteArray &absolute_path) {
-    QFile f(absolute_path);
-    if (f.open(QFile::ReadOnly)) {
-        QByteArray chunk(CHUNK_LEN, ' ');
-        QHash<QByteArray, size_t> &current_text_trigrams = trigrams[absolute_path];
-        QByteArray trigram_buffer(R"(\\\)");
-        while (true) {
-            if (cancel_state) return;
-            qint64 actual_size = f.read(chunk.data(), CHUNK_LEN);
-            if (actual_size == 0 || current_text_trigrams.size() > TEXT_FILE_THRESHOLD) break;
-            for (char c: chunk) {
-                trigram_buffer[0] = trigram_buffer[1];
-                trigram_buffer[1] = trigram_buffer[2];
-                trigram_buffer[2] = c;
-                current_text_trigrams[trigram_buffer]++;
-            }
+void scanner::update_archive(indexed_root& root, const QString &absolute_path, bool exists) {
+    trigram_index& text_index = root.index;
+    auto pool = text_index.pool();
+    string native_path = QFile::encodeName(absolute_path).toStdString();
+    archive_members old_members = archives.previous(native_path);
+    archive_members new_members;
+    if (exists) {
+        try {
+            new_members = read_archive(absolute_path, cancel_token());
         }
-        if (current_text_trigrams.size() > TEXT_FILE_THRESHOLD) {
-            trigrams[absolute_path].clear();
+        catch (const std::runtime_error &e) {
+            emit exception_occurred((QString) e.what() + " " + absolute_path);
         }
-        else {
-            text_file_names.insert(absolute_path);
-            if (!max_socket_limit_reached && !watcher.addPath(absolute_path)) {
-                emit exception_occurred("Cannot watch the file " + dir.relativeFilePath(absolute_path));
-                max_socket_limit_reached = true;
+    }
+    if (!new_members) {
+        archives.forget(native_path);
+    }
+    QSet<QString> present;
+    if (new_members) {
+        for (auto& member : *new_members) {
+            QString path = QFile::decodeName(archive_reader::virtual_path(native_path, member.name).c_str());
+            present.insert(path);
+            text_index.set(path, text_index.make_heap_entry(member.trigrams(), (qint64) member.size,
+                                                                          member.encoding), *pool);
+        }
+    }
+    if (old_members) {
+        for (auto& member : *old_members) {
+            QString path = QFile::decodeName(archive_reader::virtual_path(native_path, member.name).c_str());
+            if (!present.contains(path)) {
+                text_index.set(path, nullptr, *pool);
             }
         }
-    } else {
+    }
+    text_index.publish();
+}
+
+archive_members scanner::read_archive(const QString &absolute_path, const cancel_token &token) {
+    auto session = std::atomic_load(&scan_trace);
+    trace_span span(session.get(), "read_archive", "file", session ? absolute_path.toUtf8() : QByteArray());
+    string native_path = QFile::encodeName(absolute_path).toStdString();
+    struct stat st;
+    if (stat(native_path.c_str(), &st) != 0) {
         throw std::runtime_error("Cannot open the file");
     }
+    int64_t mtime_ns = int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+    archive_members cached = archives.find(native_path, st.st_size, mtime_ns);
+    if (cached) {
+        return cached;
+    }
+    archive_reader archive(native_path);
+    if (!archive.open(&archives)) {
+        throw std::runtime_error(archive.error());
+    }
+    auto members = std::make_shared<vector<archive_member>>();
+    trigram_counter &counter = trigram_counter::local(TEXT_FILE_THRESHOLD);
+    for (size_t i = 0; i < archive.members(); i++) {
+        counter.reset();
+        uint64_t size = 0;
+        text_encoding encoding = text_encoding::utf8;
+        std::unique_ptr<utf8_transcoder> to_utf8;
+        content_hasher hasher;
+        // decompressed straight into the counter, binaries are abandoned as soon as they are recognized
+        bool ok = archive.stream(i, [&](const char* data, size_t length) {
+            if (token.cancelled()) return false;
+            if (size == 0) {
+                encoding = detect_encoding(data, length);
+                if (encoding != text_encoding::utf8) {
+                    to_utf8.reset(new utf8_transcoder(encoding));
+                }
+            }
+            size += length;
+            counters.bytes_read += length;
+            hasher.update(data, length);
+            return feed_utf8(counter, nullptr, to_utf8.get(), data, length);
+        });
+        if (token.cancelled()) {
+            return nullptr;
+        }
+        if (!ok) {
+            throw std::runtime_error(archive.error());
+        }
+        if (counter.overflowed()) {
+            counters.binaries_rejected++;
+            continue;
+        }
+        archive_member member;
+        member.name = archive.name(i);
+        member.size = size;
+        member.encoding = encoding;
+        member.content_hash = hasher.digest();
+        member.keys.resize(counter.size());
+        member.counts.resize(counter.size());
+        counter.finish(member.keys.data(), member.counts.data());
+        counters.trigrams_extracted += counter.size();
+        members->push_back(std::move(member));
+    }
+    archives.store(native_path, st.st_size, mtime_ns, members);
+    return members;
+}
+
+void scanner::cancel() {
+    {
+        std::lock_guard<std::mutex> lock(tokens_mutex);
+        scan_token.cancel();
+        search_token.cancel();
+    }
+    // roots added alongside the others are scanned by runs of their own
+    std::lock_guard<std::mutex> lock(roots_mutex);
+    for (auto& root : indexed_roots) {
+        root->run.cancel();
+    }
 }
 
-void scanner::index() {
-    QDirIterator it(dir.path(), QDir::Files, QDirIterator::Subdirectories);
-    size_t i = 0;
-    while (it.hasNext()) {
-        if (cancel_state) return;
-        it.next();
-        QString rel_path = dir.relativeFilePath(it.fileInfo().path()) + "/";
-        if (rel_path == "./") {
-            rel_path = "";
+cancel_token scanner::new_scan_token() {
+    std::lock_guard<std::mutex> lock(tokens_mutex);
+    scan_token.cancel();
+    search_token.cancel();
+    scan_token = cancel_token(++last_epoch);
+    return scan_token;
+}
+
+cancel_token scanner::new_search_token() {
+    std::lock_guard<std::mutex> lock(tokens_mutex);
+    search_token.cancel();
+    search_token = cancel_token(++last_epoch);
+    return search_token;
+}
+
+cancel_token scanner::new_query_token() {
+    return cancel_token(++last_epoch);
+}
+
+void scanner::set_huge_pages(bool enabled) {
+    huge_pages = enabled;
+}
+
+void scanner::set_bloom_filter(double false_positive_rate) {
+    bloom_rate = false_positive_rate;
+}
+
+double scanner::bloom_filter() const {
+    return bloom_rate;
+}
+
+void scanner::set_engine(index_engine e) {
+    engine = e;
+}
+
+index_engine scanner::current_engine() const {
+    return engine;
+}
+
+void scanner::set_tokenizer(tokenizer kind) {
+    word_tokenizer = kind;
+}
+
+tokenizer scanner::current_tokenizer() const {
+    return word_tokenizer;
+}
+
+void scanner::set_io_queue_depth(unsigned depth) {
+    io_queue_depth = depth;
+}
+
+void scanner::set_exclusions(path_filter::options const& rules) {
+    std::lock_guard<std::mutex> lock(exclusions_mutex);
+    exclusions = rules;
+}
+
+path_filter::options scanner::exclusion_rules() const {
+    std::lock_guard<std::mutex> lock(exclusions_mutex);
+    return exclusions;
+}
+
+scanner_stats scanner::stats() const {
+    scanner_stats s = counters.snapshot();
+    std::lock_guard<std::mutex> lock(roots_mutex);
+    for (auto& root : indexed_roots) {
+        root_stats r = root->stats;
+        auto snapshot = root->index.snapshot();
+        r.text_files = snapshot->size();
+        r.coverage = snapshot->coverage();
+        r.complete = snapshot->complete();
+        if (root->fm) {
+            r.fm_index_files = root->fm->entries.size();
+            r.fm_index_bytes = root->fm->text.bytes();
         }
-        rel_path += it.fileName();
-        try {
-            to_trigrams(it.fileInfo().absoluteFilePath().toUtf8());
+        r.tokens = snapshot->tokens().size();
+        trigram_frequencies const& frequencies = snapshot->frequencies();
+        for (trigram t : *frequencies.stop_trigrams()) {
+            char bytes[3] = {char(t >> 16), char(t >> 8), char(t)};
+            r.stop_trigrams.emplace_back(QString::fromUtf8(bytes, 3), frequencies.frequency(t));
         }
-        catch (const std::runtime_error &e) {
-            QString message = (QString) e.what() + " " + it.fileName();
-            emit exception_occurred(message);
+        std::sort(r.stop_trigrams.begin(), r.stop_trigrams.end(),
+                  [](pair<QString, quint64> const& a, pair<QString, quint64> const& b) {
+                      return a.second > b.second;
+                  });
+        s.roots.push_back(r);
+    }
+    return s;
+}
+
+void scanner::set_trace_directory(const QString &path) {
+    trace_directory = path;
+}
+
+std::shared_ptr<trace_session> scanner::current_trace() const {
+    return std::atomic_load(&trace);
+}
+
+std::shared_ptr<trace_session> scanner::start_trace(const QString &name) {
+    std::shared_ptr<trace_session> session;
+    if (!trace_directory.isEmpty()) {
+        session = std::make_shared<trace_session>(name);
+    }
+    std::atomic_store(&trace, session);
+    return session;
+}
+
+void scanner::finish_trace(std::shared_ptr<trace_session> const& session) {
+    if (!session) {
+        return;
+    }
+    QString path = QDir(trace_directory).filePath(
+            QString("%1-%2.json").arg(session->name()).arg(QDateTime::currentMSecsSinceEpoch()));
+    // queued to the GUI thread, so the results it still has to show are in the trace as well
+    QMetaObject::invokeMethod(this, [this, session, path] {
+        if (session->write(path)) {
+            emit info_message("Trace is written to " + path);
+        } else {
+            emit exception_occurred("Cannot write the trace " + path);
         }
-        update_progress(i++, overall_files_count);
+    }, Qt::QueuedConnection);
+}
+
+trigram_counter* scanner::to_trigrams(const QString &absolute_path, batch_reader::file &file, qint64 &size,
+                                      text_encoding &encoding, uint64_t &hash, token_collector* tokens,
+                                      const cancel_token &token) {
+    auto session = std::atomic_load(&scan_trace);
+    trace_span span(session.get(), "to_trigrams", "file", session ? absolute_path.toUtf8() : QByteArray());
+    if (file.error) {
+        throw std::runtime_error("Cannot open the file");
+    }
+    static thread_local vector<char> chunk;
+    chunk.resize(CHUNK_LEN);
+    trigram_counter &counter = trigram_counter::local(TEXT_FILE_THRESHOLD);
+    counter.reset();
+    size = 0;
+    encoding = detect_encoding(file.head, file.head_size);
+    utf8_transcoder transcoder(encoding);
+    utf8_transcoder* to_utf8 = encoding == text_encoding::utf8 ? nullptr : &transcoder;
+    content_hasher hasher;
+    // the head is already in memory, only the rest of bigger files is read here
+    const char* data = file.head;
+    long actual_size = (long) file.head_size;
+    while (true) {
+        if (token.cancelled()) return nullptr;
+        if (actual_size <= 0) break;
+        size += actual_size;
+        counters.bytes_read += actual_size;
+        hasher.update(data, (size_t) actual_size);
+        if (!feed_utf8(counter, tokens, to_utf8, data, (size_t) actual_size)) break;
+        data = chunk.data();
+        actual_size = file.read(chunk.data(), CHUNK_LEN);
     }
+    if (counter.overflowed()) {
+        counters.binaries_rejected++;
+        return nullptr;
+    }
+    counters.trigrams_extracted += counter.size();
+    hash = hasher.digest();
+    return &counter;
 }
 
-void scanner::scan(QDir const &dir) {
-    this->dir = dir;
-    emit info_message("Indexing is started...");
-    init();
-    overall_files_count = dir.count();
+void scanner::build_fm_index(indexed_root &root, std::shared_ptr<const index_snapshot> const &snapshot,
+                             const cancel_token &token) {
+    auto fm = std::make_shared<root_fm_index>();
+    fm->snapshot = snapshot;
+    fm_index::builder text;
+    bool fits = true;
+    snapshot->for_each([&](indexed_file const& file) {
+        const file_entry* entry = file.entry;
+        // copies share the document of their first entry; transcoded files and members of
+        // archives are still read by searches
+        if (entry->same_as || entry->encoding != text_encoding::utf8 || file.path.contains(archive_reader::SEPARATOR)) {
+            return !token.cancelled();
+        }
+        if (text.size() + (quint64) entry->size + 1 > fm_index::MAX_TEXT) {
+            fits = false;
+            return false;
+        }
+        QFile f(file.path);
+        if (!f.open(QFile::ReadOnly)) {
+            return !token.cancelled();
+        }
+        QByteArray content = f.readAll();
+        counters.bytes_read += content.size();
+        // a file changed since it was indexed is left to its update
+        if (content.size() == entry->size) {
+            text.add(content.constData(), (size_t) content.size());
+            fm->entries.push_back(entry);
+            fm->covered.insert(entry);
+        }
+        return !token.cancelled();
+    });
+    if (token.cancelled()) {
+        return;
+    }
+    if (!fits) {
+        emit info_message(QString("The FM-index of %1 covers only %2 files, the text of the others does not fit")
+                                  .arg(root.path).arg(fm->entries.size()));
+    }
+    fm->text = text.build();
+    std::lock_guard<std::mutex> lock(roots_mutex);
+    root.fm = fm;
+}
+
+bool scanner::fm_search(const root_fm_index &fm, const QByteArray &needle, const query_options &query,
+                        const cancel_token &token, QHash<const file_entry*, occurrence_list> &results) {
+    if (fm.text.count(needle.constData(), (size_t) needle.size()) > MAX_FM_LOCATE) {
+        return false;
+    }
+    vector<fm_index::hit> hits;
+    fm.text.locate(needle.constData(), (size_t) needle.size(), hits, [&token] {
+        return token.cancelled();
+    });
+    std::sort(hits.begin(), hits.end());
+    size_t limit = query.position_limit();
+    for (size_t i = 0; i < hits.size() && !token.cancelled();) {
+        uint32_t document = hits[i].document;
+        // positions are reported 1-based, as when the file is read
+        occurrence_list::builder positions;
+        size_t kept = 0;
+        for (; i < hits.size() && hits[i].document == document; i++) {
+            if (kept == limit) {
+                continue;
+            }
+            kept++;
+            if (query.keeps_positions()) {
+                positions.append((int64_t) hits[i].offset + 1);
+            } else {
+                positions.skip(1);
+            }
+        }
+        results.insert(fm.entries[document], positions.finish());
+    }
+    return true;
+}
+
+void scanner::index(indexed_root& root, const cancel_token &token, progress_meter &progress) {
+    trigram_index& text_index = root.index;
+    QDir const& dir = root.dir;
+    auto pool = text_index.pool();
+    tokenizer words = text_index.snapshot()->words();
+    QElapsedTimer since_publish;
+    since_publish.start();
+    std::mutex publish_mutex;
+    string root_path = QFile::encodeName(root.path).toStdString();
+    // ignored subtrees are pruned while they are listed, they are never read
+    path_filter filter(exclusion_rules(), root_path);
+    // files are not stat'ed on the way, the total is estimated from the files found so far
+    // and the bytes read per file; directories go first, so it settles early
+    dir_walker walker((size_t) QThread::idealThreadCount(), false, false, std::max(io_queue_depth, 1u));
+    std::atomic<quint64> files_done{0};
+    std::atomic<quint64> bytes_done{0};
+    auto account = [&](quint64 bytes) {
+        quint64 files = files_done.fetch_add(1) + 1;
+        quint64 all_bytes = bytes_done.fetch_add(bytes) + bytes;
+        progress.set_total(quint64(double(all_bytes) / files * walker.files_found()));
+        progress.add_done(bytes);
+        report_progress(progress, token.epoch());
+    };
+    walker.set_filter(&filter);
+    // archives gone since the last scan are dropped from the cache at the end
+    std::mutex found_mutex;
+    std::unordered_set<string> archives_found;
+    walker.walk(root_path, [&](vector<dir_walker::file> const& files) {
+        vector<string> paths;
+        paths.reserve(files.size());
+        for (auto& file : files) {
+            if (!archive_reader::is_archive(file.path)) {
+                paths.push_back(file.path);
+                continue;
+            }
+            // members are indexed as files of their own
+            counters.files_walked++;
+            {
+                std::lock_guard<std::mutex> lock(found_mutex);
+                archives_found.insert(file.path);
+            }
+            QString absolute_path = QFile::decodeName(file.path.c_str());
+            quint64 read = 0;
+            try {
+                archive_members members = read_archive(absolute_path, token);
+                if (members) {
+                    for (auto& member : *members) {
+                        read += member.size;
+                        QString path = QFile::decodeName(archive_reader::virtual_path(file.path, member.name).c_str());
+                        const file_entry* entry = text_index.make_entry(*pool, member.trigrams(), (qint64) member.size,
+                                                                        member.encoding, member.content_hash);
+                        if (entry->same_as) {
+                            counters.duplicate_files++;
+                        } else {
+                            counters.trigram_bytes += entry->trigrams.bytes();
+                        }
+                        text_index.set(path, entry, *pool);
+                    }
+                }
+            }
+            catch (const std::runtime_error &e) {
+                emit exception_occurred((QString) e.what() + " " + dir.relativeFilePath(absolute_path));
+            }
+            account(read);
+        }
+        batch_reader::local(io_queue_depth).read(paths, [&](size_t i, batch_reader::file& file) {
+            counters.files_walked++;
+            QString absolute_path = QFile::decodeName(paths[i].c_str());
+            qint64 size = 0;
+            try {
+                text_encoding encoding;
+                uint64_t hash;
+                token_collector* tokens = words == tokenizer::none ? nullptr : &token_collector::local(words);
+                trigram_counter* counter = to_trigrams(absolute_path, file, size, encoding, hash, tokens, token);
+                if (counter) {
+                    const file_entry* entry = text_index.make_entry(*pool, *counter, size, encoding, hash, tokens);
+                    if (entry->same_as) {
+                        counters.duplicate_files++;
+                    } else {
+                        counters.trigram_bytes += entry->trigrams.bytes();
+                    }
+                    text_index.set(absolute_path, entry, *pool);
+                }
+            }
+            catch (const std::runtime_error &e) {
+                emit exception_occurred((QString) e.what() + " " + dir.relativeFilePath(absolute_path));
+            }
+            account((quint64) std::max<qint64>(size, 0));
+        });
+        // whoever finished a batch while nobody else publishes does it
+        std::unique_lock<std::mutex> lock(publish_mutex, std::try_to_lock);
+        if (lock.owns_lock() && since_publish.elapsed() >= PUBLISH_INTERVAL_MS) {
+            int coverage = progress.percent();
+            text_index.publish(coverage, false);
+            emit index_published(token.epoch(), root.path, coverage, text_index.snapshot()->size());
+            since_publish.restart();
+        }
+    }, [this](string const& native_path) {
+        emit exception_occurred("Cannot read the directory " + QFile::decodeName(native_path.c_str()));
+    }, [&token] {
+        return token.cancelled();
+    });
+    counters.paths_excluded = walker.paths_excluded();
+    if (!token.cancelled()) {
+        archives.forget_under(root_path, archives_found);
+    }
+}
+
+void scanner::scan(QDir const &dir, cancel_token const &token) {
+    vector<std::shared_ptr<indexed_root>> dropped;
+    {
+        std::lock_guard<std::mutex> lock(roots_mutex);
+        dropped.swap(indexed_roots);
+    }
+    for (auto& root : dropped) {
+        // the runs that added them would go on with the roots after them
+        root->run.cancel();
+        root->token.cancel();
+        unwatch(root->path);
+        // a root scanned again keeps its archives for the new scan to reuse
+        if (root->path != dir.absolutePath()) {
+            archives.forget_under(QFile::encodeName(root->path).toStdString());
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(cursor_mutex);
+        cursors.clear();
+    }
+    add_root(dir, token);
+}
+
+void scanner::add_root(QDir const &dir, cancel_token const &token) {
+    std::lock_guard<std::mutex> scan_lock(scan_mutex);
+    // a run cancelled while it waited for the scan before adds nothing
+    if (token.cancelled()) {
+        return;
+    }
+    auto root = std::make_shared<indexed_root>();
+    root->dir = dir;
+    root->path = dir.absolutePath();
+    root->run = token;
+    root->token = token.child();
+    root->stats.path = root->path;
+    // emitted once the lock is released, so that receivers may look at the roots
+    QString overlapped;
+    {
+        std::lock_guard<std::mutex> lock(roots_mutex);
+        auto same = std::find_if(indexed_roots.begin(), indexed_roots.end(),
+                                 [&root](std::shared_ptr<indexed_root> const& other) {
+                                     return other->path == root->path;
+                                 });
+        for (auto& other : indexed_roots) {
+            if (other->path != root->path &&
+                (is_under(root->path, other->path) || is_under(other->path, root->path))) {
+                overlapped = other->path;
+                break;
+            }
+        }
+        // a root scanned again is searched over its new, partial index from now on
+        if (overlapped.isEmpty() && same != indexed_roots.end()) {
+            *same = root;
+        } else if (overlapped.isEmpty()) {
+            indexed_roots.push_back(root);
+        }
+    }
+    if (!overlapped.isEmpty()) {
+        emit exception_occurred(QString("%1 overlaps the indexed directory %2").arg(root->path).arg(overlapped));
+        emit indexing_finished(token.epoch());
+        return;
+    }
+    const cancel_token& root_token = root->token;
+    counters.reset_scan();
+    auto session = start_trace("scan");
+    std::atomic_store(&scan_trace, session);
+    emit info_message("Indexing of " + root->path + " is started...");
+    progress_meter progress;
+    {
+        trace_span span(session.get(), "init", "scan");
+        phase_timer init_timer("init");
+        init(*root);
+        counters.add_scan_phase(init_timer.stop());
+    }
     emit info_message("Collecting information about files...");
-    index();
-    if (cancel_state) {
+    {
+        trace_span span(session.get(), "index", "scan");
+        phase_timer index_timer("index");
+        progress.start();
+        index(*root, root_token, progress);
+        counters.add_scan_phase(index_timer.stop());
+    }
+    auto keep_stats = [this, &root] {
+        scanner_stats scanned = counters.snapshot();
+        std::lock_guard<std::mutex> lock(roots_mutex);
+        root->stats.files_walked = scanned.files_walked;
+        root->stats.paths_excluded = scanned.paths_excluded;
+        root->stats.bytes_read = scanned.bytes_read;
+        root->stats.binaries_rejected = scanned.binaries_rejected;
+        root->stats.duplicate_files = scanned.duplicate_files;
+    };
+    if (root_token.cancelled()) {
+        keep_stats();
         emit info_message("Indexing is canceled");
+        emit stats_updated(stats());
+        finish_trace(session);
         return;
     }
-    overall_text_files_count = (uint)text_file_names.size();
-    update_progress(overall_files_count, overall_files_count);
+    trigram_index& text_index = root->index;
+    text_index.publish(100, true);
+    auto snapshot = text_index.snapshot();
+    QSet<QString> text_file_names;
+    QStringList watched;
+    QSet<QString> watched_archives;
+    snapshot->for_each([&](indexed_file const& file) {
+        text_file_names.insert(file.path);
+        // members of an archive are updated through the archive
+        int separator = file.path.indexOf(archive_reader::SEPARATOR);
+        if (separator < 0) {
+            watched.append(file.path);
+        } else if (!watched_archives.contains(file.path.left(separator))) {
+            watched_archives.insert(file.path.left(separator));
+            watched.append(file.path.left(separator));
+        }
+        return true;
+    });
+    watch(watched);
+    if (engine == index_engine::fm_index) {
+        emit info_message("Building the FM-index of " + root->path + "...");
+        trace_span span(session.get(), "fm_index", "scan");
+        phase_timer fm_timer("fm_index");
+        build_fm_index(*root, snapshot, root_token);
+        counters.add_scan_phase(fm_timer.stop());
+    }
+    counters.text_files = snapshot->size();
+    keep_stats();
+    emit progress_updated(token.epoch(), progress.finish());
+    emit index_published(token.epoch(), root->path, 100, snapshot->size());
     emit info_message("Indexing is finished, printing text file names...");
     emit all_new_text_files(text_file_names);
-    emit info_message("Done! Total number of text files: " + QString::number(overall_text_files_count));
-    emit indexing_finished();
+    emit info_message("Done! Total number of text files: " + QString::number(snapshot->size()));
+    emit stats_updated(stats());
+    finish_trace(session);
+    emit indexing_finished(token.epoch());
 }
 
-QHash<QByteArray, size_t> scanner::split_into_trigrams(const QString &s) {
-    QHash<QByteArray, size_t> trigrams;
+bool scanner::remove_root(QString const &path) {
+    QString absolute_path = QDir(path).absolutePath();
+    std::shared_ptr<indexed_root> removed;
+    {
+        std::lock_guard<std::mutex> lock(roots_mutex);
+        for (auto it = indexed_roots.begin(); it != indexed_roots.end(); ++it) {
+            if ((*it)->path == absolute_path) {
+                removed = *it;
+                indexed_roots.erase(it);
+                break;
+            }
+        }
+    }
+    if (!removed) {
+        return false;
+    }
+    removed->token.cancel();
+    unwatch(removed->path);
+    archives.forget_under(QFile::encodeName(removed->path).toStdString());
+    emit stats_updated(stats());
+    return true;
+}
+
+QStringList scanner::roots() const {
+    QStringList paths;
+    std::lock_guard<std::mutex> lock(roots_mutex);
+    for (auto& root : indexed_roots) {
+        paths.append(root->path);
+    }
+    return paths;
+}
+
+scanner::Trigrams scanner::split_into_trigrams(const QString &s) {
+    Trigrams trigrams;
     auto sb = s.toUtf8();
-    QByteArray current_trigram = sb.left(3);
-    trigrams[current_trigram]++;
-    for (int i = 3; i < sb.size(); i++) {
-        current_trigram[0] = current_trigram[1];
-        current_trigram[1] = current_trigram[2];
-        current_trigram[2] = sb[i];
-        trigrams[current_trigram]++;
+    for (int i = 2; i < sb.size(); i++) {
+        trigrams[make_trigram(sb[i - 2], sb[i - 1], sb[i])]++;
     }
     return trigrams;
 }
 
-void scanner::KMP(const QByteArray &S, const QString &pattern, qint64 S_size, vector<int>& result, int start_index) {
-    vector<int> pf((unsigned int)pattern.size());
-
-    pf[0] = 0;
-    for (int k = 0, i = 1; i < pattern.length(); ++i) {
-        while ((k > 0) && (pattern[i] != pattern[k]))
-            k = pf[k - 1];
-        if (pattern[i] == pattern[k])
-            k++;
-        pf[i] = k;
+scanner::trigram_plan scanner::plan_trigrams(const Trigrams &tg, const QByteArray &needle,
+                                             const index_snapshot &snapshot) {
+    trigram_frequencies const& frequencies = snapshot.frequencies();
+    auto stop = frequencies.stop_trigrams();
+    trigram_plan plan;
+    vector<pair<uint32_t, pair<trigram, size_t>>> by_frequency;
+    for (auto i = tg.begin(); i != tg.end(); i++) {
+        if (!std::binary_search(stop->begin(), stop->end(), i.key())) {
+            by_frequency.emplace_back(frequencies.frequency(i.key()), std::make_pair(i.key(), i.value()));
+        } else {
+            plan.stop_trigrams += i.value();
+        }
     }
-    for (int k = 0, i = 0; i < S_size; ++i) {
-        while ((k > 0) && (k < pattern.length()) && (pattern[k] != S[i]))
-            k = pf[k - 1];
-        if (k == pattern.length()) {
-            result.push_back(start_index + i - 2 * (unsigned int) pattern.length() + 3);
-            k = pf[k - 1];
+    // a file lacking the rarest trigram is rejected after a single lookup
+    std::sort(by_frequency.begin(), by_frequency.end());
+    for (auto const& t : by_frequency) {
+        plan.trigrams.push_back(t.second);
+    }
+    if (needle.size() < 3) {
+        for (trigram t : *stop) {
+            char bytes[3] = {char(t >> 16), char(t >> 8), char(t)};
+            if (std::search(bytes, bytes + 3, needle.constData(), needle.constData() + needle.size()) != bytes + 3) {
+                plan.check_bytes = false;
+            }
         }
-        //qDebug() << k << " " << i << " " << S_size << " " << pattern.length() << " " << S.length() << " " << pattern.size() << " " << S.size();
-        if ((k < pattern.length()) && pattern[k] == S[i])
-            k++;
     }
+    return plan;
 }
 
-vector<int> scanner::find_substr(const scanner::Trigrams &tg, const QString &filename, const QString &needle) {
+occurrence_list scanner::find_substr(search_run &run, const trigram_plan &plan, const QString &filename,
+                                     const file_entry *entry, const matcher &needle,
+                                     const approximate_matcher *approximate, const word_finder *words,
+                                     const query_options &query, const cancel_token &token) {
     //qDebug() << filename;
-    vector<int> occurrences;
-    auto file_trigrams = trigrams[filename.toUtf8()];
+    occurrence_list occurrences;
+    if (token.cancelled()) {
+        return occurrences;
+    }
+    run.counters.files_checked++;
+    auto session = run.trace;
+    trace_span file_span(session.get(), "find_substr", "file", session ? filename.toUtf8() : QByteArray());
+    std::unique_ptr<trace_span> filter_span(new trace_span(session.get(), "filter", "file"));
+    file_trigrams const& file_tg = entry->trigrams;
 
-    if (needle.size() < 3) {
-        bool found = false;
-        for (auto i = file_trigrams.begin(); i != file_trigrams.end(); i++) {
-            if (i.key().contains(needle.toStdString().data())) {
-                found = true;
-                break;
+    if (approximate) {
+        // q-gram lemma: k edits destroy at most 3k of the m - 2 trigrams of the needle,
+        // a file must share the rest of them but the stop trigrams
+        auto needed = int64_t(approximate->length()) - 2 - 3 * int64_t(approximate->max_errors()) -
+                      int64_t(plan.stop_trigrams);
+        if (needed > 0) {
+            int64_t shared_trigrams = 0;
+            for (auto const& t : plan.trigrams) {
+                shared_trigrams += std::min<int64_t>(int64_t(t.second), file_tg.count(t.first));
+            }
+            if (shared_trigrams < needed) {
+                return occurrences;
             }
         }
-        if (!found) {
+    }
+    else if (needle.length() < 3) {
+        if (plan.check_bytes && !file_tg.contains_bytes(needle.bytes().data(), needle.length())) {
             return occurrences;
         }
     }
     else {
-        for (auto i = tg.begin(); i != tg.end(); i++) {
-            //qDebug() << trigram.first << " " << trigram.second;
-            //qDebug() << file_trigrams[trigram.first];
-            if (i.value() > file_trigrams[i.key()]) {
+        for (auto const& t : plan.trigrams) {
+            if (t.second > file_tg.count(t.first)) {
                 return occurrences;
             }
         }
     }
 
-    QFile f(filename);
-    if (f.open(QFile::ReadOnly)) {
-        QByteArray buffer(CHUNK_LEN + needle.size() + 1, '\\');
-        int start_index = 0;
-        while (true) {
-            if (cancel_state) return occurrences;
-            for (int i = 0; i < needle.size() - 1; i++) {
-                buffer[i] = buffer[buffer.size() - needle.size() + i + 1];
-            }
-            qint64 actual_size = f.read(buffer.data() + needle.size() - 1, CHUNK_LEN);
-            if (actual_size == 0) break;
-            //qDebug() << "byte arr: " << buffer.size() << " " << actual_size + needle.size() - 1 << " " << QString(buffer).size();
-            //qDebug() << buffer;
-            //qDebug() << QString(buffer);
-            KMP(buffer, needle, actual_size + needle.size() - 1, occurrences, start_index);
-            start_index += actual_size;
+    filter_span.reset();
+    run.counters.candidates++;
+    trace_span verify_span(session.get(), "verify", "file");
+    if (approximate) {
+        // a match is at most length + max_errors bytes long and reported a byte after its end
+        approximate_matcher::stream text(*approximate);
+        return verify_sequentially<approximate_matcher::match>(
+                run, filename, entry, text, approximate->length() + approximate->max_errors() + 1, query, token);
+    }
+    if (words) {
+        // a match is reported once the byte after it is known
+        word_finder::stream text(*words);
+        return verify_sequentially<int64_t>(run, filename, entry, text, words->length() + 1, query, token);
+    }
+    // the last length - 1 bytes of a chunk are kept for matches crossing into the next one
+    size_t overlap = needle.length() - 1;
+    static thread_local vector<char> buffer;
+    buffer.resize(overlap + CHUNK_LEN);
+    static thread_local vector<int64_t> found;
+    found.clear();
+    uint64_t counted = 0;
+    size_t limit = query.position_limit();
+    // counts the matches appended since first and drops them if the query has no positions,
+    // false once the file has been verified far enough
+    auto collect = [&](size_t first) {
+        counted += found.size() - first;
+        if (!query.keeps_positions()) {
+            found.resize(first);
         }
+        return found.size() < limit;
+    };
+    size_t carried = 0;
+    qint64 offset = 0;
+    // looks at the chunk just put behind the carried bytes
+    auto consume = [&](size_t actual_size) {
+        run.counters.bytes_verified += actual_size;
+        size_t filled = carried + actual_size;
+        size_t first = found.size();
+        needle.find_all(buffer.data(), filled, offset - (qint64) carried, found, limit - first);
+        size_t keep = std::min(overlap, filled);
+        std::memmove(buffer.data(), buffer.data() + filled - keep, keep);
+        carried = keep;
+        offset += actual_size;
+        return collect(first);
+    };
+    // other encodings are searched in their UTF-8 form, converted right behind the
+    // carried bytes, and matches are mapped back to offsets in the file
+    utf8_transcoder transcoder(entry->encoding);
+    bool transcoded = entry->encoding != text_encoding::utf8;
+    static thread_local vector<int64_t> source_offsets;
+    static thread_local vector<int64_t> chunk_found;
+    auto consume_transcoded = [&](const char* data, size_t size) {
+        run.counters.bytes_verified += size;
+        buffer.resize(carried);
+        source_offsets.resize(carried);
+        transcoder.convert(data, size, buffer, &source_offsets);
+        size_t filled = buffer.size();
+        chunk_found.clear();
+        size_t first = found.size();
+        needle.find_all(buffer.data(), filled, 0, chunk_found, limit - first);
+        for (int64_t position : chunk_found) {
+            found.push_back(source_offsets[(size_t) position]);
+        }
+        size_t keep = std::min(overlap, filled);
+        std::memmove(buffer.data(), buffer.data() + filled - keep, keep);
+        std::memmove(source_offsets.data(), source_offsets.data() + filled - keep, keep * sizeof(int64_t));
+        carried = keep;
+        return collect(first);
+    };
+    static thread_local vector<char> raw;
+    string archive_path, member;
+    if (filename.contains(archive_reader::SEPARATOR) &&
+        archive_reader::split(QFile::encodeName(filename).toStdString(), archive_path, member)) {
+        // the directory of an archive is read once for all the members searched in it
+        archive_reader archive(archive_path);
+        bool ok = archive.open(&archives) && archive.stream(member, [&](const char* data, size_t size) {
+            if (transcoded) {
+                return !token.cancelled() && consume_transcoded(data, size);
+            }
+            while (size > 0) {
+                if (token.cancelled()) return false;
+                size_t n = std::min(size, (size_t) CHUNK_LEN);
+                std::memcpy(buffer.data() + carried, data, n);
+                if (!consume(n)) return false;
+                data += n;
+                size -= n;
+            }
+            return true;
+        });
+        if (!ok) {
+            emit search_error(token.epoch(), QString::fromStdString(archive.error()) + " " + filename);
+        }
+    } else if (!transcoded) {
+        qint64 size = QFileInfo(filename).size();
+        if (size >= PARALLEL_FILE_THRESHOLD) {
+            search_in_parallel(run, filename, size, needle, query, token, found, counted);
+        } else {
+            search_range(run, filename, 0, std::numeric_limits<qint64>::max(), needle, query, token, found, counted);
+        }
+    } else {
+        QFile f(filename);
+        if (f.open(QFile::ReadOnly)) {
+            raw.resize(CHUNK_LEN);
+            while (true) {
+                if (token.cancelled()) return occurrences;
+                qint64 actual_size = f.read(raw.data(), CHUNK_LEN);
+                if (actual_size <= 0 || !consume_transcoded(raw.data(), (size_t) actual_size)) break;
+            }
+        }
+    }
+    if (token.cancelled()) {
+        return occurrences;
+    }
+    // positions are reported 1-based
+    occurrence_list::builder positions;
+    for (int64_t position : found) {
+        positions.append(position + 1);
+    }
+    positions.skip(counted - found.size());
+    occurrences = positions.finish();
+    run.counters.matches += occurrences.matches();
+    return occurrences;
+}
+
+template<typename Match, typename Stream>
+occurrence_list scanner::verify_sequentially(search_run &run, const QString &filename, const file_entry *entry,
+                                             Stream &text, size_t reach, const query_options &query,
+                                             const cancel_token &token) {
+    occurrence_list occurrences;
+    static thread_local vector<Match> found;
+    found.clear();
+    uint64_t counted = 0;
+    size_t limit = query.position_limit();
+    utf8_transcoder transcoder(entry->encoding);
+    bool transcoded = entry->encoding != text_encoding::utf8;
+    static thread_local vector<char> converted;
+    // file offsets of the converted bytes from the first a match may still start at
+    static thread_local vector<int64_t> source_offsets;
+    source_offsets.clear();
+    int64_t converted_size = 0;
+    int64_t first_offset = 0;
+    // maps the matches appended since first to the file and counts them,
+    // false once the file has been verified far enough
+    auto collect = [&](size_t first) {
+        if (transcoded) {
+            for (size_t i = first; i < found.size(); i++) {
+                position_of(found[i]) = source_offsets[size_t(position_of(found[i]) - first_offset)];
+            }
+        }
+        found.resize(std::min(found.size(), limit));
+        counted += found.size() - first;
+        if (!query.keeps_positions()) {
+            found.resize(first);
+        }
+        return found.size() < limit;
+    };
+    auto consume = [&](const char* data, size_t size) {
+        run.counters.bytes_verified += size;
+        size_t first = found.size();
+        if (!transcoded) {
+            text.feed(data, size, found);
+            return collect(first);
+        }
+        converted.clear();
+        transcoder.convert(data, size, converted, &source_offsets);
+        text.feed(converted.data(), converted.size(), found);
+        bool more = collect(first);
+        converted_size += int64_t(converted.size());
+        size_t keep = std::min(source_offsets.size(), reach);
+        source_offsets.erase(source_offsets.begin(), source_offsets.end() - (std::ptrdiff_t) keep);
+        first_offset = converted_size - int64_t(keep);
+        return more;
+    };
+    bool more = true;
+    string archive_path, member;
+    if (filename.contains(archive_reader::SEPARATOR) &&
+        archive_reader::split(QFile::encodeName(filename).toStdString(), archive_path, member)) {
+        archive_reader archive(archive_path);
+        bool ok = archive.open(&archives) && archive.stream(member, [&](const char* data, size_t size) {
+            more = !token.cancelled() && consume(data, size);
+            return more;
+        });
+        if (!ok) {
+            emit search_error(token.epoch(), QString::fromStdString(archive.error()) + " " + filename);
+        }
+    } else {
+        QFile f(filename);
+        if (f.open(QFile::ReadOnly)) {
+            static thread_local vector<char> raw;
+            raw.resize(CHUNK_LEN);
+            while (more) {
+                if (token.cancelled()) return occurrences;
+                qint64 actual_size = f.read(raw.data(), CHUNK_LEN);
+                if (actual_size <= 0) break;
+                more = consume(raw.data(), (size_t) actual_size);
+            }
+        }
+    }
+    if (token.cancelled()) {
+        return occurrences;
     }
+    if (more) {
+        size_t first = found.size();
+        text.finish(found);
+        collect(first);
+    }
+    // positions are reported 1-based
+    occurrence_list::builder positions;
+    for (auto const& match : found) {
+        append_match(positions, match);
+    }
+    positions.skip(counted - found.size());
+    occurrences = positions.finish();
+    run.counters.matches += occurrences.matches();
     return occurrences;
 }
 
-void scanner::search(QString const &needle) {
-    current_progress = 0;
+void scanner::search_range(search_run &run, const QString &filename, qint64 begin, qint64 end, const matcher &needle,
+                           const query_options &query, const cancel_token &token,
+                           vector<int64_t> &found, uint64_t &counted) {
+    QFile f(filename);
+    if (!f.open(QFile::ReadOnly) || (begin > 0 && !f.seek(begin))) {
+        return;
+    }
+    size_t overlap = needle.length() - 1;
+    static thread_local vector<char> buffer;
+    buffer.resize(overlap + CHUNK_LEN);
+    size_t carried = 0;
+    qint64 offset = begin;
+    qint64 read_end = end > std::numeric_limits<qint64>::max() - (qint64) overlap ? end : end + (qint64) overlap;
+    size_t limit = query.position_limit();
+    while (offset < read_end && found.size() < limit) {
+        if (token.cancelled()) return;
+        qint64 actual_size = f.read(buffer.data() + carried, std::min<qint64>(CHUNK_LEN, read_end - offset));
+        if (actual_size <= 0) break;
+        run.counters.bytes_verified += actual_size;
+        size_t filled = carried + (size_t) actual_size;
+        size_t first = found.size();
+        needle.find_all(buffer.data(), filled, offset - (qint64) carried, found, limit - first);
+        // a match that starts in the overlap is found by the next range as well and belongs to it
+        bool past_end = false;
+        while (found.size() > first && found.back() >= end) {
+            found.pop_back();
+            past_end = true;
+        }
+        counted += found.size() - first;
+        if (!query.keeps_positions()) {
+            found.resize(first);
+        }
+        if (past_end) break;
+        size_t keep = std::min(overlap, filled);
+        std::memmove(buffer.data(), buffer.data() + filled - keep, keep);
+        carried = keep;
+        offset += actual_size;
+    }
+}
+
+void scanner::search_in_parallel(search_run &run, const QString &filename, qint64 size, const matcher &needle,
+                                 const query_options &query, const cancel_token &token,
+                                 vector<int64_t> &found, uint64_t &counted) {
+    // a few ranges per thread even out uneven reads, but none smaller than the minimum
+    qint64 parts = (qint64) range_pool.maxThreadCount() * RANGES_PER_THREAD;
+    qint64 range_len = std::max(MIN_RANGE_LEN, (size + parts - 1) / parts);
+    vector<QFuture<std::pair<vector<int64_t>, uint64_t>>> ranges;
+    for (qint64 begin = 0; begin < size; begin += range_len) {
+        // the last range also takes what the file has grown by since it was measured
+        qint64 end = size - begin <= range_len ? std::numeric_limits<qint64>::max() : begin + range_len;
+        ranges.push_back(QtConcurrent::run(&range_pool, [this, &run, filename, begin, end, &needle, &query, &token] {
+            std::pair<vector<int64_t>, uint64_t> part;
+            part.second = 0;
+            search_range(run, filename, begin, end, needle, query, token, part.first, part.second);
+            return part;
+        }));
+    }
+    // ranges are in file order, so the merged positions are sorted
+    for (auto& range : ranges) {
+        auto part = range.result();
+        found.insert(found.end(), part.first.begin(), part.first.end());
+        counted += part.second;
+    }
+    // each range stopped at the limit on its own
+    size_t limit = query.position_limit();
+    if (found.size() > limit) {
+        counted -= found.size() - limit;
+        found.resize(limit);
+    }
+}
+
+void scanner::search(QString const &needle, query_options const &query, cancel_token const &token) {
+    // the matchers keep length - 1 bytes between chunks
+    if (needle.isEmpty()) {
+        emit search_error(token.epoch(), "Nothing to search for");
+        emit searching_finished(token.epoch());
+        return;
+    }
+    if (query.max_errors > 0) {
+        auto length = (size_t) needle.toUtf8().size();
+        QString problem;
+        if (length > approximate_matcher::MAX_NEEDLE) {
+            problem = QString("Approximate search takes up to %1 bytes").arg(approximate_matcher::MAX_NEEDLE);
+        } else if (query.max_errors >= length) {
+            problem = QString("%1 errors match anything of up to %2 bytes").arg(query.max_errors).arg(length);
+        }
+        if (query.words != word_match::anywhere) {
+            problem = "Approximate search matches anywhere, not by words";
+        }
+        if (!problem.isEmpty()) {
+            emit search_error(token.epoch(), problem);
+            emit searching_finished(token.epoch());
+            return;
+        }
+    }
+    search_cursor page;
+    page.needle = needle;
+    page.query = query;
+    QStringList unknown;
+    for (QString const& path : query.roots) {
+        unknown.append(QDir(path).absolutePath());
+    }
+    {
+        std::lock_guard<std::mutex> lock(roots_mutex);
+        for (auto& root : indexed_roots) {
+            if (query.roots.isEmpty() || unknown.contains(root->path)) {
+                unknown.removeAll(root->path);
+                page.roots.push_back(root);
+                page.snapshots.push_back(root->index.snapshot());
+                page.fm_indexes.push_back(root->fm);
+            }
+        }
+    }
+    if (!unknown.isEmpty()) {
+        emit info_message("Not indexed, so not searched: " + unknown.join(", "));
+    }
+    search_page(std::move(page), token);
+}
+
+QString scanner::result_name(const search_cursor &page, size_t root, const QString &absolute_path) {
+    if (page.roots.size() == 1) {
+        return page.roots[root]->dir.relativeFilePath(absolute_path);
+    }
+    return absolute_path;
+}
+
+void scanner::search_next(quint64 epoch, cancel_token const &token) {
+    std::unique_ptr<search_cursor> page;
+    {
+        std::lock_guard<std::mutex> lock(cursor_mutex);
+        auto it = cursors.find(epoch);
+        if (it != cursors.end()) {
+            page = std::move(it->second);
+            cursors.erase(it);
+        }
+    }
+    if (!page) {
+        emit info_message("There are no more results");
+        emit searching_finished(token.epoch());
+        return;
+    }
+    search_page(std::move(*page), token);
+}
+
+void scanner::search_page(search_cursor page, cancel_token const &token) {
+    search_run run;
+    run.trace = start_trace("search");
+    auto session = run.trace;
     emit info_message("Searching has been started...");
 
+    phase_timer plan_timer("plan");
+    std::unique_ptr<trace_span> phase_span(new trace_span(session.get(), "plan", "search"));
+    // entries replaced by file updates stay alive until the search unpins
+    vector<epoch_reclaimer::guard> pins;
+    pins.reserve(page.roots.size());
+    for (auto& root : page.roots) {
+        pins.push_back(root->index.pin());
+    }
+    auto const& snapshots = page.snapshots;
+    for (auto& snapshot : snapshots) {
+        if (!snapshot->complete() && page.end == 0) {
+            emit info_message(QString("Indexing is in progress, searching %1 files (%2% of %3)")
+                                      .arg(snapshot->size()).arg(snapshot->coverage()).arg(snapshot->root()));
+        }
+    }
+    // the files left pending by the previous page, then everything after it
+    size_t start = page.pending.empty() ? page.end : page.pending.front();
+    auto in_page = [&page](size_t position) {
+        return position >= page.end || std::binary_search(page.pending.begin(), page.pending.end(), position);
+    };
+    quint64 total_bytes = 0;
+    // contents that more than one file of the page holds, verified once
+    QSet<const file_entry*> shared;
+    for_each_from(snapshots, start, [&](indexed_file const& file, size_t, size_t position) {
+        if (in_page(position)) {
+            total_bytes += (quint64) file.entry->size;
+            if (file.entry->same_as) {
+                shared.insert(file.entry->same_as);
+            }
+        }
+        return true;
+    });
+    progress_meter progress;
+    progress.start(total_bytes);
+    const QString& needle = page.needle;
+    const query_options& query = page.query;
     auto needle_trigrams = split_into_trigrams(needle);
-    vector<QFuture<vector<int>>> my_pool;
+    QByteArray needle_bytes = needle.toUtf8();
+    // after the snapshots, so the stop trigrams cover every entry they hold
+    vector<trigram_plan> plans;
+    for (auto& snapshot : snapshots) {
+        plans.push_back(plan_trigrams(needle_trigrams, needle_bytes, *snapshot));
+    }
+    matcher needle_matcher(string(needle_bytes.constData(), (size_t) needle_bytes.size()));
+    std::unique_ptr<approximate_matcher> approximate;
+    if (query.max_errors > 0) {
+        approximate.reset(new approximate_matcher(string(needle_bytes.constData(), (size_t) needle_bytes.size()),
+                                                  query.max_errors));
+    }
+    // words end where the tokens of each root do, the postings give the files a single token may be in
+    vector<std::unique_ptr<word_finder>> word_finders(snapshots.size());
+    vector<bool> by_postings(snapshots.size(), false);
+    vector<QSet<const file_entry*>> token_files(snapshots.size());
+    if (query.words != word_match::anywhere && !needle_bytes.isEmpty()) {
+        string token(needle_bytes.constData(), (size_t) needle_bytes.size());
+        bool prefix = query.words == word_match::prefix;
+        for (size_t r = 0; r < snapshots.size(); r++) {
+            tokenizer words = snapshots[r]->words();
+            word_finders[r].reset(new word_finder(token, words, !prefix));
+            bool single_token = std::all_of(token.begin(), token.end(), [words](char c) {
+                return is_token_byte(words, (unsigned char) c);
+            });
+            if (words != tokenizer::none && single_token) {
+                by_postings[r] = true;
+                for (const file_entry* entry : snapshots[r]->tokens().find(token, prefix)) {
+                    token_files[r].insert(entry);
+                }
+            }
+        }
+    }
+    run.counters.add_search_phase(plan_timer.stop());
+    phase_timer locate_timer("locate");
+    phase_span.reset();
+    phase_span.reset(new trace_span(session.get(), "locate", "search"));
+    // the files an FM-index covers are answered from it without being read;
+    // the later pages take what the first one located
+    page.fm_results.resize(page.fm_indexes.size());
+    vector<const root_fm_index*> fm_roots(snapshots.size(), nullptr);
+    for (size_t r = 0; r < page.fm_indexes.size(); r++) {
+        auto const& fm = page.fm_indexes[r];
+        // the FM-index finds exact matches anywhere only
+        if (!fm || needle_bytes.isEmpty() || approximate || word_finders[r]) {
+            continue;
+        }
+        if (page.fm_results[r]) {
+            fm_roots[r] = fm.get();
+            continue;
+        }
+        auto located = std::make_shared<QHash<const file_entry*, occurrence_list>>();
+        if (fm_search(*fm, needle_bytes, query, token, *located)) {
+            page.fm_results[r] = located;
+            fm_roots[r] = fm.get();
+        } else if (page.end == 0) {
+            emit info_message("Too many matches to locate in the FM-index of " + page.roots[r]->path +
+                              ", its files are read instead");
+        }
+    }
+    run.counters.add_search_phase(locate_timer.stop());
+    phase_timer verify_timer("verify");
+    phase_span.reset();
+    phase_span.reset(new trace_span(session.get(), "verify", "search"));
+    // cancelled as well once the page is full, which stops the file tasks still running
+    cancel_token page_token = token.child();
+    quint64 reported = 0;
+    auto report = [&](QString const& filename, occurrence_list const& result) {
+        if (result.matches() == 0 || page_token.cancelled()) {
+            return;
+        }
+        emit update_results(token.epoch(), filename, result);
+        reported += result.matches();
+        if (query.max_results != 0 && reported >= query.max_results) {
+            page_token.cancel();
+        }
+    };
+    vector<QFuture<occurrence_list>> my_pool;
     vector<QString> thread_file_names;
+    vector<qint64> thread_file_sizes;
+    vector<size_t> thread_file_positions;
+    size_t next = start;
+    // results of shared contents, and the tasks verifying those not done yet
+    QHash<const file_entry*, occurrence_list> shared_results;
+    QHash<const file_entry*, size_t> shared_tasks;
+    struct file_copy {
+        QString name;
+        qint64 size;
+        size_t position;
+    };
+    // files that wait for the result of a task to be reported along with it
+    vector<vector<file_copy>> thread_file_copies;
+    auto report_copy = [&](file_copy const& copy, occurrence_list const& result) {
+        run.counters.duplicates_skipped++;
+        run.counters.matches += result.matches();
+        report(copy.name, result);
+        progress.add_done((quint64) copy.size);
+    };
 
-    size_t counter = 0;
-    for (auto& i : text_file_names) {
-        if (cancel_state)
-            break;
-        QFileInfo qFileInfo(i);
-        if (qFileInfo.size() > BIG_FILE_THRESHOLD) {
-            thread_file_names.push_back(dir.relativeFilePath(i));
-             my_pool.push_back(QtConcurrent::run(this, &scanner::find_substr, needle_trigrams,
-                    i, needle));
+    for_each_from(snapshots, start, [&](indexed_file const& file, size_t root, size_t position) {
+        if (page_token.cancelled())
+            return false;
+        if (!in_page(position)) {
+            next = position + 1;
+            return true;
+        }
+        const file_entry* content = file.entry->same_as ? file.entry->same_as : file.entry;
+        bool is_shared = shared.contains(content);
+        if (is_shared && shared_results.contains(content)) {
+            report_copy(file_copy{result_name(page, root, file.path), file.entry->size, position},
+                        shared_results.value(content));
+            report_progress(progress, token.epoch());
+            next = position + 1;
+            return true;
+        }
+        if (is_shared && shared_tasks.contains(content)) {
+            thread_file_copies[shared_tasks.value(content)].push_back(
+                    file_copy{result_name(page, root, file.path), file.entry->size, position});
+            next = position + 1;
+            return true;
+        }
+        if (by_postings[root] && content->tokenized && !token_files[root].contains(content)) {
+            run.counters.files_checked++;
+            progress.add_done((quint64) file.entry->size);
+            report_progress(progress, token.epoch());
+            next = position + 1;
+            return true;
+        }
+        if (fm_roots[root] && fm_roots[root]->covered.contains(content)) {
+            occurrence_list result = page.fm_results[root]->value(content);
+            run.counters.matches += result.matches();
+            if (is_shared) {
+                shared_results.insert(content, result);
+            }
+            report(result_name(page, root, file.path), result);
+            progress.add_done((quint64) file.entry->size);
+            report_progress(progress, token.epoch());
+            next = position + 1;
+            return true;
+        }
+        if (file.entry->size > BIG_FILE_THRESHOLD) {
+            if (is_shared) {
+                shared_tasks.insert(content, my_pool.size());
+            }
+            thread_file_names.push_back(result_name(page, root, file.path));
+            thread_file_sizes.push_back(file.entry->size);
+            thread_file_positions.push_back(position);
+            thread_file_copies.emplace_back();
+            QString path = file.path;
+            const file_entry* entry = file.entry;
+            // the run waits for every task below, so they can refer to the query state
+            const trigram_plan* plan = &plans[root];
+            const approximate_matcher* within = approximate.get();
+            const word_finder* words = word_finders[root].get();
+            my_pool.push_back(QtConcurrent::run([this, &run, plan, path, entry, &needle_matcher, within, words,
+                                                 &query, &page_token] {
+                return find_substr(run, *plan, path, entry, needle_matcher, within, words, query, page_token);
+            }));
         }
         else {
-            auto result = find_substr(needle_trigrams, i, needle);
-            if (!result.empty()) {
-                emit update_results(dir.relativeFilePath(i), result);
+            auto result = find_substr(run, plans[root], file.path, file.entry, needle_matcher, approximate.get(),
+                                      word_finders[root].get(), query, page_token);
+            if (is_shared) {
+                shared_results.insert(content, result);
             }
-            update_progress(++counter, overall_text_files_count);
+            report(result_name(page, root, file.path), result);
+            progress.add_done((quint64) file.entry->size);
+            report_progress(progress, token.epoch());
         }
-    }
+        next = position + 1;
+        return true;
+    });
+    run.counters.add_search_phase(verify_timer.stop());
+    phase_timer collect_timer("collect");
+    phase_span.reset();
+    phase_span.reset(new trace_span(session.get(), "collect", "search"));
+    // files whose results were not reported because the page filled up first
+    vector<size_t> unfinished;
     vector<bool> already_finished(my_pool.size());
     size_t finished_threads_counter = 0;
     while (finished_threads_counter != my_pool.size()) {
-        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
         for (size_t i = 0; i < my_pool.size(); i++) {
             if (my_pool[i].isFinished() && !already_finished[i]) {
                 finished_threads_counter++;
                 already_finished[i] = true;
-                auto result = my_pool[i].result();
-                if (!result.empty()) {
-                    emit update_results(thread_file_names[i], result);
+                if (page_token.cancelled()) {
+                    unfinished.push_back(thread_file_positions[i]);
+                    for (auto& copy : thread_file_copies[i]) {
+                        unfinished.push_back(copy.position);
+                    }
+                    continue;
                 }
-                update_progress(++counter, overall_text_files_count);
+                occurrence_list result = my_pool[i].result();
+                report(thread_file_names[i], result);
+                progress.add_done((quint64) thread_file_sizes[i]);
+                for (auto& copy : thread_file_copies[i]) {
+                    // the page may fill up halfway through the copies
+                    if (page_token.cancelled()) {
+                        unfinished.push_back(copy.position);
+                    } else {
+                        report_copy(copy, result);
+                    }
+                }
+                report_progress(progress, token.epoch());
+            }
+        }
+    }
+    run.counters.add_search_phase(collect_timer.stop());
+    phase_span.reset();
+    if (page_token.cancelled() && !token.cancelled()) {
+        std::unique_ptr<search_cursor> rest(new search_cursor);
+        rest->needle = page.needle;
+        rest->query = page.query;
+        rest->roots = page.roots;
+        rest->snapshots = page.snapshots;
+        rest->fm_indexes = page.fm_indexes;
+        rest->fm_results = page.fm_results;
+        rest->end = std::max(next, page.end);
+        rest->pending = std::move(unfinished);
+        for (size_t position : page.pending) {
+            if (position >= next) {
+                rest->pending.push_back(position);
             }
         }
+        std::sort(rest->pending.begin(), rest->pending.end());
+        {
+            std::lock_guard<std::mutex> lock(cursor_mutex);
+            cursors[token.epoch()] = std::move(rest);
+            if (cursors.size() > MAX_CURSORS) {
+                cursors.erase(cursors.begin());
+            }
+        }
+        emit info_message(QString("Searching has stopped at %1 matches, more are on the next page").arg(reported));
+        emit search_truncated(token.epoch(), reported);
+    } else {
+        emit info_message("Searching has finished...");
     }
-    emit info_message("Searching has finished...");
-    emit searching_finished();
-    update_progress(overall_text_files_count, overall_text_files_count);
-}
\ No newline at end of file
+    counters.set_search(run.counters);
+    emit stats_updated(stats());
+    emit progress_updated(token.epoch(), progress.finish());
+    emit searching_finished(token.epoch());
+    finish_trace(session);
+}
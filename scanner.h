@@ -13,8 +13,28 @@
 #include <QFileSystemWatcher>
 #include <QHash>
 #include <QSet>
+#include <QThreadPool>
 #include <unordered_map>
+#include <map>
 #include <atomic>
+#include <memory>
+#include <mutex>
+#include "arena.h"
+#include "trigrams.h"
+#include "trigram_index.h"
+#include "fm_index.h"
+#include "stats.h"
+#include "tracer.h"
+#include "cancel_token.h"
+#include "matcher.h"
+#include "approximate_matcher.h"
+#include "token_index.h"
+#include "progress.h"
+#include "batch_reader.h"
+#include "path_filter.h"
+#include "occurrence_list.h"
+#include "query.h"
+#include "archive.h"
 
 using std::string;
 using std::vector;
@@ -23,34 +43,203 @@ using std::pair;
 class scanner: public QObject {
     Q_OBJECT
 
-    using Trigrams = QHash<QByteArray, size_t>;
+    using Trigrams = QHash<trigram, size_t>;
 
-    QDir dir;
-    int current_progress;
-    std::atomic_bool cancel_state;
-    uint overall_files_count;
-    uint overall_text_files_count;
+    // Trigrams of the needle to look up in the files of one root.
+    struct trigram_plan {
+        // the rarest first, without the stop trigrams of the index
+        vector<pair<trigram, size_t>> trigrams;
+        // false if a needle shorter than a trigram is part of a stop trigram, which files may not store
+        bool check_bytes = true;
+        // occurrences of stop trigrams in the needle, which approximate matches need not share
+        size_t stop_trigrams = 0;
+    };
+
+    std::mutex tokens_mutex;
+    cancel_token scan_token;
+    cancel_token search_token;
+    std::atomic<uint64_t> last_epoch{0};
     QFileSystemWatcher watcher;
-    QHash<QByteArray, Trigrams> trigrams;
-    QSet<QString> text_file_names;
     bool max_socket_limit_reached;
+    bool huge_pages = false;
+    // 0 keeps exact trigram counts
+    std::atomic<double> bloom_rate{0};
+    std::atomic<index_engine> engine{index_engine::trigrams};
+    std::atomic<tokenizer> word_tokenizer{tokenizer::none};
+    // 0 reads files with blocking calls
+    unsigned io_queue_depth = 32;
+    mutable std::mutex exclusions_mutex;
+    path_filter::options exclusions;
+    archive_cache archives;
+    stats_collector counters;
+    QString trace_directory;
+    // the session started last, and the one of the scan running or done last
+    std::shared_ptr<trace_session> trace;
+    std::shared_ptr<trace_session> scan_trace;
 
     const int TEXT_FILE_THRESHOLD = 20000;
     const qint64 BIG_FILE_THRESHOLD = 512 * 1024;
     const int CHUNK_LEN = 1024 * 8;
+    const int PUBLISH_INTERVAL_MS = 500;
+    // files from this size on are searched in ranges by several threads
+    const qint64 PARALLEL_FILE_THRESHOLD = 64 * 1024 * 1024;
+    const qint64 MIN_RANGE_LEN = 8 * 1024 * 1024;
+    const int RANGES_PER_THREAD = 4;
+    // matches an FM-index locates at most, each takes up to fm_index::SAMPLE_RATE steps
+    const uint64_t MAX_FM_LOCATE = 1 << 22;
+
+    QThreadPool range_pool;
+
+    // FM-index of the text files of a root as they were at the end of its scan.
+    struct root_fm_index {
+        // the snapshot it was built from, which keeps the entries it covers alive
+        std::shared_ptr<const index_snapshot> snapshot;
+        fm_index text;
+        // the entry of every document; files whose entries were replaced since are not covered
+        vector<const file_entry*> entries;
+        QSet<const file_entry*> covered;
+    };
+
+    // A directory tree of the index, scanned, updated and dropped on its own.
+    struct indexed_root {
+        QDir dir;
+        QString path;
+        trigram_index index;
+        // token of the run that scans the root, which may go on to other roots
+        cancel_token run;
+        // child of run, so that removing the root stops only its own scan
+        cancel_token token;
+        // counters of its last scan
+        root_stats stats;
+        // null unless the engine of its scan builds one
+        std::shared_ptr<const root_fm_index> fm;
+    };
+    mutable std::mutex roots_mutex;
+    vector<std::shared_ptr<indexed_root>> indexed_roots;
+    // roots are scanned one at a time, they share the scan counters
+    std::mutex scan_mutex;
+
+    // What a page of a search counts and traces. Pages of the daemon's queries run alongside
+    // each other, the counters of the page finished last are the search counters of the scanner.
+    struct search_run {
+        stats_collector counters;
+        std::shared_ptr<trace_session> trace;
+    };
+
+    // Where a search stopped at its result limit. The next page goes on over the same snapshots.
+    // Positions run over the slots of the snapshots one root after another.
+    struct search_cursor {
+        QString needle;
+        query_options query;
+        vector<std::shared_ptr<indexed_root>> roots;
+        vector<std::shared_ptr<const index_snapshot>> snapshots;
+        vector<std::shared_ptr<const root_fm_index>> fm_indexes;
+        // what the FM-index of each root located for the first page, null where nothing was located
+        vector<std::shared_ptr<const QHash<const file_entry*, occurrence_list>>> fm_results;
+        // files before end have been searched, except those at the pending positions
+        size_t end = 0;
+        vector<size_t> pending;
+    };
+    std::mutex cursor_mutex;
+    // by the epoch of the page that stopped, the oldest are dropped beyond MAX_CURSORS
+    std::map<uint64_t, std::unique_ptr<search_cursor>> cursors;
+    static const size_t MAX_CURSORS = 16;
+
+    // declared last, so that it waits for pending file updates before anything else is destroyed
+    QThreadPool updates;
 
-    void init();
-    void index();
-    void to_trigrams(const QByteArray &);
+    void init(indexed_root& root);
+    void index(indexed_root& root, const cancel_token& token, progress_meter& progress);
+    // Reads the UTF-8 text files of the snapshot again into an FM-index of the root.
+    void build_fm_index(indexed_root& root, std::shared_ptr<const index_snapshot> const& snapshot,
+                        const cancel_token& token);
+    // Results of the contents the FM-index has matches in. False if there are too many to locate,
+    // then the files are read as without the index.
+    bool fm_search(const root_fm_index& fm, const QByteArray& needle, const query_options& query,
+                   const cancel_token& token, QHash<const file_entry*, occurrence_list>& results);
+    // The root a file is under, null if it is under none.
+    std::shared_ptr<indexed_root> root_of(const QString& absolute_path) const;
+    // Counts the trigrams of a file in the scratch counter of the thread and hashes its bytes,
+    // null for binaries. Also collects its tokens unless tokens is null.
+    trigram_counter* to_trigrams(const QString& absolute_path, batch_reader::file& file, qint64& size,
+                                 text_encoding& encoding, uint64_t& hash, token_collector* tokens,
+                                 const cancel_token& token);
+    void update_file(const QString& filename, bool exists);
+    // Trigrams of the text members of an archive, decompressed only when it changed since the last time.
+    archive_members read_archive(const QString& absolute_path, const cancel_token& token);
+    void update_archive(indexed_root& root, const QString& absolute_path, bool exists);
+    void watch(const QStringList& absolute_paths);
+    void unwatch(const QString& root_path);
     Trigrams split_into_trigrams(const QString&);
-    void update_progress(size_t i, size_t overall_size);
-    void KMP(const QByteArray &S, const QString &pattern, qint64 S_size, vector<int>& result, int start_index);
-    vector<int> find_substr(const scanner::Trigrams &tg, const QString& filename, const QString& needle);
+    static trigram_plan plan_trigrams(const Trigrams& tg, const QByteArray& needle, const index_snapshot& snapshot);
+    void report_progress(progress_meter& progress, quint64 epoch);
+    // Null unless traces are written.
+    std::shared_ptr<trace_session> start_trace(const QString& name);
+    void finish_trace(std::shared_ptr<trace_session> const& session);
+    // Approximate queries pass an approximate matcher and word queries a word finder, which then
+    // verify the file instead of needle.
+    occurrence_list find_substr(search_run& run, const trigram_plan& plan, const QString& filename,
+                                const file_entry* entry, const matcher& needle, const approximate_matcher* approximate,
+                                const word_finder* words, const query_options& query, const cancel_token& token);
+    // Verifies the UTF-8 text of a file from start to end with a stream of an approximate matcher or
+    // a word finder, which reports matches starting less than reach bytes before the end of the text
+    // fed to it. Stops at the query's limit.
+    template<typename Match, typename Stream>
+    occurrence_list verify_sequentially(search_run& run, const QString& filename, const file_entry* entry,
+                                        Stream& text, size_t reach, const query_options& query,
+                                        const cancel_token& token);
+    // Counts the matches starting in [begin, end) of a file, which is read up to length - 1 bytes past end,
+    // and appends their positions if the query keeps them. Stops at the query's limit.
+    void search_range(search_run& run, const QString& filename, qint64 begin, qint64 end, const matcher& needle,
+                      const query_options& query, const cancel_token& token,
+                      vector<int64_t>& found, uint64_t& counted);
+    void search_in_parallel(search_run& run, const QString& filename, qint64 size, const matcher& needle,
+                            const query_options& query, const cancel_token& token,
+                            vector<int64_t>& found, uint64_t& counted);
+    void search_page(search_cursor page, const cancel_token& token);
+    // Name of a result: relative to its root when a single root is searched, absolute otherwise.
+    static QString result_name(const search_cursor& page, size_t root, const QString& absolute_path);
 
 
 public:
-    void scan(QDir const& dir);
-    void search(QString const& needle);
+    scanner();
+    void set_huge_pages(bool enabled);
+    // From the next scan on, keeps Bloom filters of the trigrams of every file with this false
+    // positive rate instead of their counts, 0 to keep the counts.
+    void set_bloom_filter(double false_positive_rate);
+    double bloom_filter() const;
+    // Applied from the next scan on.
+    void set_engine(index_engine e);
+    index_engine current_engine() const;
+    // From the next scan on, also keeps postings of the tokens of the text files for whole-word
+    // and prefix queries, none to keep no tokens.
+    void set_tokenizer(tokenizer kind);
+    tokenizer current_tokenizer() const;
+    // Files are opened and read in batches of this many through io_uring where available.
+    void set_io_queue_depth(unsigned depth);
+    // Applied from the next scan on.
+    void set_exclusions(path_filter::options const& rules);
+    path_filter::options exclusion_rules() const;
+    // Cancel the previous run and return the token (with a new epoch) of the next one.
+    cancel_token new_scan_token();
+    cancel_token new_search_token();
+    // Token of a search that runs alongside the others, as the queries of the daemon's clients do.
+    cancel_token new_query_token();
+    // Replaces every root of the index by dir, and stops the runs that added them.
+    void scan(QDir const& dir, cancel_token const& token);
+    // Indexes dir next to the other roots, or indexes it again if it is one of them already.
+    // Roots may not be nested.
+    void add_root(QDir const& dir, cancel_token const& token);
+    // Drops a root and stops its scan. Searches already running keep their view of it.
+    bool remove_root(QString const& path);
+    QStringList roots() const;
+    // Runs over the latest published snapshot, which may be partial while a scan is in progress.
+    void search(QString const& needle, query_options const& query, cancel_token const& token);
+    // Continues the search whose page of the given epoch stopped at its result limit, with the same limit.
+    void search_next(quint64 epoch, cancel_token const& token);
+    scanner_stats stats() const;
+    void set_trace_directory(const QString& path);
+    std::shared_ptr<trace_session> current_trace() const;
 
 public slots:
     void cancel();
@@ -58,12 +247,18 @@ public slots:
 
 signals:
     void exception_occurred(const QString &message);
+    // An error of the search of this epoch, which concerns only whoever runs it.
+    void search_error(quint64 epoch, const QString& message);
     void info_message(const QString& message);
-    void progress_updated(int value);
-    void indexing_finished();
+    void progress_updated(quint64 epoch, const progress_info& progress);
+    void index_published(quint64 epoch, const QString& root, int coverage, quint64 files);
+    void indexing_finished(quint64 epoch);
     void all_new_text_files(const QSet<QString>&);
-    void searching_finished();
-    void update_results(const QString&, const vector<int>&);
+    void searching_finished(quint64 epoch);
+    // Sent before searching_finished when the search stopped at its result limit.
+    void search_truncated(quint64 epoch, quint64 results);
+    void update_results(quint64 epoch, const QString&, const occurrence_list&);
+    void stats_updated(const scanner_stats&);
 };
 
 #endif // SCANNER_H
@@ -0,0 +1,102 @@
+#include "search_client.h"
+#include "daemon_protocol.h"
+
+#include <QJsonArray>
+
+search_client::search_client(QObject *parent) : QObject(parent) {
+    connect(&socket, &QLocalSocket::readyRead, this, &search_client::read_events);
+    connect(&socket, &QLocalSocket::disconnected, this, &search_client::disconnected);
+}
+
+bool search_client::connect_to_daemon(QString const &socket_name, int timeout_ms) {
+    socket.connectToServer(socket_name);
+    if (!socket.waitForConnected(timeout_ms)) {
+        return false;
+    }
+    // the daemon greets with the list of its roots
+    while (!greeted && socket.waitForReadyRead(timeout_ms)) {
+        read_events();
+    }
+    return greeted;
+}
+
+bool search_client::connected() const {
+    return socket.state() == QLocalSocket::ConnectedState;
+}
+
+QStringList search_client::roots() const {
+    return root_paths;
+}
+
+quint64 search_client::search(QString const &needle, query_options const &query) {
+    QJsonObject message;
+    message["op"] = "search";
+    message["id"] = (qint64) ++last_id;
+    message["needle"] = needle;
+    message["query"] = query_to_json(query);
+    send(message);
+    return last_id;
+}
+
+quint64 search_client::search_next(quint64 epoch) {
+    QJsonObject message;
+    message["op"] = "next";
+    message["id"] = (qint64) ++last_id;
+    message["after"] = (qint64) epoch;
+    send(message);
+    return last_id;
+}
+
+void search_client::cancel() {
+    if (!connected()) {
+        return;
+    }
+    QJsonObject message;
+    message["op"] = "cancel";
+    message["id"] = (qint64) last_id;
+    send(message);
+}
+
+void search_client::send(QJsonObject const &message) {
+    if (socket.write(encode_message(message)) < 0) {
+        emit exception_occurred("Cannot reach the search daemon: " + socket.errorString());
+    }
+}
+
+void search_client::read_events() {
+    while (socket.canReadLine()) {
+        QJsonObject message;
+        if (decode_message(socket.readLine(), message)) {
+            handle(message);
+        }
+    }
+}
+
+void search_client::handle(QJsonObject const &message) {
+    QString event = message.value("event").toString();
+    auto epoch = (quint64) message.value("id").toDouble();
+    if (event == "result") {
+        emit update_results(epoch, message.value("file").toString(), occurrences_from_json(message));
+    } else if (event == "progress") {
+        emit progress_updated(epoch, progress_from_json(message.value("progress").toObject()));
+    } else if (event == "finished") {
+        emit searching_finished(epoch);
+    } else if (event == "truncated") {
+        emit search_truncated(epoch, (quint64) message.value("results").toDouble());
+    } else if (event == "roots") {
+        root_paths.clear();
+        for (auto const& root : message.value("roots").toArray()) {
+            root_paths.append(root.toString());
+        }
+        greeted = true;
+    } else if (event == "index") {
+        emit index_published(0, message.value("root").toString(), message.value("coverage").toInt(),
+                             (quint64) message.value("files").toDouble());
+    } else if (event == "indexed") {
+        emit indexing_finished(0);
+    } else if (event == "info") {
+        emit info_message(message.value("message").toString());
+    } else if (event == "error") {
+        emit exception_occurred(message.value("message").toString());
+    }
+}
@@ -0,0 +1,54 @@
+#ifndef SEARCH_CLIENT_H
+#define SEARCH_CLIENT_H
+
+#include <QJsonObject>
+#include <QLocalSocket>
+#include <QObject>
+#include "occurrence_list.h"
+#include "progress.h"
+#include "query.h"
+
+// Connection to a search daemon. It sends the same signals as scanner, with
+// the ids of its own searches as epochs and epoch 0 for the indexing, so the
+// window shows remote searches the way it shows local ones.
+class search_client : public QObject {
+    Q_OBJECT
+
+public:
+    explicit search_client(QObject* parent = nullptr);
+
+    bool connect_to_daemon(QString const& socket_name, int timeout_ms);
+    bool connected() const;
+    // Directories the daemon has indexed.
+    QStringList roots() const;
+    // Both return the epoch of the new search.
+    quint64 search(QString const& needle, query_options const& query);
+    quint64 search_next(quint64 epoch);
+
+public slots:
+    // Cancels the last search.
+    void cancel();
+
+signals:
+    void exception_occurred(const QString& message);
+    void info_message(const QString& message);
+    void progress_updated(quint64 epoch, const progress_info& progress);
+    void index_published(quint64 epoch, const QString& root, int coverage, quint64 files);
+    void indexing_finished(quint64 epoch);
+    void searching_finished(quint64 epoch);
+    void search_truncated(quint64 epoch, quint64 results);
+    void update_results(quint64 epoch, const QString&, const occurrence_list&);
+    void disconnected();
+
+private:
+    QLocalSocket socket;
+    QStringList root_paths;
+    bool greeted = false;
+    quint64 last_id = 0;
+
+    void read_events();
+    void handle(QJsonObject const& message);
+    void send(QJsonObject const& message);
+};
+
+#endif // SEARCH_CLIENT_H
@@ -0,0 +1,284 @@
+#include "search_daemon.h"
+#include "daemon_protocol.h"
+
+#include <QJsonArray>
+#include <QtConcurrent/QtConcurrent>
+
+search_daemon::search_daemon(QObject *parent) : QObject(parent) {
+    qRegisterMetaType<occurrence_list>("occurrence_list");
+    qRegisterMetaType<progress_info>("progress_info");
+    qRegisterMetaType<scanner_stats>("scanner_stats");
+    qRegisterMetaType<QSet<QString>>("QSet<QString>");
+    queries.setMaxThreadCount(MAX_PARALLEL_QUERIES);
+
+    connect(&server, &QLocalServer::newConnection, this, &search_daemon::accept);
+    connect(&s, SIGNAL(info_message(const QString&)), this, SLOT(log_message(const QString&)));
+    connect(&s, SIGNAL(exception_occurred(const QString&)), this, SLOT(log_error(const QString&)));
+    connect(&s, SIGNAL(search_error(quint64, const QString&)), this, SLOT(send_search_error(quint64, const QString&)));
+    connect(&s, SIGNAL(progress_updated(quint64, const progress_info&)),
+            this, SLOT(send_progress(quint64, const progress_info&)));
+    connect(&s, SIGNAL(index_published(quint64, const QString&, int, quint64)),
+            this, SLOT(send_index(quint64, const QString&, int, quint64)));
+    connect(&s, SIGNAL(indexing_finished(quint64)), this, SLOT(send_indexed(quint64)));
+    connect(&s, SIGNAL(update_results(quint64, const QString&, const occurrence_list&)),
+            this, SLOT(send_result(quint64, const QString&, const occurrence_list&)));
+    connect(&s, SIGNAL(search_truncated(quint64, quint64)), this, SLOT(send_truncated(quint64, quint64)));
+    connect(&s, SIGNAL(searching_finished(quint64)), this, SLOT(send_finished(quint64)));
+}
+
+search_daemon::~search_daemon() {
+    server.close();
+    s.cancel();
+    for (auto& search : running) {
+        search.token.cancel();
+    }
+    queries.waitForDone();
+    scan_future.waitForFinished();
+}
+
+bool search_daemon::start(QStringList const &dirs, QString const &socket_name, bool shared, QString &error) {
+    // a socket left behind by a daemon that died is taken over, a live one is not
+    QLocalSocket probe;
+    probe.connectToServer(socket_name);
+    if (probe.waitForConnected(500)) {
+        error = "Another daemon is listening on " + socket_name;
+        return false;
+    }
+    QLocalServer::removeServer(socket_name);
+    server.setSocketOptions(shared ? QLocalServer::WorldAccessOption : QLocalServer::UserAccessOption);
+    if (!server.listen(socket_name)) {
+        error = server.errorString();
+        return false;
+    }
+    for (QString const& dir : dirs) {
+        QString root = QDir(dir).absolutePath();
+        roots.append(root);
+        QJsonObject state;
+        state["event"] = "index";
+        state["root"] = root;
+        state["coverage"] = 0;
+        state["files"] = 0;
+        index_states.insert(root, state);
+    }
+    cancel_token token = s.new_scan_token();
+    scan_epoch = token.epoch();
+    QStringList paths = roots;
+    scan_future = QtConcurrent::run([this, paths, token] {
+        for (QString const& path : paths) {
+            s.add_root(QDir(path), token);
+        }
+    });
+    return true;
+}
+
+void search_daemon::set_bloom_filter(double false_positive_rate) {
+    s.set_bloom_filter(false_positive_rate);
+}
+
+void search_daemon::set_engine(index_engine engine) {
+    s.set_engine(engine);
+}
+
+void search_daemon::set_tokenizer(tokenizer kind) {
+    s.set_tokenizer(kind);
+}
+
+void search_daemon::accept() {
+    while (QLocalSocket* client = server.nextPendingConnection()) {
+        clients.insert(client, QHash<qint64, quint64>());
+        connect(client, &QLocalSocket::readyRead, this, [this, client] { read_requests(client); });
+        connect(client, &QLocalSocket::disconnected, this, [this, client] { drop(client); });
+        QJsonObject greeting;
+        greeting["event"] = "roots";
+        greeting["roots"] = QJsonArray::fromStringList(roots);
+        send(client, greeting);
+        for (QString const& root : roots) {
+            send(client, index_states.value(root));
+        }
+    }
+}
+
+void search_daemon::read_requests(QLocalSocket *client) {
+    while (client->canReadLine()) {
+        QJsonObject message;
+        if (!decode_message(client->readLine(), message)) {
+            QJsonObject error;
+            error["event"] = "error";
+            error["message"] = "Malformed request";
+            send(client, error);
+            continue;
+        }
+        handle(client, message);
+    }
+    if (client->bytesAvailable() > MAX_REQUEST_LEN) {
+        client->abort();
+    }
+}
+
+void search_daemon::handle(QLocalSocket *client, QJsonObject const &message) {
+    QString op = message.value("op").toString();
+    auto id = (qint64) message.value("id").toDouble();
+    if (op == "cancel") {
+        for (auto& search : running) {
+            if (search.client == client && search.id == id) {
+                search.token.cancel();
+            }
+        }
+        return;
+    }
+    if (op != "search" && op != "next") {
+        QJsonObject error;
+        error["event"] = "error";
+        error["message"] = "Unknown request " + op;
+        send(client, error);
+        return;
+    }
+    if (op == "search" && message.value("needle").toString().isEmpty()) {
+        QJsonObject error;
+        error["event"] = "error";
+        error["message"] = "Nothing to search for";
+        send(client, error);
+        QJsonObject finished;
+        finished["event"] = "finished";
+        finished["id"] = id;
+        send(client, finished);
+        return;
+    }
+    cancel_token token = s.new_query_token();
+    running.insert(token.epoch(), request{client, id, token});
+    if (op == "search") {
+        QString needle = message.value("needle").toString();
+        query_options query = query_from_json(message.value("query").toObject());
+        QtConcurrent::run(&queries, [this, needle, query, token] {
+            s.search(needle, query, token);
+        });
+    } else {
+        // an unknown page just finishes with no results
+        quint64 page = clients[client].take((qint64) message.value("after").toDouble());
+        QtConcurrent::run(&queries, [this, page, token] {
+            s.search_next(page, token);
+        });
+    }
+}
+
+void search_daemon::drop(QLocalSocket *client) {
+    clients.remove(client);
+    // results still on their way are dropped in send()
+    for (auto& search : running) {
+        if (search.client == client) {
+            search.client = nullptr;
+            search.token.cancel();
+        }
+    }
+    client->deleteLater();
+}
+
+void search_daemon::send(QLocalSocket *client, QJsonObject const &message) {
+    if (client && clients.contains(client)) {
+        client->write(encode_message(message));
+    }
+}
+
+void search_daemon::broadcast(QJsonObject const &message) {
+    for (auto it = clients.begin(); it != clients.end(); ++it) {
+        it.key()->write(encode_message(message));
+    }
+}
+
+void search_daemon::log_message(const QString &message) {
+    qDebug() << message;
+}
+
+// errors of the scans concern every client, those of a search go to its client alone
+void search_daemon::log_error(const QString &message) {
+    qWarning() << message;
+    QJsonObject error;
+    error["event"] = "error";
+    error["message"] = message;
+    broadcast(error);
+}
+
+void search_daemon::send_search_error(quint64 epoch, const QString &message) {
+    auto it = running.find(epoch);
+    if (it == running.end()) {
+        return;
+    }
+    QJsonObject error;
+    error["event"] = "error";
+    error["id"] = it->id;
+    error["message"] = message;
+    send(it->client, error);
+}
+
+void search_daemon::send_progress(quint64 epoch, const progress_info &progress) {
+    QJsonObject message;
+    message["event"] = "progress";
+    message["progress"] = progress_to_json(progress);
+    if (epoch == scan_epoch) {
+        // id 0 is the indexing
+        message["id"] = 0;
+        broadcast(message);
+        return;
+    }
+    auto it = running.find(epoch);
+    if (it != running.end()) {
+        message["id"] = it->id;
+        send(it->client, message);
+    }
+}
+
+void search_daemon::send_index(quint64 epoch, const QString &root, int coverage, quint64 files) {
+    if (epoch != scan_epoch || !index_states.contains(root)) {
+        return;
+    }
+    QJsonObject& state = index_states[root];
+    state["coverage"] = coverage;
+    state["files"] = (qint64) files;
+    broadcast(state);
+}
+
+void search_daemon::send_indexed(quint64 epoch) {
+    if (epoch != scan_epoch) {
+        return;
+    }
+    QJsonObject message;
+    message["event"] = "indexed";
+    broadcast(message);
+}
+
+void search_daemon::send_result(quint64 epoch, const QString &filename, const occurrence_list &occurrences) {
+    auto it = running.find(epoch);
+    if (it == running.end()) {
+        return;
+    }
+    QJsonObject message = occurrences_to_json(occurrences);
+    message["event"] = "result";
+    message["id"] = it->id;
+    message["file"] = filename;
+    send(it->client, message);
+}
+
+void search_daemon::send_truncated(quint64 epoch, quint64 results) {
+    auto it = running.find(epoch);
+    if (it == running.end() || !it->client) {
+        return;
+    }
+    clients[it->client].insert(it->id, epoch);
+    QJsonObject message;
+    message["event"] = "truncated";
+    message["id"] = it->id;
+    message["results"] = (qint64) results;
+    send(it->client, message);
+}
+
+void search_daemon::send_finished(quint64 epoch) {
+    auto it = running.find(epoch);
+    if (it == running.end()) {
+        return;
+    }
+    QJsonObject message;
+    message["event"] = "finished";
+    message["id"] = it->id;
+    send(it->client, message);
+    running.erase(it);
+}
@@ -0,0 +1,75 @@
+#ifndef SEARCH_DAEMON_H
+#define SEARCH_DAEMON_H
+
+#include <QDir>
+#include <QFuture>
+#include <QHash>
+#include <QJsonObject>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QThreadPool>
+#include "scanner.h"
+
+// Keeps the index of a few trees in memory and runs the searches of the clients
+// connected to its local socket (see daemon_protocol.h), so that a tree is
+// indexed once per machine instead of once per window. Searches of different
+// clients run side by side.
+class search_daemon : public QObject {
+    Q_OBJECT
+
+public:
+    explicit search_daemon(QObject* parent = nullptr);
+    ~search_daemon() override;
+
+    // Starts indexing the directories, one after another, and listening. A shared socket
+    // accepts other users of the machine.
+    bool start(QStringList const& dirs, QString const& socket_name, bool shared, QString& error);
+    // See scanner::set_bloom_filter, scanner::set_engine and scanner::set_tokenizer; call before start.
+    void set_bloom_filter(double false_positive_rate);
+    void set_engine(index_engine engine);
+    void set_tokenizer(tokenizer kind);
+
+private slots:
+    void accept();
+    void log_message(const QString& message);
+    void log_error(const QString& message);
+    void send_search_error(quint64 epoch, const QString& message);
+    void send_progress(quint64 epoch, const progress_info& progress);
+    void send_index(quint64 epoch, const QString& root, int coverage, quint64 files);
+    void send_indexed(quint64 epoch);
+    void send_result(quint64 epoch, const QString& filename, const occurrence_list& occurrences);
+    void send_truncated(quint64 epoch, quint64 results);
+    void send_finished(quint64 epoch);
+
+private:
+    // a search of a client, by the epoch the scanner runs it under
+    struct request {
+        QLocalSocket* client;
+        qint64 id;
+        cancel_token token;
+    };
+
+    // longest request line accepted before the client is dropped
+    static const qint64 MAX_REQUEST_LEN = 1024 * 1024;
+    const int MAX_PARALLEL_QUERIES = 4;
+
+    scanner s;
+    QLocalServer server;
+    QStringList roots;
+    quint64 scan_epoch = 0;
+    QFuture<void> scan_future;
+    QThreadPool queries;
+    QHash<quint64, request> running;
+    // connected clients, each with the epochs of its truncated pages by the id it gave them
+    QHash<QLocalSocket*, QHash<qint64, quint64>> clients;
+    // the last index event of every root, sent to clients as they connect
+    QHash<QString, QJsonObject> index_states;
+
+    void read_requests(QLocalSocket* client);
+    void handle(QLocalSocket* client, QJsonObject const& message);
+    void drop(QLocalSocket* client);
+    void send(QLocalSocket* client, QJsonObject const& message);
+    void broadcast(QJsonObject const& message);
+};
+
+#endif // SEARCH_DAEMON_H
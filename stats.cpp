@@ -0,0 +1,137 @@
+#include "stats.h"
+#include <QJsonArray>
+
+namespace {
+    QJsonArray phases_to_json(vector<phase_time> const& phases) {
+        QJsonArray result;
+        for (auto& phase : phases) {
+            QJsonObject p;
+            p["name"] = phase.name;
+            p["wall_ms"] = phase.wall_ms;
+            p["process_cpu_ms"] = phase.process_cpu_ms;
+            result.append(p);
+        }
+        return result;
+    }
+}
+
+QJsonObject scanner_stats::to_json() const {
+    QJsonObject scan;
+    scan["files_walked"] = double(files_walked);
+    scan["paths_excluded"] = double(paths_excluded);
+    scan["bytes_read"] = double(bytes_read);
+    scan["trigrams_extracted"] = double(trigrams_extracted);
+    scan["trigram_bytes"] = double(trigram_bytes);
+    scan["binaries_rejected"] = double(binaries_rejected);
+    scan["duplicate_files"] = double(duplicate_files);
+    scan["text_files"] = double(text_files);
+    scan["phases"] = phases_to_json(scan_phases);
+
+    QJsonObject search;
+    search["files_checked"] = double(files_checked);
+    search["duplicates_skipped"] = double(duplicates_skipped);
+    search["candidates"] = double(candidates);
+    search["bytes_verified"] = double(bytes_verified);
+    search["matches"] = double(matches);
+    search["phases"] = phases_to_json(search_phases);
+
+    QJsonArray roots_json;
+    for (auto& root : roots) {
+        QJsonObject r;
+        r["path"] = root.path;
+        r["files_walked"] = double(root.files_walked);
+        r["paths_excluded"] = double(root.paths_excluded);
+        r["bytes_read"] = double(root.bytes_read);
+        r["binaries_rejected"] = double(root.binaries_rejected);
+        r["duplicate_files"] = double(root.duplicate_files);
+        r["text_files"] = double(root.text_files);
+        r["coverage"] = root.coverage;
+        r["complete"] = root.complete;
+        QJsonArray stop;
+        for (auto& t : root.stop_trigrams) {
+            QJsonObject s;
+            s["trigram"] = t.first;
+            s["files"] = double(t.second);
+            stop.append(s);
+        }
+        r["stop_trigrams"] = stop;
+        r["fm_index_files"] = double(root.fm_index_files);
+        r["fm_index_bytes"] = double(root.fm_index_bytes);
+        r["tokens"] = double(root.tokens);
+        roots_json.append(r);
+    }
+
+    QJsonObject result;
+    result["scan"] = scan;
+    result["search"] = search;
+    result["roots"] = roots_json;
+    return result;
+}
+
+void stats_collector::reset_scan() {
+    files_walked = 0;
+    paths_excluded = 0;
+    bytes_read = 0;
+    trigrams_extracted = 0;
+    trigram_bytes = 0;
+    binaries_rejected = 0;
+    duplicate_files = 0;
+    text_files = 0;
+    std::lock_guard<std::mutex> lock(phases_mutex);
+    scan_phases.clear();
+}
+
+void stats_collector::set_search(stats_collector const& search) {
+    vector<phase_time> phases;
+    {
+        std::lock_guard<std::mutex> lock(search.phases_mutex);
+        phases = search.search_phases;
+    }
+    std::lock_guard<std::mutex> lock(phases_mutex);
+    files_checked = search.files_checked.load();
+    duplicates_skipped = search.duplicates_skipped.load();
+    candidates = search.candidates.load();
+    bytes_verified = search.bytes_verified.load();
+    matches = search.matches.load();
+    search_phases = std::move(phases);
+}
+
+void stats_collector::add_scan_phase(phase_time const& phase) {
+    std::lock_guard<std::mutex> lock(phases_mutex);
+    scan_phases.push_back(phase);
+}
+
+void stats_collector::add_search_phase(phase_time const& phase) {
+    std::lock_guard<std::mutex> lock(phases_mutex);
+    search_phases.push_back(phase);
+}
+
+scanner_stats stats_collector::snapshot() const {
+    scanner_stats s;
+    s.files_walked = files_walked;
+    s.paths_excluded = paths_excluded;
+    s.bytes_read = bytes_read;
+    s.trigrams_extracted = trigrams_extracted;
+    s.trigram_bytes = trigram_bytes;
+    s.binaries_rejected = binaries_rejected;
+    s.duplicate_files = duplicate_files;
+    s.text_files = text_files;
+    s.files_checked = files_checked;
+    s.duplicates_skipped = duplicates_skipped;
+    s.candidates = candidates;
+    s.bytes_verified = bytes_verified;
+    s.matches = matches;
+    std::lock_guard<std::mutex> lock(phases_mutex);
+    s.scan_phases = scan_phases;
+    s.search_phases = search_phases;
+    return s;
+}
+
+phase_timer::phase_timer(QString name)
+        : name(std::move(name)), wall_start(std::chrono::steady_clock::now()), cpu_start(std::clock()) {}
+
+phase_time phase_timer::stop() const {
+    std::chrono::duration<double, std::milli> wall = std::chrono::steady_clock::now() - wall_start;
+    double cpu = 1000.0 * double(std::clock() - cpu_start) / CLOCKS_PER_SEC;
+    return phase_time{name, wall.count(), cpu};
+}
@@ -0,0 +1,113 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <QString>
+#include <QJsonObject>
+#include <QMetaType>
+#include <atomic>
+#include <chrono>
+#include <ctime>
+#include <mutex>
+#include <vector>
+
+using std::vector;
+
+struct phase_time {
+    QString name;
+    double wall_ms;
+    // CPU time of the whole process, so scans and queries running alongside count as well
+    double process_cpu_ms;
+};
+
+// One indexed directory: the scan counters of its last scan and the state of its index.
+struct root_stats {
+    QString path;
+    quint64 files_walked = 0;
+    quint64 paths_excluded = 0;
+    quint64 bytes_read = 0;
+    quint64 binaries_rejected = 0;
+    quint64 duplicate_files = 0;
+    quint64 text_files = 0;
+    int coverage = 0;
+    bool complete = false;
+    // trigrams the index leaves out of its files, with the number of files they occur in
+    vector<std::pair<QString, quint64>> stop_trigrams;
+    // files searched without reading them and the memory their FM-index takes, 0 without one
+    quint64 fm_index_files = 0;
+    quint64 fm_index_bytes = 0;
+    // distinct tokens of the postings, 0 without them
+    quint64 tokens = 0;
+};
+
+// Plain copy of the counters, safe to pass through queued signals.
+struct scanner_stats {
+    quint64 files_walked = 0;
+    quint64 paths_excluded = 0;
+    quint64 bytes_read = 0;
+    quint64 trigrams_extracted = 0;
+    quint64 trigram_bytes = 0;
+    quint64 binaries_rejected = 0;
+    quint64 duplicate_files = 0;
+    quint64 text_files = 0;
+
+    quint64 files_checked = 0;
+    quint64 duplicates_skipped = 0;
+    quint64 candidates = 0;
+    quint64 bytes_verified = 0;
+    quint64 matches = 0;
+
+    vector<phase_time> scan_phases;
+    vector<phase_time> search_phases;
+    vector<root_stats> roots;
+
+    QJsonObject to_json() const;
+};
+
+Q_DECLARE_METATYPE(scanner_stats)
+
+class stats_collector {
+public:
+    std::atomic<quint64> files_walked{0};
+    std::atomic<quint64> paths_excluded{0};
+    std::atomic<quint64> bytes_read{0};
+    std::atomic<quint64> trigrams_extracted{0};
+    // memory of the trigram counts or filters stored
+    std::atomic<quint64> trigram_bytes{0};
+    std::atomic<quint64> binaries_rejected{0};
+    // indexed as copies of a file with the same content
+    std::atomic<quint64> duplicate_files{0};
+    std::atomic<quint64> text_files{0};
+
+    std::atomic<quint64> files_checked{0};
+    // given the results of a copy instead of being verified
+    std::atomic<quint64> duplicates_skipped{0};
+    std::atomic<quint64> candidates{0};
+    std::atomic<quint64> bytes_verified{0};
+    std::atomic<quint64> matches{0};
+
+    void reset_scan();
+    // Takes the search counters and phases of one search.
+    void set_search(stats_collector const& search);
+    void add_scan_phase(phase_time const& phase);
+    void add_search_phase(phase_time const& phase);
+    scanner_stats snapshot() const;
+
+private:
+    mutable std::mutex phases_mutex;
+    vector<phase_time> scan_phases;
+    vector<phase_time> search_phases;
+};
+
+// Measures wall and process CPU time between construction and stop().
+class phase_timer {
+public:
+    explicit phase_timer(QString name);
+    phase_time stop() const;
+
+private:
+    QString name;
+    std::chrono::steady_clock::time_point wall_start;
+    std::clock_t cpu_start;
+};
+
+#endif // STATS_H
@@ -1,13 +1,613 @@
 #include <algorithm>
 #include <cassert>
 #include <cstdlib>
+#include <cstring>
 #include <vector>
 #include <utility>
+#include <chrono>
+#include <random>
+#include <iostream>
 
 #include "gtest/gtest.h"
 #include "scanner.h"
+#include <QTemporaryDir>
+#include "matcher.h"
+#include "path_filter.h"
+#include "encoding.h"
+#include "occurrence_list.h"
+#include "content_hash.h"
+#include "trigrams.h"
+#include "trigram_frequencies.h"
+#include "fm_index.h"
+#include "approximate_matcher.h"
+#include "token_index.h"
+#include "archive.h"
+#include <mutex>
+#include <set>
+#include <tuple>
+#include <sys/stat.h>
+#include <zlib.h>
 
 TEST(correctness, KMP_1)
 {
 
-}
\ No newline at end of file
+}
+
+TEST(correctness, matcher_kernels_agree_with_naive_search)
+{
+    std::mt19937 rng(1);
+    for (int iteration = 0; iteration < 2000; iteration++) {
+        size_t length = 1 + rng() % 40;
+        std::string text(rng() % 300, 'a'), needle(length, 'a');
+        for (auto &c : text) c = "ab"[rng() % 2];
+        for (auto &c : needle) c = "ab"[rng() % 2];
+
+        vector<int64_t> expected;
+        for (size_t i = 0; i + length <= text.size(); i++) {
+            if (text.compare(i, length, needle) == 0) {
+                expected.push_back(7 + (int64_t) i);
+            }
+        }
+        matcher m(needle);
+        vector<int64_t> specialized, kmp;
+        m.find_all(text.data(), text.size(), 7, specialized);
+        kmp_find(m, text.data(), text.size(), 7, kmp);
+        ASSERT_EQ(expected, specialized);
+        ASSERT_EQ(expected, kmp);
+
+        // the limit counts only the positions appended by this call
+        size_t limit = rng() % 4;
+        vector<int64_t> limited{-1};
+        m.find_all(text.data(), text.size(), 7, limited, limit);
+        expected.resize(std::min(limit, expected.size()));
+        expected.insert(expected.begin(), -1);
+        ASSERT_EQ(expected, limited);
+    }
+}
+
+TEST(correctness, gitignore_rules)
+{
+    path_filter::rule_set rules;
+    for (auto line : {"*.log", "!keep.log", "build/", "/out", "docs/**/*.md", "[Tt]emp?", "\\#hash"}) {
+        rules.add(line);
+    }
+    EXPECT_EQ(1, rules.match("a/b/x.log", "x.log", false));
+    EXPECT_EQ(-1, rules.match("a/keep.log", "keep.log", false));
+    EXPECT_EQ(1, rules.match("src/build", "build", true));
+    EXPECT_EQ(0, rules.match("src/build", "build", false));
+    EXPECT_EQ(1, rules.match("out", "out", true));
+    EXPECT_EQ(0, rules.match("src/out", "out", true));
+    EXPECT_EQ(1, rules.match("docs/a.md", "a.md", false));
+    EXPECT_EQ(1, rules.match("docs/x/y/a.md", "a.md", false));
+    EXPECT_EQ(0, rules.match("src/a.md", "a.md", false));
+    EXPECT_EQ(1, rules.match("Temp1", "Temp1", false));
+    EXPECT_EQ(0, rules.match("temp12", "temp12", false));
+    EXPECT_EQ(1, rules.match("#hash", "#hash", false));
+}
+
+TEST(correctness, transcoding_maps_offsets_back)
+{
+    // "aé😀b" in UTF-16LE with a BOM
+    const unsigned char utf16[] = {0xFF, 0xFE, 'a', 0, 0xE9, 0, 0x3D, 0xD8, 0x00, 0xDE, 'b', 0};
+    std::string text(reinterpret_cast<const char*>(utf16), sizeof(utf16));
+    ASSERT_EQ(text_encoding::utf16le, detect_encoding(text.data(), text.size()));
+    ASSERT_EQ(text_encoding::windows1252, detect_encoding("caf\xe9 \x80", 6));
+    ASSERT_EQ(text_encoding::utf8, detect_encoding("caf\xc3\xa9", 5));
+
+    // the result does not depend on where chunks are cut
+    for (size_t cut = 0; cut <= text.size(); cut++) {
+        utf8_transcoder transcoder(text_encoding::utf16le);
+        vector<char> out;
+        vector<int64_t> offsets;
+        transcoder.convert(text.data(), cut, out, &offsets);
+        transcoder.convert(text.data() + cut, text.size() - cut, out, &offsets);
+        ASSERT_EQ("\xef\xbb\xbf" "a" "\xc3\xa9" "\xf0\x9f\x98\x80" "b", std::string(out.begin(), out.end()));
+        ASSERT_EQ((vector<int64_t>{0, 0, 0, 2, 4, 4, 6, 6, 6, 6, 10}), offsets);
+    }
+}
+
+TEST(correctness, occurrence_list_round_trip)
+{
+    std::mt19937_64 rng(3);
+    vector<int64_t> positions;
+    int64_t position = 0;
+    for (int i = 0; i < 1000; i++) {
+        position += int64_t(rng() % 4 == 0 ? rng() % (int64_t(1) << 40) : rng() % 200);
+        positions.push_back(position);
+    }
+    occurrence_list list = occurrence_list::from(positions);
+    ASSERT_EQ(positions.size(), list.size());
+    ASSERT_EQ(positions, vector<int64_t>(list.begin(), list.end()));
+    for (size_t i : {0, 1, 127, 128, 129, 999}) {
+        ASSERT_EQ(positions[i], *list.from_index(i));
+    }
+    ASSERT_TRUE(list.from_index(1000) == list.end());
+}
+
+TEST(correctness, content_hash_is_xxh64)
+{
+    ASSERT_EQ(0xef46db3751d8e999ULL, content_hash("", 0));
+    ASSERT_EQ(0x44bc2cf5ad770999ULL, content_hash("abc", 3));
+    std::string text = "Nobody inspects the spammish repetition";
+    ASSERT_EQ(0xfbcea83c8a378bf1ULL, content_hash(text.data(), text.size()));
+    std::string bytes;
+    for (int i = 0; i < 768; i++) {
+        bytes.push_back(char(i % 256));
+    }
+    ASSERT_EQ(0x8e03c838c596036fULL, content_hash(bytes.data(), bytes.size()));
+    // fed in uneven pieces, as files are read
+    content_hasher hasher;
+    for (size_t i = 0, n = 1; i < bytes.size(); i += n, n = n * 3 % 41 + 1) {
+        hasher.update(bytes.data() + i, std::min(n, bytes.size() - i));
+    }
+    ASSERT_EQ(content_hash(bytes.data(), bytes.size()), hasher.digest());
+}
+
+TEST(correctness, bloom_filter_of_trigrams)
+{
+    std::mt19937 rng(3);
+    std::string text;
+    for (int i = 0; i < 20000; i++) {
+        text.push_back(char('a' + rng() % 26));
+    }
+    trigram_counter counter(1 << 20);
+    counter.reset();
+    ASSERT_TRUE(counter.feed(text.data(), text.size()));
+    double rate = 0.01;
+    bloom_shape shape = bloom_shape::for_trigrams(counter.size(), rate);
+    vector<uint64_t> words(shape.words());
+    file_trigrams filter = counter.finish_bloom(words.data(), shape);
+    for (size_t i = 0; i + 3 <= text.size(); i++) {
+        ASSERT_NE(0u, filter.count(make_trigram(text[i], text[i + 1], text[i + 2])));
+    }
+    // uppercase trigrams never occur in the text
+    int false_positives = 0, probes = 0;
+    for (char a = 'A'; a <= 'Z'; a++) {
+        for (char b = 'A'; b <= 'Z'; b++) {
+            for (char c = 'A'; c <= 'Z'; c++, probes++) {
+                false_positives += filter.count(make_trigram(a, b, c)) != 0;
+            }
+        }
+    }
+    ASSERT_LT(false_positives, probes * rate * 3);
+    ASSERT_TRUE(filter.contains_bytes("qz", 2) || text.find("qz") == std::string::npos);
+}
+
+TEST(correctness, short_files_keep_short_needles)
+{
+    trigram_counter counter(1 << 10);
+    counter.reset();
+    ASSERT_TRUE(counter.feed("ab", 2));
+    ASSERT_EQ(0u, counter.size());
+    file_trigrams counts = counter.finish(nullptr, nullptr);
+    ASSERT_TRUE(counts.contains_bytes("b", 1));
+    ASSERT_TRUE(counts.contains_bytes("ab", 2));
+    bloom_shape shape = bloom_shape::for_trigrams(0, 0.01);
+    vector<uint64_t> words(shape.words());
+    file_trigrams filter = counter.finish_bloom(words.data(), shape);
+    ASSERT_TRUE(filter.contains_bytes("b", 1));
+}
+
+TEST(correctness, stop_trigrams)
+{
+    trigram_frequencies frequencies(10);
+    trigram_counter counter(1000);
+    for (int i = 0; i < 10; i++) {
+        std::string text = "the cat " + std::to_string(i * 37) + (i < 5 ? " sat" : "");
+        counter.reset();
+        ASSERT_TRUE(counter.feed(text.data(), text.size()));
+        auto const& keys = counter.sorted_keys();
+        ASSERT_TRUE(std::is_sorted(keys.begin(), keys.end()));
+        ASSERT_TRUE(frequencies.stop_trigrams()->empty());
+        frequencies.add(keys.data(), keys.size());
+    }
+    trigram the = make_trigram('t', 'h', 'e');
+    trigram sat = make_trigram('s', 'a', 't');
+    ASSERT_EQ(10u, frequencies.files());
+    ASSERT_EQ(10u, frequencies.frequency(the));
+    ASSERT_EQ(5u, frequencies.frequency(sat));
+    auto stop = frequencies.stop_trigrams();
+    ASSERT_TRUE(std::binary_search(stop->begin(), stop->end(), the));
+    ASSERT_FALSE(std::binary_search(stop->begin(), stop->end(), sat));
+    ASSERT_EQ(10u, frequencies.most_common(1)[0].second);
+
+    // entries leave the stop trigrams out
+    vector<trigram> keys(counter.size_without(*stop));
+    vector<uint32_t> counts(keys.size());
+    file_trigrams kept = counter.finish(keys.data(), counts.data(), *stop);
+    ASSERT_EQ(keys.size(), size_t(kept.size));
+    ASSERT_EQ(0u, kept.count(the));
+    ASSERT_EQ(1u, kept.count(make_trigram('3', '3', '3')));
+}
+
+TEST(correctness, fm_index_locates_like_a_scan)
+{
+    std::mt19937 rng(4);
+    for (int round = 0; round < 20; round++) {
+        // few letters, so that substrings repeat a lot
+        vector<std::string> documents(1 + rng() % 12);
+        fm_index::builder builder;
+        for (auto& document : documents) {
+            size_t size = rng() % 300;
+            for (size_t i = 0; i < size; i++) {
+                document.push_back(rng() % 8 == 0 ? char(0) : char('a' + rng() % (1 + round % 4)));
+            }
+            builder.add(document.data(), document.size());
+        }
+        fm_index index = builder.build();
+        ASSERT_EQ(documents.size(), index.documents());
+        for (int query = 0; query < 30; query++) {
+            std::string needle;
+            for (size_t i = 0, n = 1 + rng() % 4; i < n; i++) {
+                needle.push_back(char('a' + rng() % (1 + round % 4)));
+            }
+            vector<fm_index::hit> expected;
+            for (uint32_t d = 0; d < documents.size(); d++) {
+                for (size_t p = documents[d].find(needle); p != std::string::npos; p = documents[d].find(needle, p + 1)) {
+                    expected.push_back(fm_index::hit{d, uint32_t(p)});
+                }
+            }
+            vector<fm_index::hit> found;
+            index.locate(needle.data(), needle.size(), found);
+            std::sort(found.begin(), found.end());
+            ASSERT_EQ(expected.size(), found.size());
+            for (size_t i = 0; i < found.size(); i++) {
+                ASSERT_EQ(expected[i].document, found[i].document);
+                ASSERT_EQ(expected[i].offset, found[i].offset);
+            }
+            ASSERT_GE(index.count(needle.data(), needle.size()), found.size());
+            if (!found.empty()) {
+                vector<fm_index::hit> cancelled;
+                ASSERT_FALSE(index.locate(needle.data(), needle.size(), cancelled, [] { return true; }));
+                ASSERT_TRUE(cancelled.empty());
+            }
+        }
+    }
+}
+
+TEST(correctness, approximate_matches_are_within_the_distance)
+{
+    // edit distance of the needle to the best substring ending at every position of the text,
+    // or to the whole text if anchored
+    auto distances = [](std::string const& needle, std::string const& text, bool anchored) {
+        vector<unsigned> column(needle.size() + 1), ends;
+        for (size_t i = 0; i <= needle.size(); i++) column[i] = unsigned(i);
+        for (size_t j = 0; j < text.size(); j++) {
+            unsigned diagonal = column[0];
+            column[0] = anchored ? unsigned(j + 1) : 0;
+            for (size_t i = 1; i <= needle.size(); i++) {
+                unsigned above = column[i];
+                column[i] = std::min(std::min(column[i], column[i - 1]) + 1, diagonal + (needle[i - 1] != text[j]));
+                diagonal = above;
+            }
+            ends.push_back(column[needle.size()]);
+        }
+        return ends;
+    };
+    std::mt19937 rng(5);
+    for (int round = 0; round < 500; round++) {
+        std::string needle, text;
+        for (size_t i = 0, n = 2 + rng() % 10; i < n; i++) needle.push_back(char('a' + rng() % 3));
+        for (size_t i = 0, n = rng() % 200; i < n; i++) text.push_back(char('a' + rng() % 3));
+        unsigned k = 1 + rng() % (needle.size() - 1);
+        approximate_matcher matcher(needle, k);
+        approximate_matcher::stream stream(matcher);
+        vector<approximate_matcher::match> found;
+        for (size_t i = 0; i < text.size();) {
+            size_t n = std::min<size_t>(1 + rng() % 16, text.size() - i);
+            stream.feed(text.data() + i, n, found);
+            i += n;
+        }
+        stream.finish(found);
+
+        auto ends = distances(needle, text, false);
+        bool any = std::any_of(ends.begin(), ends.end(), [k](unsigned d) { return d <= k; });
+        ASSERT_EQ(any, !found.empty());
+        for (size_t i = 0; i < found.size(); i++) {
+            ASSERT_LE(found[i].distance, k);
+            if (i > 0) {
+                ASSERT_LT(found[i - 1].position, found[i].position);
+            }
+            // the match aligns with the needle from its start to an end of that distance
+            auto from_start = distances(needle, text.substr(size_t(found[i].position)), true);
+            bool aligned = false;
+            for (size_t length = 1; length <= from_start.size(); length++) {
+                aligned |= from_start[length - 1] == found[i].distance &&
+                           ends[size_t(found[i].position) + length - 1] == found[i].distance;
+            }
+            ASSERT_TRUE(aligned);
+        }
+    }
+}
+
+TEST(correctness, word_finder_and_token_postings)
+{
+    std::mt19937 rng(6);
+    const char letters[] = "ab_ .";
+    for (int round = 0; round < 2000; round++) {
+        std::string needle, text;
+        for (size_t i = 0, n = 1 + rng() % 4; i < n; i++) needle.push_back(letters[rng() % 5]);
+        for (size_t i = 0, n = rng() % 100; i < n; i++) text.push_back(letters[rng() % 5]);
+        tokenizer kind = round % 2 ? tokenizer::words : tokenizer::identifiers;
+        bool whole = round % 4 < 2;
+        word_finder finder(needle, kind, whole);
+        word_finder::stream stream(finder);
+        vector<int64_t> found;
+        for (size_t i = 0; i < text.size();) {
+            size_t n = std::min<size_t>(1 + rng() % 8, text.size() - i);
+            stream.feed(text.data() + i, n, found);
+            i += n;
+        }
+        stream.finish(found);
+
+        vector<int64_t> expected;
+        auto word = [kind](char c) { return is_token_byte(kind, (unsigned char) c); };
+        for (size_t p = text.find(needle); p != std::string::npos; p = text.find(needle, p + 1)) {
+            size_t end = p + needle.size();
+            bool starts = !word(needle.front()) || p == 0 || !word(text[p - 1]);
+            bool ends = !whole || !word(needle.back()) || end == text.size() || !word(text[end]);
+            if (starts && ends) {
+                expected.push_back(int64_t(p));
+            }
+        }
+        ASSERT_EQ(expected, found);
+
+        // the postings hold the file for a needle that is a token of the text, or starts one
+        token_collector& tokens = token_collector::local(kind);
+        tokens.feed(text.data(), text.size());
+        token_postings postings;
+        postings.add(nullptr, tokens.finish());
+        if (std::all_of(needle.begin(), needle.end(), word)) {
+            ASSERT_EQ(!expected.empty(), !postings.find(needle, !whole).empty());
+        }
+    }
+}
+
+TEST(correctness, fm_index_serves_every_page)
+{
+    QTemporaryDir dir;
+    ASSERT_TRUE(dir.isValid());
+    for (int i = 0; i < 20; i++) {
+        QFile f(dir.filePath(QString("file%1.txt").arg(i)));
+        ASSERT_TRUE(f.open(QFile::WriteOnly));
+        f.write("a needle and another needle\n");
+    }
+    scanner s;
+    s.set_engine(index_engine::fm_index);
+    s.scan(QDir(dir.path()), s.new_scan_token());
+
+    quint64 results = 0;
+    quint64 stopped = 0;
+    QObject::connect(&s, &scanner::update_results, [&results](quint64, const QString&, const occurrence_list& found) {
+        results += found.matches();
+    });
+    QObject::connect(&s, &scanner::search_truncated, [&stopped](quint64 epoch, quint64) {
+        stopped = epoch;
+    });
+    query_options query;
+    query.max_results = 10;
+    cancel_token first = s.new_query_token();
+    s.search("needle", query, first);
+    ASSERT_EQ(first.epoch(), stopped);
+    while (stopped != 0) {
+        quint64 page = stopped;
+        stopped = 0;
+        s.search_next(page, s.new_query_token());
+        // the FM-index answers the later pages too, without reading the files
+        ASSERT_EQ(0u, s.stats().bytes_verified);
+    }
+    ASSERT_EQ(40u, results);
+}
+
+namespace {
+    void put16(std::string& out, uint32_t v) {
+        out += char(v & 0xFF);
+        out += char((v >> 8) & 0xFF);
+    }
+
+    void put32(std::string& out, uint32_t v) {
+        put16(out, v & 0xFFFF);
+        put16(out, v >> 16);
+    }
+
+    void put64(std::string& out, uint64_t v) {
+        put32(out, uint32_t(v));
+        put32(out, uint32_t(v >> 32));
+    }
+
+    // raw deflate for zip members with negative window bits, gzip framing with 16 + 15
+    std::string deflated(std::string const& text, int window_bits) {
+        z_stream z;
+        std::memset(&z, 0, sizeof(z));
+        deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, window_bits, 8, Z_DEFAULT_STRATEGY);
+        std::string out(deflateBound(&z, (uLong) text.size()) + 32, '\0');
+        z.next_in = (Bytef*) text.data();
+        z.avail_in = (uInt) text.size();
+        z.next_out = (Bytef*) &out[0];
+        z.avail_out = (uInt) out.size();
+        deflate(&z, Z_FINISH);
+        out.resize(z.total_out);
+        deflateEnd(&z);
+        return out;
+    }
+
+    // A zip of (name, text, deflated) members.
+    std::string zip_of(vector<std::tuple<std::string, std::string, bool>> const& members) {
+        std::string local, central;
+        for (auto& m : members) {
+            std::string const& name = std::get<0>(m);
+            std::string const& text = std::get<1>(m);
+            uint16_t method = std::get<2>(m) ? 8 : 0;
+            std::string data = method ? deflated(text, -MAX_WBITS) : text;
+            auto crc = (uint32_t) crc32(0, (const Bytef*) text.data(), (uInt) text.size());
+            auto offset = (uint32_t) local.size();
+            put32(local, 0x04034b50);
+            put16(local, 20);
+            put16(local, 0);
+            put16(local, method);
+            put32(local, 0);
+            put32(local, crc);
+            put32(local, (uint32_t) data.size());
+            put32(local, (uint32_t) text.size());
+            put16(local, (uint32_t) name.size());
+            put16(local, 0);
+            local += name + data;
+            put32(central, 0x02014b50);
+            put16(central, 20);
+            put16(central, 20);
+            put16(central, 0);
+            put16(central, method);
+            put32(central, 0);
+            put32(central, crc);
+            put32(central, (uint32_t) data.size());
+            put32(central, (uint32_t) text.size());
+            put16(central, (uint32_t) name.size());
+            put32(central, 0);
+            put32(central, 0);
+            put32(central, 0);
+            put32(central, offset);
+            central += name;
+        }
+        std::string zip = local + central;
+        put32(zip, 0x06054b50);
+        put32(zip, 0);
+        put16(zip, (uint32_t) members.size());
+        put16(zip, (uint32_t) members.size());
+        put32(zip, (uint32_t) central.size());
+        put32(zip, (uint32_t) local.size());
+        put16(zip, 0);
+        return zip;
+    }
+
+    std::string write_file(QTemporaryDir const& dir, const char* name, std::string const& content) {
+        QString path = dir.filePath(name);
+        QFile f(path);
+        f.open(QFile::WriteOnly);
+        f.write(content.data(), (qint64) content.size());
+        return QFile::encodeName(path).toStdString();
+    }
+
+    // The member's text, or the reader's error.
+    std::string read_member(std::string const& path, std::string const& member) {
+        archive_reader archive(path);
+        std::string text;
+        if (!archive.open() || !archive.stream(member, [&text](const char* data, size_t size) {
+            text.append(data, size);
+            return true;
+        })) {
+            return "error: " + archive.error();
+        }
+        return text;
+    }
+}
+
+TEST(correctness, archive_members_are_searched_and_broken_archives_rejected)
+{
+    QTemporaryDir dir;
+    ASSERT_TRUE(dir.isValid());
+    std::string deflated_text;
+    for (int i = 0; i < 1000; i++) {
+        deflated_text += "line " + std::to_string(i) + (i == 700 ? " with a needle\n" : "\n");
+    }
+    std::string zip = zip_of({std::make_tuple("src/stored.txt", "a stored needle", false),
+                              std::make_tuple("deflated.txt", deflated_text, true)});
+    std::string zip_path = write_file(dir, "archive.zip", zip);
+    std::string gz_path = write_file(dir, "notes.txt.gz", deflated("gzipped needle\n", 16 + MAX_WBITS));
+
+    ASSERT_EQ("a stored needle", read_member(zip_path, "src/stored.txt"));
+    ASSERT_EQ(deflated_text, read_member(zip_path, "deflated.txt"));
+    ASSERT_EQ("gzipped needle\n", read_member(gz_path, "notes.txt"));
+    ASSERT_EQ("error: No such member missing.txt", read_member(zip_path, "missing.txt"));
+
+    std::string archive, member;
+    ASSERT_EQ(zip_path + "!/src/stored.txt", archive_reader::virtual_path(zip_path, "src/stored.txt"));
+    ASSERT_TRUE(archive_reader::split(zip_path + "!/src/stored.txt", archive, member));
+    ASSERT_EQ(zip_path, archive);
+    ASSERT_EQ("src/stored.txt", member);
+    ASSERT_FALSE(archive_reader::split(zip_path + "/src/stored.txt", archive, member));
+
+    // the directory is read once per version of the archive, and dropped with its root
+    archive_cache cache;
+    archive_reader cached(zip_path);
+    ASSERT_TRUE(cached.open(&cache));
+    struct stat st;
+    ASSERT_EQ(0, stat(zip_path.c_str(), &st));
+    int64_t mtime_ns = int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+    auto directory = cache.find_directory(zip_path, st.st_size, mtime_ns);
+    ASSERT_TRUE(directory != nullptr);
+    ASSERT_EQ(2u, directory->entries.size());
+    ASSERT_TRUE(cache.find_directory(zip_path, st.st_size + 1, mtime_ns) == nullptr);
+    cache.forget_under(QFile::encodeName(dir.path()).toStdString(), {zip_path});
+    ASSERT_TRUE(cache.find_directory(zip_path, st.st_size, mtime_ns) != nullptr);
+    cache.forget_under(QFile::encodeName(dir.path()).toStdString());
+    ASSERT_TRUE(cache.find_directory(zip_path, st.st_size, mtime_ns) == nullptr);
+
+    // a truncated end record, a directory past the end, and zip64 values whose sum wraps
+    std::string truncated = write_file(dir, "truncated.zip", zip.substr(0, zip.size() - 10));
+    ASSERT_EQ("error: Not a zip archive", read_member(truncated, "deflated.txt"));
+    std::string past_end = zip;
+    past_end[past_end.size() - 6] = char(0xF0);
+    past_end[past_end.size() - 5] = char(0xFF);
+    past_end[past_end.size() - 4] = char(0xFF);
+    past_end[past_end.size() - 3] = char(0xFF);
+    std::string past_end_path = write_file(dir, "past_end.zip", past_end);
+    ASSERT_EQ("error: Broken zip directory", read_member(past_end_path, "deflated.txt"));
+    std::string zip64;
+    put32(zip64, 0x06064b50);
+    zip64.resize(32, '\0');
+    put64(zip64, 1);
+    put64(zip64, uint64_t(1) << 63);
+    put64(zip64, (uint64_t(1) << 63) + 4);
+    put32(zip64, 0x07064b50);
+    put32(zip64, 0);
+    put64(zip64, 0);
+    put32(zip64, 1);
+    put32(zip64, 0x06054b50);
+    put32(zip64, 0);
+    put16(zip64, 0xFFFF);
+    put16(zip64, 0xFFFF);
+    put32(zip64, 16);
+    put32(zip64, 0xFFFFFFFF);
+    put16(zip64, 0);
+    std::string zip64_path = write_file(dir, "wrapping.zip", zip64);
+    ASSERT_EQ("error: Broken zip directory", read_member(zip64_path, "deflated.txt"));
+
+    // members are found under <archive>!/<member>, broken archives are reported
+    scanner s;
+    std::mutex m;
+    std::set<QString> found;
+    QStringList errors;
+    QObject::connect(&s, &scanner::exception_occurred, [&](const QString& message) {
+        std::lock_guard<std::mutex> lock(m);
+        errors.append(message);
+    });
+    QObject::connect(&s, &scanner::update_results, [&](quint64, const QString& name, const occurrence_list&) {
+        std::lock_guard<std::mutex> lock(m);
+        found.insert(name);
+    });
+    s.scan(QDir(dir.path()), s.new_scan_token());
+    ASSERT_EQ(3, errors.size());
+    s.search("needle", query_options(), s.new_query_token());
+    std::set<QString> expected{"archive.zip!/src/stored.txt", "archive.zip!/deflated.txt", "notes.txt.gz!/notes.txt"};
+    ASSERT_EQ(expected, found);
+}
+
+TEST(performance, short_needle_kernels_vs_KMP)
+{
+    std::mt19937 rng(2);
+    std::string text(32 << 20, 'a');
+    for (auto &c : text) c = char('a' + rng() % 26);
+    for (size_t length : {4, 8, 16, 32}) {
+        matcher m(text.substr(text.size() / 2, length));
+        vector<int64_t> specialized, kmp;
+        auto start = std::chrono::steady_clock::now();
+        m.find_all(text.data(), text.size(), 0, specialized);
+        auto middle = std::chrono::steady_clock::now();
+        kmp_find(m, text.data(), text.size(), 0, kmp);
+        auto end = std::chrono::steady_clock::now();
+        ASSERT_EQ(kmp, specialized);
+        std::cout << "needle of " << length << " bytes: "
+                  << std::chrono::duration<double, std::milli>(middle - start).count() << " ms vs KMP "
+                  << std::chrono::duration<double, std::milli>(end - middle).count() << " ms" << std::endl;
+    }
+}
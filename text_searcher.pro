@@ -4,7 +4,7 @@
 #
 #-------------------------------------------------
 
-QT       += core gui
+QT       += core gui network
 
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
@@ -24,15 +24,65 @@ DEFINES += QT_DEPRECATED_WARNINGS
 
 CONFIG += c++11
 
+LIBS += -lz
+
 SOURCES += \
         main.cpp \
         mainwindow.cpp \
         scanner.cpp \
+        arena.cpp \
+        trigrams.cpp \
+        trigram_frequencies.cpp \
+        fm_index.cpp \
+        approximate_matcher.cpp \
+        token_index.cpp \
+        encoding.cpp \
+        matcher.cpp \
+        trigram_index.cpp \
+        dir_walker.cpp \
+        path_filter.cpp \
+        progress.cpp \
+        occurrence_list.cpp \
+        content_hash.cpp \
+        batch_reader.cpp \
+        archive.cpp \
+        reclaimer.cpp \
+        stats.cpp \
+        tracer.cpp \
+        daemon_protocol.cpp \
+        search_daemon.cpp \
+        search_client.cpp \
+        command_line.cpp \
         my_file.cpp
 
 HEADERS += \
         mainwindow.h \
         scanner.h \
+        arena.h \
+        trigrams.h \
+        trigram_frequencies.h \
+        fm_index.h \
+        approximate_matcher.h \
+        token_index.h \
+        encoding.h \
+        matcher.h \
+        trigram_index.h \
+        dir_walker.h \
+        path_filter.h \
+        progress.h \
+        occurrence_list.h \
+        content_hash.h \
+        batch_reader.h \
+        archive.h \
+        reclaimer.h \
+        stats.h \
+        tracer.h \
+        daemon_protocol.h \
+        search_daemon.h \
+        search_client.h \
+        command_line.h \
+        cancel_token.h \
+        query.h \
         my_file.h
 
 FORMS += \
@@ -0,0 +1,145 @@
+#include "token_index.h"
+#include <algorithm>
+
+const size_t token_collector::MAX_TOKEN;
+const size_t token_postings::SHARDS;
+
+bool is_token_byte(tokenizer kind, unsigned char c) {
+    if (c >= 0x80 || (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')) {
+        return true;
+    }
+    return c == '_' && kind != tokenizer::words;
+}
+
+token_collector& token_collector::local(tokenizer kind) {
+    static thread_local token_collector collector;
+    collector.kind = kind;
+    collector.current.clear();
+    collector.seen.clear();
+    collector.sorted.clear();
+    return collector;
+}
+
+void token_collector::feed(const char* data, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        auto c = (unsigned char) data[i];
+        if (!is_token_byte(kind, c)) {
+            end_token();
+        } else if (current.size() < MAX_TOKEN) {
+            current.push_back(char(c));
+        }
+    }
+}
+
+void token_collector::end_token() {
+    if (!current.empty()) {
+        seen.insert(current);
+        current.clear();
+    }
+}
+
+std::vector<std::string> const& token_collector::finish() {
+    end_token();
+    sorted.assign(seen.begin(), seen.end());
+    std::sort(sorted.begin(), sorted.end());
+    return sorted;
+}
+
+void token_postings::add(const file_entry* entry, std::vector<std::string> const& tokens) {
+    // sorted tokens come shard by shard
+    for (size_t i = 0; i < tokens.size();) {
+        auto first = (unsigned char) tokens[i][0];
+        shard& s = shards[first];
+        std::lock_guard<std::mutex> lock(s.mutex);
+        for (; i < tokens.size() && (unsigned char) tokens[i][0] == first; i++) {
+            s.files[tokens[i]].push_back(entry);
+        }
+    }
+}
+
+std::vector<const file_entry*> token_postings::find(std::string const& token, bool prefix) const {
+    std::vector<const file_entry*> result;
+    if (token.empty()) {
+        return result;
+    }
+    shard const& s = shards[(unsigned char) token[0]];
+    std::lock_guard<std::mutex> lock(s.mutex);
+    // a token of the longest length stands for every longer one it starts
+    if (token.size() >= token_collector::MAX_TOKEN) {
+        auto it = s.files.find(token.substr(0, token_collector::MAX_TOKEN));
+        if (it != s.files.end()) {
+            result = it->second;
+        }
+        return result;
+    }
+    if (!prefix) {
+        auto it = s.files.find(token);
+        if (it != s.files.end()) {
+            result = it->second;
+        }
+        return result;
+    }
+    for (auto it = s.files.lower_bound(token); it != s.files.end() && it->first.compare(0, token.size(), token) == 0; it++) {
+        result.insert(result.end(), it->second.begin(), it->second.end());
+    }
+    return result;
+}
+
+size_t token_postings::size() const {
+    size_t total = 0;
+    for (shard const& s : shards) {
+        std::lock_guard<std::mutex> lock(s.mutex);
+        total += s.files.size();
+    }
+    return total;
+}
+
+word_finder::word_finder(std::string needle, tokenizer kind, bool whole)
+        : needle(std::move(needle)), kind(kind), whole(whole) {}
+
+size_t word_finder::length() const {
+    return needle.length();
+}
+
+word_finder::stream::stream(word_finder const& f) : f(f) {}
+
+void word_finder::stream::feed(const char* data, size_t size, std::vector<int64_t>& out) {
+    window.append(data, size);
+    decide(false, out);
+}
+
+void word_finder::stream::finish(std::vector<int64_t>& out) {
+    decide(true, out);
+}
+
+void word_finder::stream::decide(bool at_end, std::vector<int64_t>& out) {
+    std::string const& bytes = f.needle.bytes();
+    size_t n = bytes.size();
+    bool needs_start = is_token_byte(f.kind, (unsigned char) bytes.front());
+    bool needs_end = f.whole && is_token_byte(f.kind, (unsigned char) bytes.back());
+    auto from = size_t(undecided - window_start);
+    found.clear();
+    f.needle.find_all(window.data() + from, window.size() - from, undecided, found);
+    for (int64_t position : found) {
+        auto i = size_t(position - window_start);
+        bool last = i + n == window.size();
+        // the byte after it is still to come
+        if (last && !at_end) {
+            break;
+        }
+        if (needs_start && i > 0 && is_token_byte(f.kind, (unsigned char) window[i - 1])) {
+            continue;
+        }
+        if (needs_end && !last && is_token_byte(f.kind, (unsigned char) window[i + n])) {
+            continue;
+        }
+        out.push_back(position);
+    }
+    if (window.size() >= n) {
+        undecided = std::max(undecided, window_start + int64_t(window.size() - n));
+    }
+    // keeps the byte before the first undecided start
+    auto keep_from = size_t(std::max<int64_t>(undecided - 1 - window_start, 0));
+    window.erase(0, keep_from);
+    window_start += int64_t(keep_from);
+}
@@ -0,0 +1,102 @@
+#ifndef TOKEN_INDEX_H
+#define TOKEN_INDEX_H
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <vector>
+#include "matcher.h"
+
+struct file_entry;
+
+// What a scan indexes as tokens besides the trigrams, and where words end for
+// whole-word and prefix queries.
+enum class tokenizer {
+    none,         // no tokens; queries split words like identifiers
+    identifiers,  // runs of letters, digits and underscores
+    words         // runs of letters and digits
+};
+
+// Whether a byte belongs to a token. Bytes of non-ASCII UTF-8 characters count as letters.
+bool is_token_byte(tokenizer kind, unsigned char c);
+
+// Distinct tokens of one UTF-8 text fed in chunks.
+class token_collector {
+public:
+    // longer tokens are kept cut to this length, which queries for them look up instead
+    static const size_t MAX_TOKEN = 64;
+
+    // The collector of the calling thread, reset for a text split by kind.
+    static token_collector& local(tokenizer kind);
+
+    void feed(const char* data, size_t size);
+    // The distinct tokens in ascending order, valid until the next reset.
+    std::vector<std::string> const& finish();
+
+private:
+    tokenizer kind = tokenizer::identifiers;
+    std::string current;
+    std::unordered_set<std::string> seen;
+    std::vector<std::string> sorted;
+
+    void end_token();
+};
+
+// Files of every token of an index generation. Shards by first byte keep the
+// tokens of a prefix together and let the threads of a scan add at once.
+class token_postings {
+public:
+    void add(const file_entry* entry, std::vector<std::string> const& tokens);
+    // Files holding the token, or with prefix set a token starting with it, in no particular order.
+    std::vector<const file_entry*> find(std::string const& token, bool prefix) const;
+    // Distinct tokens.
+    size_t size() const;
+
+private:
+    static const size_t SHARDS = 256;
+
+    struct shard {
+        mutable std::mutex mutex;
+        std::map<std::string, std::vector<const file_entry*>> files;
+    };
+    shard shards[SHARDS];
+};
+
+// Occurrences of a needle that start a word, and with whole set also end one,
+// in a text fed in chunks. A side of the needle that is not a token byte needs
+// no boundary there.
+class word_finder {
+public:
+    word_finder(std::string needle, tokenizer kind, bool whole);
+
+    size_t length() const;
+
+    class stream {
+    public:
+        explicit stream(word_finder const& f);
+        // Appends the occurrences decided so far, those whose next byte has been seen.
+        void feed(const char* data, size_t size, std::vector<int64_t>& out);
+        // Appends the occurrence ending with the last byte, if there is one.
+        void finish(std::vector<int64_t>& out);
+
+    private:
+        word_finder const& f;
+        // text from the byte before the first start not decided yet
+        std::string window;
+        int64_t window_start = 0;
+        int64_t undecided = 0;
+        std::vector<int64_t> found;
+
+        void decide(bool at_end, std::vector<int64_t>& out);
+    };
+
+private:
+    matcher needle;
+    tokenizer kind;
+    bool whole;
+};
+
+#endif // TOKEN_INDEX_H
@@ -0,0 +1,110 @@
+#include "tracer.h"
+#include <QFile>
+
+namespace {
+    std::atomic<uint64_t> next_session_id(1);
+
+    struct local_buffer_cache {
+        uint64_t session_id = 0;
+        void* buffer = nullptr;
+    };
+    thread_local local_buffer_cache cache;
+
+    void append_json_string(QByteArray& out, QByteArray const& s) {
+        out += '"';
+        for (char c : s) {
+            switch (c) {
+                case '"': out += "\\\""; break;
+                case '\\': out += "\\\\"; break;
+                case '\n': out += "\\n"; break;
+                case '\r': out += "\\r"; break;
+                case '\t': out += "\\t"; break;
+                default:
+                    if ((unsigned char) c < 0x20) {
+                        out += "\\u00";
+                        out += QByteArray::number((unsigned char) c, 16).rightJustified(2, '0');
+                    } else {
+                        out += c;
+                    }
+            }
+        }
+        out += '"';
+    }
+}
+
+trace_session::trace_session(QString name)
+        : session_name(std::move(name)), id(next_session_id++), start(std::chrono::steady_clock::now()) {}
+
+qint64 trace_session::now_us() const {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+QString const& trace_session::name() const {
+    return session_name;
+}
+
+trace_session::thread_buffer& trace_session::local() {
+    if (cache.session_id == id) {
+        return *static_cast<thread_buffer*>(cache.buffer);
+    }
+    std::lock_guard<std::mutex> lock(m);
+    auto& b = buffers[std::this_thread::get_id()];
+    if (!b) {
+        b.reset(new thread_buffer{int(buffers.size()), {}});
+    }
+    cache.session_id = id;
+    cache.buffer = b.get();
+    return *b;
+}
+
+void trace_session::record(const char* name, const char* category, qint64 start_us, qint64 duration_us,
+                           QByteArray const& detail) {
+    local().events.push_back(event{name, category, start_us, duration_us, detail});
+}
+
+bool trace_session::write(QString const& path) const {
+    QFile f(path);
+    if (!f.open(QFile::WriteOnly | QFile::Truncate)) {
+        return false;
+    }
+    QByteArray out;
+    out += "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    out += "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":";
+    append_json_string(out, session_name.toUtf8());
+    out += "}}";
+    for (auto& b : buffers) {
+        out += ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" + QByteArray::number(b.second->tid)
+               + ",\"args\":{\"name\":\"thread " + QByteArray::number(b.second->tid) + "\"}}";
+        for (auto& e : b.second->events) {
+            out += ",\n{\"name\":";
+            append_json_string(out, e.name);
+            out += ",\"cat\":";
+            append_json_string(out, e.category);
+            out += ",\"ph\":\"X\",\"ts\":" + QByteArray::number(e.start_us)
+                   + ",\"dur\":" + QByteArray::number(e.duration_us)
+                   + ",\"pid\":1,\"tid\":" + QByteArray::number(b.second->tid);
+            if (!e.detail.isEmpty()) {
+                out += ",\"args\":{\"detail\":";
+                append_json_string(out, e.detail);
+                out += "}";
+            }
+            out += "}";
+            if (out.size() > (1 << 20)) {
+                f.write(out);
+                out.clear();
+            }
+        }
+    }
+    out += "\n]}\n";
+    return f.write(out) == out.size();
+}
+
+trace_span::trace_span(trace_session* session, const char* name, const char* category, QByteArray detail)
+        : session(session), name(name), category(category), detail(std::move(detail)),
+          start_us(session ? session->now_us() : 0) {}
+
+trace_span::~trace_span() {
+    if (session) {
+        session->record(name, category, start_us, session->now_us() - start_us, detail);
+    }
+}
@@ -0,0 +1,72 @@
+#ifndef TRACER_H
+#define TRACER_H
+
+#include <QByteArray>
+#include <QString>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+using std::vector;
+
+// Spans of one scan or search run, written out in the Chrome trace-event
+// format (chrome://tracing, ui.perfetto.dev). Every thread appends to its own
+// buffer, so recording takes no locks after the first span on a thread.
+class trace_session {
+public:
+    explicit trace_session(QString name);
+    trace_session(const trace_session&) = delete;
+    trace_session& operator=(const trace_session&) = delete;
+
+    qint64 now_us() const;
+    void record(const char* name, const char* category, qint64 start_us, qint64 duration_us,
+                QByteArray const& detail = QByteArray());
+    // Must only be called when no other thread records into the session.
+    bool write(QString const& path) const;
+    QString const& name() const;
+
+private:
+    struct event {
+        const char* name;
+        const char* category;
+        qint64 start_us;
+        qint64 duration_us;
+        QByteArray detail;
+    };
+    struct thread_buffer {
+        int tid;
+        vector<event> events;
+    };
+
+    QString session_name;
+    uint64_t id;
+    std::chrono::steady_clock::time_point start;
+    std::mutex m;
+    std::unordered_map<std::thread::id, std::unique_ptr<thread_buffer>> buffers;
+
+    thread_buffer& local();
+};
+
+// Records the time between construction and destruction. Does nothing when
+// the session is null, which is the case when tracing is turned off.
+class trace_span {
+public:
+    trace_span(trace_session* session, const char* name, const char* category,
+               QByteArray detail = QByteArray());
+    ~trace_span();
+    trace_span(const trace_span&) = delete;
+    trace_span& operator=(const trace_span&) = delete;
+
+private:
+    trace_session* session;
+    const char* name;
+    const char* category;
+    QByteArray detail;
+    qint64 start_us;
+};
+
+#endif // TRACER_H
@@ -0,0 +1,73 @@
+#include "trigram_frequencies.h"
+#include <algorithm>
+
+const uint64_t trigram_frequencies::SAMPLE_FILES;
+const double trigram_frequencies::STOP_SHARE = 0.9;
+const size_t trigram_frequencies::SHARDS;
+
+trigram_frequencies::trigram_frequencies(uint64_t sample_files)
+        : sample_files(sample_files), stop(std::make_shared<const std::vector<trigram>>()) {}
+
+size_t trigram_frequencies::shard_of(trigram t) {
+    return (t >> 18) & (SHARDS - 1);
+}
+
+void trigram_frequencies::add(const trigram* keys, size_t n) {
+    for (size_t i = 0; i < n;) {
+        shard& s = shards[shard_of(keys[i])];
+        std::lock_guard<std::mutex> lock(s.mutex);
+        for (size_t first = shard_of(keys[i]); i < n && shard_of(keys[i]) == first; i++) {
+            s.counts[keys[i]]++;
+        }
+    }
+    // the file that completes the sample picks the stop trigrams, files still being counted
+    // by other threads at that moment may be left out
+    if (++counted == sample_files) {
+        choose_stop_trigrams();
+    }
+}
+
+uint64_t trigram_frequencies::files() const {
+    return counted.load();
+}
+
+uint32_t trigram_frequencies::frequency(trigram t) const {
+    shard const& s = shards[shard_of(t)];
+    std::lock_guard<std::mutex> lock(s.mutex);
+    auto it = s.counts.find(t);
+    return it == s.counts.end() ? 0 : it->second;
+}
+
+std::vector<std::pair<trigram, uint32_t>> trigram_frequencies::most_common(size_t n) const {
+    std::vector<std::pair<trigram, uint32_t>> result;
+    for (shard const& s : shards) {
+        std::lock_guard<std::mutex> lock(s.mutex);
+        result.insert(result.end(), s.counts.begin(), s.counts.end());
+    }
+    auto by_frequency = [](std::pair<trigram, uint32_t> const& a, std::pair<trigram, uint32_t> const& b) {
+        return a.second != b.second ? a.second > b.second : a.first < b.first;
+    };
+    n = std::min(n, result.size());
+    std::partial_sort(result.begin(), result.begin() + n, result.end(), by_frequency);
+    result.resize(n);
+    return result;
+}
+
+std::shared_ptr<const std::vector<trigram>> trigram_frequencies::stop_trigrams() const {
+    return std::atomic_load(&stop);
+}
+
+void trigram_frequencies::choose_stop_trigrams() {
+    auto minimum = uint32_t(STOP_SHARE * sample_files);
+    auto chosen = std::make_shared<std::vector<trigram>>();
+    for (shard const& s : shards) {
+        std::lock_guard<std::mutex> lock(s.mutex);
+        for (auto const& count : s.counts) {
+            if (count.second >= minimum) {
+                chosen->push_back(count.first);
+            }
+        }
+    }
+    std::sort(chosen->begin(), chosen->end());
+    std::atomic_store(&stop, std::shared_ptr<const std::vector<trigram>>(chosen));
+}
@@ -0,0 +1,52 @@
+#ifndef TRIGRAM_FREQUENCIES_H
+#define TRIGRAM_FREQUENCIES_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "trigrams.h"
+
+// Document frequencies of the trigrams of one index generation: in how many
+// files each of them occurs. Once a sample of files has been counted, the
+// trigrams found in nearly all of them become stop trigrams. They filter out
+// almost nothing, so entries made after that leave them out and queries skip them.
+class trigram_frequencies {
+public:
+    static const uint64_t SAMPLE_FILES = 1000;
+    // share of the sampled files a stop trigram occurs in
+    static const double STOP_SHARE;
+
+    explicit trigram_frequencies(uint64_t sample_files = SAMPLE_FILES);
+
+    // Counts one file from its distinct trigrams in ascending order.
+    void add(const trigram* keys, size_t n);
+    uint64_t files() const;
+    uint32_t frequency(trigram t) const;
+    // The n trigrams found in most files, the most common first.
+    std::vector<std::pair<trigram, uint32_t>> most_common(size_t n) const;
+    // Sorted, empty until the sample is complete and never changed after that.
+    std::shared_ptr<const std::vector<trigram>> stop_trigrams() const;
+
+private:
+    // by the first 6 bits of a trigram, so the keys of a file fall into each one in a single run
+    static const size_t SHARDS = 64;
+
+    struct shard {
+        mutable std::mutex mutex;
+        std::unordered_map<trigram, uint32_t> counts;
+    };
+
+    uint64_t sample_files;
+    shard shards[SHARDS];
+    std::atomic<uint64_t> counted{0};
+    std::shared_ptr<const std::vector<trigram>> stop;
+
+    static size_t shard_of(trigram t);
+    void choose_stop_trigrams();
+};
+
+#endif // TRIGRAM_FREQUENCIES_H
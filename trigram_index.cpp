@@ -0,0 +1,327 @@
+#include "trigram_index.h"
+#include <algorithm>
+
+index_generation::index_generation(bool huge_pages) : arenas(huge_pages) {}
+
+index_generation::~index_generation() {
+    for (auto& slot : file_slots) {
+        const file_entry* entry = slot.entry.load();
+        if (entry && entry->heap_allocated) {
+            delete[] reinterpret_cast<const char*>(entry);
+        }
+    }
+}
+
+size_t index_snapshot::size() const {
+    return files;
+}
+
+QString const& index_snapshot::root() const {
+    return root_path;
+}
+
+bool index_snapshot::complete() const {
+    return is_complete;
+}
+
+int index_snapshot::coverage() const {
+    return coverage_percent;
+}
+
+size_t index_snapshot::slot_count() const {
+    return slot_total;
+}
+
+trigram_frequencies const& index_snapshot::frequencies() const {
+    return generation->frequencies;
+}
+
+tokenizer index_snapshot::words() const {
+    return generation->words;
+}
+
+token_postings const& index_snapshot::tokens() const {
+    return generation->tokens;
+}
+
+trigram_index::trigram_index() : files(0) {
+    reset(QString(), false, 0, tokenizer::none);
+}
+
+void trigram_index::reset(QString const& root, bool huge_pages, double bloom_false_positive_rate, tokenizer words) {
+    std::lock_guard<std::mutex> lock(writer);
+    this->root = root;
+    bloom_rate = bloom_false_positive_rate;
+    generation = std::make_shared<index_generation>(huge_pages);
+    generation->words = words;
+    // the pool shares ownership of the whole generation, so entries made in it stay valid
+    generation_pool = std::shared_ptr<arena_pool>(generation, &generation->arenas);
+    sealed.clear();
+    tail.clear();
+    slot_by_path.clear();
+    entry_by_content.clear();
+    files = 0;
+    publish_locked(0, false);
+}
+
+std::shared_ptr<arena_pool> trigram_index::pool() const {
+    std::lock_guard<std::mutex> lock(writer);
+    return generation_pool;
+}
+
+file_entry* trigram_index::allocate_entry(arena_pool* pool, size_t bytes, size_t align, char*& storage) {
+    file_entry* entry;
+    if (pool) {
+        arena& a = pool->local();
+        entry = a.allocate_array<file_entry>(1);
+        storage = static_cast<char*>(a.allocate(bytes, align));
+        entry->heap_allocated = false;
+    } else {
+        // the trigrams follow the entry in the same block, which free_entry deletes as a whole
+        char* memory = new char[sizeof(file_entry) + align - 1 + bytes];
+        entry = reinterpret_cast<file_entry*>(memory);
+        auto behind = reinterpret_cast<uintptr_t>(memory + sizeof(file_entry));
+        storage = reinterpret_cast<char*>((behind + align - 1) & ~uintptr_t(align - 1));
+        entry->heap_allocated = true;
+    }
+    entry->version = 0;
+    entry->content_hash = 0;
+    entry->same_as = nullptr;
+    entry->tokenized = false;
+    return entry;
+}
+
+const file_entry* trigram_index::build_entry(arena_pool* pool, trigram_counter& counter, qint64 size,
+                                            text_encoding encoding, vector<trigram> const* stop) const {
+    static const vector<trigram> none;
+    vector<trigram> const& skip = stop ? *stop : none;
+    double rate = bloom_rate.load();
+    size_t n = counter.size_without(skip);
+    char* storage;
+    file_entry* entry;
+    if (rate > 0) {
+        bloom_shape shape = bloom_shape::for_trigrams(n, rate);
+        entry = allocate_entry(pool, shape.words() * sizeof(uint64_t), bloom_shape::BLOCK_BYTES, storage);
+        entry->trigrams = counter.finish_bloom(reinterpret_cast<uint64_t*>(storage), shape, skip);
+    } else {
+        entry = allocate_entry(pool, n * (sizeof(trigram) + sizeof(uint32_t)), alignof(trigram), storage);
+        auto* keys = reinterpret_cast<trigram*>(storage);
+        entry->trigrams = counter.finish(keys, reinterpret_cast<uint32_t*>(keys + n), skip);
+    }
+    entry->size = size;
+    entry->encoding = encoding;
+    return entry;
+}
+
+const file_entry* trigram_index::build_entry(arena_pool* pool, file_trigrams const& trigrams, qint64 size,
+                                            text_encoding encoding, vector<trigram> const* stop) const {
+    double rate = bloom_rate.load();
+    auto kept = [stop](trigram t) {
+        return !stop || !std::binary_search(stop->begin(), stop->end(), t);
+    };
+    size_t n = trigrams.size;
+    if (!trigrams.bloom) {
+        n = size_t(std::count_if(trigrams.keys, trigrams.keys + trigrams.size, kept));
+    }
+    char* storage;
+    file_entry* entry;
+    // a filter cannot be turned back into counts, so one stays a filter
+    if (trigrams.bloom || rate > 0) {
+        bloom_shape shape = trigrams.bloom ? trigrams.shape : bloom_shape::for_trigrams(n, rate);
+        entry = allocate_entry(pool, shape.words() * sizeof(uint64_t), bloom_shape::BLOCK_BYTES, storage);
+        auto* words = reinterpret_cast<uint64_t*>(storage);
+        if (trigrams.bloom) {
+            std::copy(trigrams.bloom, trigrams.bloom + shape.words(), words);
+        } else {
+            std::fill(words, words + shape.words(), 0);
+            for (uint32_t i = 0; i < trigrams.size; i++) {
+                if (kept(trigrams.keys[i])) {
+                    shape.add(words, trigrams.keys[i]);
+                }
+            }
+        }
+        entry->trigrams = file_trigrams();
+        entry->trigrams.size = uint32_t(n);
+        entry->trigrams.bloom = words;
+        entry->trigrams.shape = shape;
+    } else {
+        entry = allocate_entry(pool, n * (sizeof(trigram) + sizeof(uint32_t)), alignof(trigram), storage);
+        auto* keys = reinterpret_cast<trigram*>(storage);
+        auto* counts = reinterpret_cast<uint32_t*>(keys + n);
+        size_t j = 0;
+        for (uint32_t i = 0; i < trigrams.size; i++) {
+            if (kept(trigrams.keys[i])) {
+                keys[j] = trigrams.keys[i];
+                counts[j] = trigrams.counts[i];
+                j++;
+            }
+        }
+        entry->trigrams = file_trigrams();
+        entry->trigrams.keys = keys;
+        entry->trigrams.counts = counts;
+        entry->trigrams.size = uint32_t(n);
+    }
+    entry->size = size;
+    entry->encoding = encoding;
+    return entry;
+}
+
+const file_entry* trigram_index::make_heap_entry(trigram_counter& counter, qint64 size,
+                                                text_encoding encoding) const {
+    return build_entry(nullptr, counter, size, encoding, nullptr);
+}
+
+const file_entry* trigram_index::make_heap_entry(file_trigrams const& trigrams, qint64 size,
+                                                text_encoding encoding) const {
+    return build_entry(nullptr, trigrams, size, encoding, nullptr);
+}
+
+const file_entry* trigram_index::make_entry(arena_pool& pool, trigram_counter& counter, qint64 size,
+                                           text_encoding encoding, uint64_t content_hash, token_collector* tokens) {
+    index_generation* current = generation_of(pool);
+    if (current) {
+        auto const& keys = counter.sorted_keys();
+        current->frequencies.add(keys.data(), keys.size());
+    }
+    if (const file_entry* copy = find_copy(pool, content_hash, size, encoding)) {
+        return copy;
+    }
+    auto stop = current ? current->frequencies.stop_trigrams() : nullptr;
+    auto* entry = const_cast<file_entry*>(build_entry(&pool, counter, size, encoding, stop.get()));
+    // copies share the postings of the first entry, searches look them up by it
+    if (current && tokens && current->words != tokenizer::none) {
+        current->tokens.add(entry, tokens->finish());
+        entry->tokenized = true;
+    }
+    remember_content(pool, entry, content_hash);
+    return entry;
+}
+
+const file_entry* trigram_index::make_entry(arena_pool& pool, file_trigrams const& trigrams, qint64 size,
+                                           text_encoding encoding, uint64_t content_hash) {
+    index_generation* current = generation_of(pool);
+    // a filter does not list its trigrams
+    if (current && !trigrams.bloom) {
+        current->frequencies.add(trigrams.keys, trigrams.size);
+    }
+    if (const file_entry* copy = find_copy(pool, content_hash, size, encoding)) {
+        return copy;
+    }
+    auto stop = current ? current->frequencies.stop_trigrams() : nullptr;
+    auto* entry = const_cast<file_entry*>(build_entry(&pool, trigrams, size, encoding, stop.get()));
+    remember_content(pool, entry, content_hash);
+    return entry;
+}
+
+index_generation* trigram_index::generation_of(arena_pool const& pool) {
+    std::lock_guard<std::mutex> lock(writer);
+    return &pool == generation_pool.get() ? generation.get() : nullptr;
+}
+
+const file_entry* trigram_index::find_copy(arena_pool& pool, uint64_t content_hash, qint64 size,
+                                          text_encoding encoding) {
+    const file_entry* original;
+    {
+        std::lock_guard<std::mutex> lock(writer);
+        if (&pool != generation_pool.get()) {
+            return nullptr;
+        }
+        original = entry_by_content.value(content_hash, nullptr);
+    }
+    if (!original || original->size != size || original->encoding != encoding) {
+        return nullptr;
+    }
+    // the trigrams live in the same arena pool as the copy, so they outlive it
+    auto* copy = pool.local().allocate_array<file_entry>(1);
+    *copy = *original;
+    copy->same_as = original;
+    return copy;
+}
+
+void trigram_index::remember_content(arena_pool const& pool, file_entry* entry, uint64_t content_hash) {
+    entry->content_hash = content_hash;
+    std::lock_guard<std::mutex> lock(writer);
+    // two copies read at once both become first entries, which only costs the sharing
+    if (&pool == generation_pool.get() && !entry_by_content.contains(content_hash)) {
+        entry_by_content.insert(content_hash, entry);
+    }
+}
+
+void trigram_index::free_entry(void* entry) {
+    delete[] static_cast<char*>(entry);
+}
+
+void trigram_index::set(QString const& path, const file_entry* entry, arena_pool const& pool) {
+    std::unique_lock<std::mutex> lock(writer);
+    if (&pool != generation_pool.get()) {
+        lock.unlock();
+        if (entry && entry->heap_allocated) {
+            free_entry(const_cast<file_entry*>(entry));
+        }
+        return;
+    }
+    file_slot* slot = slot_by_path.value(path, nullptr);
+    if (!slot) {
+        if (!entry) {
+            return;
+        }
+        generation->file_slots.emplace_back(path, entry);
+        slot = &generation->file_slots.back();
+        slot_by_path.insert(path, slot);
+        tail.push_back(slot);
+        files++;
+        if (tail.size() == CHUNK_SIZE) {
+            sealed.push_back(std::make_shared<const vector<file_slot*>>(std::move(tail)));
+            tail.clear();
+        }
+        return;
+    }
+    const file_entry* old = slot->entry.load(std::memory_order_relaxed);
+    if (entry && old) {
+        const_cast<file_entry*>(entry)->version = old->version + 1;
+    }
+    slot->entry.store(entry, std::memory_order_release);
+    if (old && !entry) {
+        files--;
+    } else if (!old && entry) {
+        files++;
+    }
+    if (old && old->heap_allocated) {
+        reclaimer.retire(const_cast<file_entry*>(old), free_entry);
+    }
+}
+
+void trigram_index::publish(int coverage, bool complete) {
+    std::lock_guard<std::mutex> lock(writer);
+    publish_locked(coverage, complete);
+}
+
+void trigram_index::publish() {
+    std::lock_guard<std::mutex> lock(writer);
+    publish_locked(published->coverage(), published->complete());
+}
+
+void trigram_index::publish_locked(int coverage, bool complete) {
+    auto s = std::make_shared<index_snapshot>();
+    s->generation = generation;
+    s->root_path = root;
+    s->chunks = sealed;
+    if (!tail.empty()) {
+        s->chunks.push_back(std::make_shared<const vector<file_slot*>>(tail));
+    }
+    for (auto& chunk : s->chunks) {
+        s->slot_total += chunk->size();
+    }
+    s->files = files;
+    s->is_complete = complete;
+    s->coverage_percent = coverage;
+    std::atomic_store(&published, std::shared_ptr<const index_snapshot>(s));
+}
+
+std::shared_ptr<const index_snapshot> trigram_index::snapshot() const {
+    return std::atomic_load(&published);
+}
+
+epoch_reclaimer::guard trigram_index::pin() {
+    return reclaimer.pin();
+}
@@ -0,0 +1,205 @@
+#ifndef TRIGRAM_INDEX_H
+#define TRIGRAM_INDEX_H
+
+#include <QHash>
+#include <QString>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "arena.h"
+#include "reclaimer.h"
+#include "trigrams.h"
+#include "trigram_frequencies.h"
+#include "token_index.h"
+#include "encoding.h"
+
+using std::vector;
+
+// Index data of one version of a file. It never changes after it was created:
+// an update makes a new version and swaps it into the slot of the file.
+struct file_entry {
+    file_trigrams trigrams;
+    qint64 size;
+    uint32_t version;
+    // trigrams are of the UTF-8 form of the text, verification transcodes the same way
+    text_encoding encoding;
+    // Entries of a scan live in the arena of their generation, entries of
+    // later updates are allocated one by one and reclaimed by epochs.
+    bool heap_allocated;
+    // XXH64 of the bytes of the file, 0 for entries of updates.
+    uint64_t content_hash;
+    // First entry of the scan with the same content, whose trigrams this one shares;
+    // null for that first entry itself. A search verifies the content once.
+    const file_entry* same_as;
+    // True if the tokens of the file are in the postings of its generation, so a whole-word
+    // or prefix query it does not match need not look at it.
+    bool tokenized;
+};
+
+// Stable place of a file in the index. Readers load the entry with a single
+// atomic read, writers replace it with a single atomic store.
+struct file_slot {
+    QString path;
+    std::atomic<const file_entry*> entry;
+
+    file_slot(QString path, const file_entry* entry) : path(std::move(path)), entry(entry) {}
+};
+
+struct indexed_file {
+    QString const& path;
+    const file_entry* entry;
+};
+
+// Everything an index built by one scan owns. Kept alive by snapshots.
+class index_generation {
+public:
+    explicit index_generation(bool huge_pages);
+    ~index_generation();
+
+    arena_pool arenas;
+    std::deque<file_slot> file_slots;
+    // of the files of the scan, updates are not counted
+    trigram_frequencies frequencies;
+    tokenizer words = tokenizer::none;
+    // of the text files of the scan, archive members and updates are left out
+    token_postings tokens;
+};
+
+// View of the set of files at some moment. Searches take one at the start and
+// keep it for the whole query, so they never block the indexer. The entries
+// behind the slots can still be replaced by file updates; pin the reclaimer of
+// the index while reading them.
+class index_snapshot {
+public:
+    size_t size() const;
+    QString const& root() const;
+    bool complete() const;
+    // Percentage of the tree that had been walked when the snapshot was taken.
+    int coverage() const;
+    // Number of slots, removed files included; positions of for_each_from are below it.
+    size_t slot_count() const;
+    // Frequencies of the trigrams in the files of the index. Entries may lack the stop
+    // trigrams, so queries must skip them; take them after the snapshot itself.
+    trigram_frequencies const& frequencies() const;
+    // What the tokens of tokenized entries are, and their postings.
+    tokenizer words() const;
+    token_postings const& tokens() const;
+
+    // Calls f for every indexed file until it returns false.
+    template<typename F>
+    void for_each(F f) const {
+        for (auto& chunk : chunks) {
+            for (file_slot* slot : *chunk) {
+                const file_entry* entry = slot->entry.load(std::memory_order_acquire);
+                if (entry && !f(indexed_file{slot->path, entry})) {
+                    return;
+                }
+            }
+        }
+    }
+    // Calls f(file, position) for every indexed file from the slot at position on until it returns
+    // false. Removed files keep their positions, so a position means the same file for the whole
+    // life of the snapshot.
+    template<typename F>
+    void for_each_from(size_t position, F f) const {
+        size_t chunk_start = 0;
+        for (auto& chunk : chunks) {
+            if (position >= chunk_start + chunk->size()) {
+                chunk_start += chunk->size();
+                continue;
+            }
+            for (size_t i = position - chunk_start; i < chunk->size(); i++) {
+                file_slot* slot = (*chunk)[i];
+                const file_entry* entry = slot->entry.load(std::memory_order_acquire);
+                if (entry && !f(indexed_file{slot->path, entry}, chunk_start + i)) {
+                    return;
+                }
+            }
+            chunk_start += chunk->size();
+            position = chunk_start;
+        }
+    }
+
+private:
+    friend class trigram_index;
+
+    std::shared_ptr<index_generation> generation;
+    vector<std::shared_ptr<const vector<file_slot*>>> chunks;
+    QString root_path;
+    size_t files = 0;
+    size_t slot_total = 0;
+    bool is_complete = false;
+    int coverage_percent = 0;
+};
+
+// Writer side of the index. Writers are serialized by a mutex, readers only
+// touch published snapshots and slot entries and never lock.
+class trigram_index {
+public:
+    trigram_index();
+
+    // Drops the index. Memory is released once the last snapshot is gone. With a false positive
+    // rate above 0 the new index keeps Bloom filters of the trigrams instead of their counts,
+    // and unless words is none it also keeps the postings of the tokens its entries are made with.
+    void reset(QString const& root, bool huge_pages, double bloom_false_positive_rate, tokenizer words);
+    // Arenas of the current index generation. Entries must be made in the
+    // pool of the generation they are added to.
+    std::shared_ptr<arena_pool> pool() const;
+    // Entries of a scan. Content already indexed in this generation gets an entry that
+    // shares the trigrams of the first one and points to it. The tokens of the file, if
+    // collected, go to the postings.
+    const file_entry* make_entry(arena_pool& pool, trigram_counter& counter, qint64 size, text_encoding encoding,
+                                 uint64_t content_hash, token_collector* tokens = nullptr);
+    // From trigrams kept elsewhere, such as the members of cached archives.
+    const file_entry* make_entry(arena_pool& pool, file_trigrams const& trigrams, qint64 size,
+                                 text_encoding encoding, uint64_t content_hash);
+    // Entries of file updates, freed one by one.
+    const file_entry* make_heap_entry(trigram_counter& counter, qint64 size, text_encoding encoding) const;
+    const file_entry* make_heap_entry(file_trigrams const& trigrams, qint64 size, text_encoding encoding) const;
+    // Adds or replaces the entry of a file, null removes the file. Entries made
+    // in the pool of an older generation are ignored. Replaced heap entries
+    // are retired and freed when no search can see them any more.
+    void set(QString const& path, const file_entry* entry, arena_pool const& pool);
+    void publish(int coverage, bool complete);
+    // Publishes pending changes, keeping the coverage of the last snapshot.
+    void publish();
+    std::shared_ptr<const index_snapshot> snapshot() const;
+    epoch_reclaimer::guard pin();
+
+private:
+    static const size_t CHUNK_SIZE = 4096;
+
+    mutable std::mutex writer;
+    std::shared_ptr<index_generation> generation;
+    std::shared_ptr<arena_pool> generation_pool;
+    vector<std::shared_ptr<const vector<file_slot*>>> sealed;
+    vector<file_slot*> tail;
+    QHash<QString, file_slot*> slot_by_path;
+    // first entries of the generation by their content hash
+    QHash<quint64, const file_entry*> entry_by_content;
+    size_t files;
+    std::shared_ptr<const index_snapshot> published;
+    QString root;
+    std::atomic<double> bloom_rate{0};
+    epoch_reclaimer reclaimer;
+
+    void publish_locked(int coverage, bool complete);
+    // An entry with room for the trigrams at storage, in the pool or on the heap if it is null.
+    static file_entry* allocate_entry(arena_pool* pool, size_t bytes, size_t align, char*& storage);
+    // Entries leave out the stop trigrams unless they are null.
+    const file_entry* build_entry(arena_pool* pool, trigram_counter& counter, qint64 size, text_encoding encoding,
+                                  vector<trigram> const* stop) const;
+    const file_entry* build_entry(arena_pool* pool, file_trigrams const& trigrams, qint64 size,
+                                  text_encoding encoding, vector<trigram> const* stop) const;
+    // Generation of the pool, null if it is not the current one.
+    index_generation* generation_of(arena_pool const& pool);
+    // Entry sharing the trigrams of the first one with this content, null if there is none
+    // or the pool is not of the current generation.
+    const file_entry* find_copy(arena_pool& pool, uint64_t content_hash, qint64 size, text_encoding encoding);
+    void remember_content(arena_pool const& pool, file_entry* entry, uint64_t content_hash);
+    static void free_entry(void* entry);
+};
+
+#endif // TRIGRAM_INDEX_H
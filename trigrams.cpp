@@ -0,0 +1,254 @@
+#include "trigrams.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <memory>
+
+const trigram trigram_counter::EMPTY;
+const size_t bloom_shape::BLOCK_WORDS;
+const size_t bloom_shape::BLOCK_BYTES;
+
+namespace {
+    uint64_t mix(uint64_t x) {
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+        return x ^ (x >> 31);
+    }
+}
+
+bloom_shape bloom_shape::for_trigrams(size_t n, double false_positive_rate) {
+    // the textbook optimum: -ln(p) / ln(2)^2 bits and ln(2) bits per hash for every key
+    double rate = std::min(std::max(false_positive_rate, 1e-6), 0.5);
+    double bits_per_trigram = -std::log(rate) / (std::log(2.0) * std::log(2.0));
+    bloom_shape shape;
+    shape.hashes = (uint32_t) std::max(1.0, std::round(bits_per_trigram * std::log(2.0)));
+    double bits = std::max(1.0, bits_per_trigram * double(n));
+    shape.blocks = (uint32_t) std::ceil(bits / (BLOCK_BYTES * 8));
+    return shape;
+}
+
+size_t bloom_shape::words() const {
+    return size_t(blocks) * BLOCK_WORDS;
+}
+
+// The high half of the hash picks the block, a second hash gives the bits by double hashing.
+void bloom_shape::add(uint64_t* words, trigram t) const {
+    uint64_t h = mix(t);
+    uint64_t* block = words + ((h >> 32) * blocks >> 32) * BLOCK_WORDS;
+    uint64_t g = mix(h);
+    auto a = uint32_t(g);
+    auto b = uint32_t(g >> 32) | 1;
+    for (uint32_t i = 0; i < hashes; i++) {
+        uint32_t bit = (a + i * b) & (BLOCK_BYTES * 8 - 1);
+        block[bit >> 6] |= uint64_t(1) << (bit & 63);
+    }
+}
+
+bool bloom_shape::may_contain(const uint64_t* words, trigram t) const {
+    uint64_t h = mix(t);
+    const uint64_t* block = words + ((h >> 32) * blocks >> 32) * BLOCK_WORDS;
+    uint64_t g = mix(h);
+    auto a = uint32_t(g);
+    auto b = uint32_t(g >> 32) | 1;
+    for (uint32_t i = 0; i < hashes; i++) {
+        uint32_t bit = (a + i * b) & (BLOCK_BYTES * 8 - 1);
+        if (!(block[bit >> 6] & (uint64_t(1) << (bit & 63)))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+uint32_t file_trigrams::count(trigram t) const {
+    if (bloom) {
+        return shape.may_contain(bloom, t) ? std::numeric_limits<uint32_t>::max() : 0;
+    }
+    const trigram* it = std::lower_bound(keys, keys + size, t);
+    if (it == keys + size || *it != t) {
+        return 0;
+    }
+    return counts[it - keys];
+}
+
+bool file_trigrams::contains_bytes(const char* s, size_t len) const {
+    // a text shorter than a trigram has none, it may hold any needle that short
+    if (size == 0) {
+        return true;
+    }
+    if (bloom) {
+        // a pair of bytes is in one of the trigrams starting or ending with it; a single byte
+        // would take too many probes to be worth it
+        if (len != 2) {
+            return true;
+        }
+        for (unsigned c = 0; c < 256; c++) {
+            if (shape.may_contain(bloom, make_trigram(s[0], s[1], c)) ||
+                shape.may_contain(bloom, make_trigram(c, s[0], s[1]))) {
+                return true;
+            }
+        }
+        return false;
+    }
+    for (uint32_t i = 0; i < size; i++) {
+        char t[3] = {char(keys[i] >> 16), char(keys[i] >> 8), char(keys[i])};
+        if (std::search(t, t + 3, s, s + len) != t + 3) {
+            return true;
+        }
+    }
+    return false;
+}
+
+trigram_counter::trigram_counter(size_t threshold) : threshold(threshold), window(0), seen(0) {
+    size_t capacity = 1;
+    while (capacity < threshold * 3 / 2 + 2) {
+        capacity <<= 1;
+    }
+    mask = capacity - 1;
+    keys.assign(capacity, EMPTY);
+    counts.assign(capacity, 0);
+    used.reserve(threshold + 1);
+}
+
+trigram_counter& trigram_counter::local(size_t threshold) {
+    thread_local std::unique_ptr<trigram_counter> counter;
+    if (!counter || counter->threshold != threshold) {
+        counter.reset(new trigram_counter(threshold));
+    }
+    return *counter;
+}
+
+void trigram_counter::reset() {
+    for (uint32_t slot : used) {
+        keys[slot] = EMPTY;
+        counts[slot] = 0;
+    }
+    used.clear();
+    window = 0;
+    seen = 0;
+}
+
+void trigram_counter::add(trigram t) {
+    size_t slot = (t * 2654435761u) & mask;
+    while (keys[slot] != t) {
+        if (keys[slot] == EMPTY) {
+            keys[slot] = t;
+            used.push_back(uint32_t(slot));
+            break;
+        }
+        slot = (slot + 1) & mask;
+    }
+    counts[slot]++;
+}
+
+bool trigram_counter::feed(const char* data, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        window = ((window << 8) | (unsigned char) data[i]) & 0xFFFFFFu;
+        if (++seen >= 3) {
+            add(window);
+            if (overflowed()) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool trigram_counter::overflowed() const {
+    return used.size() > threshold;
+}
+
+size_t trigram_counter::size() const {
+    return used.size();
+}
+
+size_t file_trigrams::bytes() const {
+    if (bloom) {
+        return shape.words() * sizeof(uint64_t);
+    }
+    return size_t(size) * (sizeof(trigram) + sizeof(uint32_t));
+}
+
+file_trigrams trigram_counter::finish(arena& a) {
+    return finish(a.allocate_array<trigram>(used.size()), a.allocate_array<uint32_t>(used.size()));
+}
+
+bool trigram_counter::contains(trigram t) const {
+    size_t slot = (t * 2654435761u) & mask;
+    while (keys[slot] != t) {
+        if (keys[slot] == EMPTY) {
+            return false;
+        }
+        slot = (slot + 1) & mask;
+    }
+    return true;
+}
+
+size_t trigram_counter::size_without(std::vector<trigram> const& skip) const {
+    size_t n = used.size();
+    for (trigram t : skip) {
+        n -= contains(t);
+    }
+    return n;
+}
+
+void trigram_counter::sort_used() {
+    std::sort(used.begin(), used.end(), [this](uint32_t x, uint32_t y) {
+        return keys[x] < keys[y];
+    });
+}
+
+std::vector<trigram> const& trigram_counter::sorted_keys() {
+    sort_used();
+    ordered.clear();
+    for (uint32_t slot : used) {
+        ordered.push_back(keys[slot]);
+    }
+    return ordered;
+}
+
+file_trigrams trigram_counter::finish(trigram* k, uint32_t* c) {
+    return finish(k, c, std::vector<trigram>());
+}
+
+file_trigrams trigram_counter::finish(trigram* k, uint32_t* c, std::vector<trigram> const& skip) {
+    sort_used();
+    size_t n = 0;
+    auto skipped = skip.begin();
+    for (uint32_t slot : used) {
+        while (skipped != skip.end() && *skipped < keys[slot]) {
+            ++skipped;
+        }
+        if (skipped != skip.end() && *skipped == keys[slot]) {
+            continue;
+        }
+        k[n] = keys[slot];
+        c[n] = counts[slot];
+        n++;
+    }
+    file_trigrams result;
+    result.size = uint32_t(n);
+    result.keys = k;
+    result.counts = c;
+    return result;
+}
+
+file_trigrams trigram_counter::finish_bloom(uint64_t* words, bloom_shape shape) {
+    return finish_bloom(words, shape, std::vector<trigram>());
+}
+
+file_trigrams trigram_counter::finish_bloom(uint64_t* words, bloom_shape shape, std::vector<trigram> const& skip) {
+    std::memset(words, 0, shape.words() * sizeof(uint64_t));
+    size_t n = 0;
+    for (uint32_t slot : used) {
+        if (!std::binary_search(skip.begin(), skip.end(), keys[slot])) {
+            shape.add(words, keys[slot]);
+            n++;
+        }
+    }
+    file_trigrams result;
+    result.size = uint32_t(n);
+    result.bloom = words;
+    result.shape = shape;
+    return result;
+}
@@ -0,0 +1,95 @@
+#ifndef TRIGRAMS_H
+#define TRIGRAMS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "arena.h"
+
+// Three bytes packed into the low 24 bits.
+using trigram = uint32_t;
+
+inline trigram make_trigram(unsigned char a, unsigned char b, unsigned char c) {
+    return (trigram(a) << 16) | (trigram(b) << 8) | trigram(c);
+}
+
+// Layout of a blocked Bloom filter of trigrams. Every trigram sets its bits in
+// one 512-bit block picked by its hash, so a probe reads a single cache line.
+struct bloom_shape {
+    static const size_t BLOCK_WORDS = 8;
+    static const size_t BLOCK_BYTES = BLOCK_WORDS * sizeof(uint64_t);
+
+    uint32_t blocks = 0;
+    uint32_t hashes = 0;
+
+    // Smallest filter that holds n trigrams at about the false positive rate.
+    static bloom_shape for_trigrams(size_t n, double false_positive_rate);
+    size_t words() const;
+    void add(uint64_t* words, trigram t) const;
+    bool may_contain(const uint64_t* words, trigram t) const;
+};
+
+// Immutable trigrams of a single file, in an arena owned by the index: the
+// sorted keys with their counts, or only a Bloom filter of the keys in the
+// low-memory mode.
+struct file_trigrams {
+    const trigram* keys = nullptr;
+    const uint32_t* counts = nullptr;
+    // number of distinct trigrams
+    uint32_t size = 0;
+    const uint64_t* bloom = nullptr;
+    bloom_shape shape;
+
+    // A Bloom filter does not know counts: a trigram that may be present counts UINT32_MAX.
+    uint32_t count(trigram t) const;
+    // Whether a needle shorter than a trigram may be in the text. True for texts without trigrams.
+    bool contains_bytes(const char* s, size_t len) const;
+    // Memory of the keys and counts or of the filter.
+    size_t bytes() const;
+};
+
+// Per-thread scratch table used while a single file is being read. It has a
+// fixed capacity, so it never allocates after the first use on a thread.
+class trigram_counter {
+public:
+    explicit trigram_counter(size_t threshold);
+
+    static trigram_counter& local(size_t threshold);
+
+    void reset();
+    // Returns false as soon as the file has more distinct trigrams than the
+    // threshold, i.e. it is most likely binary.
+    bool feed(const char* data, size_t size);
+    bool overflowed() const;
+    size_t size() const;
+    // Number of trigrams that are not in the sorted skip list.
+    size_t size_without(std::vector<trigram> const& skip) const;
+    // The distinct trigrams in ascending order, valid until the next feed or reset.
+    std::vector<trigram> const& sorted_keys();
+    file_trigrams finish(arena& a);
+    // Writes the sorted counts into arrays of size() elements.
+    file_trigrams finish(trigram* keys, uint32_t* counts);
+    // The same without the trigrams of the sorted skip list, into arrays of size_without(skip) elements.
+    file_trigrams finish(trigram* keys, uint32_t* counts, std::vector<trigram> const& skip);
+    // Writes the filter of the keys into shape.words() words.
+    file_trigrams finish_bloom(uint64_t* words, bloom_shape shape);
+    file_trigrams finish_bloom(uint64_t* words, bloom_shape shape, std::vector<trigram> const& skip);
+
+private:
+    static const trigram EMPTY = 0xFFFFFFFFu;
+
+    size_t threshold;
+    size_t mask;
+    std::vector<trigram> keys;
+    std::vector<uint32_t> counts;
+    std::vector<uint32_t> used;
+    std::vector<trigram> ordered;
+    uint32_t window;
+    size_t seen;
+
+    void add(trigram t);
+    bool contains(trigram t) const;
+    void sort_used();
+};
+
+#endif // TRIGRAMS_H